@@ -0,0 +1,123 @@
+#include "font-cache.h"
+#include "font-fallback.h"
+
+/* Entries kept after their last user has gone */
+#define FONT_CACHE_MAX_UNUSED 8
+
+struct _FontCacheEntry
+{
+  gint ref_count;
+  gchar *key;
+
+  PangoFontDescription *desc;
+  PangoFont *font;
+};
+
+static GHashTable *entries = NULL;
+static GQueue *unused = NULL;
+static FontCacheStats stats = { 0, };
+
+static void
+entry_free(FontCacheEntry *entry)
+{
+  g_hash_table_remove(entries, entry->key);
+  if (entry->font)
+    g_object_unref(entry->font);
+  pango_font_description_free(entry->desc);
+  g_free(entry->key);
+  g_free(entry);
+}
+
+/* Returns the entry for @name at @size points, loading the font through the
+   Pango context of @widget if nobody has done so yet */
+FontCacheEntry *
+font_cache_get(GtkWidget *widget, const gchar *name, gint size)
+{
+  FontCacheEntry *entry;
+  PangoContext *context;
+  gchar *key;
+
+  /* The fallbacks are part of the description, and of the key */
+  key = g_strdup_printf("%s%s %d", name, font_fallback_get_families(), size);
+
+  if (!entries) {
+    entries = g_hash_table_new(g_str_hash, g_str_equal);
+    unused = g_queue_new();
+  }
+
+  if ((entry = g_hash_table_lookup(entries, key)) != NULL) {
+    g_free(key);
+    stats.hits++;
+    if (entry->ref_count == 0)
+      g_queue_remove(unused, entry);
+    return font_cache_entry_ref(entry);
+  }
+
+  stats.misses++;
+
+  entry = g_new0(FontCacheEntry, 1);
+  entry->ref_count = 1;
+  entry->key = key;
+  entry->desc = pango_font_description_from_string(key);
+
+  context = gtk_widget_get_pango_context(widget);
+  entry->font = pango_context_load_font(context, entry->desc);
+
+  g_hash_table_insert(entries, entry->key, entry);
+
+  return entry;
+}
+
+FontCacheEntry *
+font_cache_entry_ref(FontCacheEntry *entry)
+{
+  g_return_val_if_fail(entry != NULL, NULL);
+
+  entry->ref_count++;
+
+  return entry;
+}
+
+void
+font_cache_entry_unref(FontCacheEntry *entry)
+{
+  g_return_if_fail(entry != NULL);
+
+  if (--(entry->ref_count) > 0)
+    return;
+
+  g_queue_push_tail(unused, entry);
+  while (g_queue_get_length(unused) > FONT_CACHE_MAX_UNUSED) {
+    entry_free(g_queue_pop_head(unused));
+    stats.evictions++;
+  }
+}
+
+const PangoFontDescription *
+font_cache_entry_get_description(FontCacheEntry *entry)
+{
+  return entry->desc;
+}
+
+/* Unloads the fonts nobody is using. Returns how many there were. */
+guint
+font_cache_trim(void)
+{
+  guint n = 0;
+
+  while (unused && !g_queue_is_empty(unused)) {
+    entry_free(g_queue_pop_head(unused));
+    stats.evictions++;
+    n++;
+  }
+
+  return n;
+}
+
+void
+font_cache_get_stats(FontCacheStats *stats_out)
+{
+  (*stats_out) = stats;
+  stats_out->n_entries = entries ? g_hash_table_size(entries) : 0;
+  stats_out->n_unused = unused ? g_queue_get_length(unused) : 0;
+}
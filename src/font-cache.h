@@ -0,0 +1,37 @@
+#ifndef _FONT_CACHE_H_
+#define _FONT_CACHE_H_
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Fonts loaded once for the whole process and shared by all terminals using
+   the same font at the same size. An entry holds on to the loaded font, so
+   Pango's font map keeps it and the next window setting that font need not
+   match and open it again. Entries nobody uses any more are kept for a
+   while, least recently used ones going first. */
+typedef struct _FontCacheEntry FontCacheEntry;
+
+typedef struct
+{
+  guint hits;
+  guint misses;
+  guint evictions;
+  guint n_entries;
+  guint n_unused;
+} FontCacheStats;
+
+/* The fallbacks for @name must have been set up with
+   font_fallback_set_primary() */
+FontCacheEntry             *font_cache_get(GtkWidget *widget, const gchar *name, gint size);
+FontCacheEntry             *font_cache_entry_ref(FontCacheEntry *entry);
+void                        font_cache_entry_unref(FontCacheEntry *entry);
+
+const PangoFontDescription *font_cache_entry_get_description(FontCacheEntry *entry);
+
+guint                       font_cache_trim(void);
+void                        font_cache_get_stats(FontCacheStats *stats);
+
+G_END_DECLS
+
+#endif /* !_FONT_CACHE_H_ */
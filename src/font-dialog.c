@@ -1,5 +1,8 @@
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <fontconfig/fontconfig.h>
+#include <pango/pangofc-fontmap.h>
 #include <vte/vte.h>
 #include <gconf/gconf-client.h>
 #include <hildon/hildon.h>
@@ -10,8 +13,6 @@
 
 enum {
   FONT_NAME_STRING_COLUMN,
-  FONT_NAME_FAMILY_COLUMN,
-  FONT_NAME_FACE_COLUMN,
   FONT_NAME_PFD_COLUMN
 };
 
@@ -40,10 +41,22 @@ typedef struct
   GtkWidget *reverse_button;
   GtkWidget *scroll_button;
   GtkWidget *scrollback_entry;
+
+  /* Row of each font in tm_name, by description */
+  GHashTable *name_rows;
+  /* The font to select once the list is in */
+  char *initial_name;
+  int initial_size;
 } FontDialog;
 
 static FontDialog font_dialog = { NULL };
 
+/* The monospace fonts, as font description strings, once known. Listing them
+   takes a while with many fonts installed, so it is done on a thread, and the
+   result is kept on disk for as long as the installed fonts stay the same. */
+static GPtrArray *font_list = NULL;
+static gboolean font_list_pending = FALSE;
+
 static const guint8 font_sizes[] = {6, 8, 10, 12, 16, 24, 32};
 
 static void
@@ -80,39 +93,184 @@ select_iter(GtkTreeView *tv, GtkTreeModel *tm, GtkTreeIter *itr)
 }
 
 static int
-compare_faces(PangoFontFace **p_face1, PangoFontFace **p_face2, gpointer null)
+compare_descriptions(PangoFontDescription **p_pfd1, PangoFontDescription **p_pfd2, gpointer null)
 {
-  /* most sig. ... weight ... style ... stretch ... variant ... least sig. */
+  /* most sig. ... family ... weight ... style ... stretch ... variant ... least sig. */
+
+  int family, weight1, style1, stretch1, variant1,
+              weight2, style2, stretch2, variant2;
 
-  PangoFontDescription *pfd1 = pango_font_face_describe((*p_face1)), *pfd2 = pango_font_face_describe((*p_face2));
+  family = g_ascii_strcasecmp(pango_font_description_get_family((*p_pfd1)),
+                              pango_font_description_get_family((*p_pfd2)));
 
-  int weight1, style1, stretch1, variant1,
-      weight2, style2, stretch2, variant2;
+  weight1  = pango_font_description_get_weight((*p_pfd1));
+  style1   = pango_font_description_get_style((*p_pfd1));
+  stretch1 = pango_font_description_get_stretch((*p_pfd1));
+  variant1 = pango_font_description_get_variant((*p_pfd1));
 
-  weight1  = pango_font_description_get_weight(pfd1);
-  style1   = pango_font_description_get_style(pfd1);
-  stretch1 = pango_font_description_get_stretch(pfd1);
-  variant1 = pango_font_description_get_variant(pfd1);
+  weight2  = pango_font_description_get_weight((*p_pfd2));
+  style2   = pango_font_description_get_style((*p_pfd2));
+  stretch2 = pango_font_description_get_stretch((*p_pfd2));
+  variant2 = pango_font_description_get_variant((*p_pfd2));
 
-  pango_font_description_free(pfd1);
+  return
+    (family != 0)
+      ? family
+      : (weight1 != weight2)
+        ? ((weight1 < weight2) ? -1 : 1)
+        : (style1 != style2)
+          ? ((style1 < style2) ? -1 : 1)
+          : (stretch1 != stretch2)
+            ? ((stretch1 < stretch2) ? -1 : 1)
+            : (variant1 != variant2)
+              ? ((variant1 < variant2) ? -1 : 1)
+              : 0;
+}
 
-  weight2  = pango_font_description_get_weight(pfd2);
-  style2   = pango_font_description_get_style(pfd2);
-  stretch2 = pango_font_description_get_stretch(pfd2);
-  variant2 = pango_font_description_get_variant(pfd2);
+static char *
+font_list_file_name(void)
+{
+  return g_build_filename(g_get_home_dir(), ".cache", "osso-xterm", "font-list", NULL);
+}
 
-  pango_font_description_free(pfd2);
+/* Changes whenever fonts are added or removed, or fontconfig rebuilds its
+   caches */
+static char *
+font_list_stamp(FcConfig *config)
+{
+  FcStrList *dirs[2];
+  FcChar8 *dir;
+  struct stat st;
+  time_t newest = 0;
+  int Nix;
 
-  return
-    (weight1 != weight2)
-      ? ((weight1 < weight2) ? -1 : 1)
-      : (style1 != style2)
-        ? ((style1 < style2) ? -1 : 1)
-        : (stretch1 != stretch2)
-          ? ((stretch1 < stretch2) ? -1 : 1)
-          : (variant1 != variant2)
-            ? ((variant1 < variant2) ? -1 : 1)
-            : 0;
+  dirs[0] = FcConfigGetFontDirs(config);
+  dirs[1] = FcConfigGetCacheDirs(config);
+
+  for (Nix = 0 ; Nix < G_N_ELEMENTS(dirs) ; Nix++)
+    if (dirs[Nix]) {
+      while ((dir = FcStrListNext(dirs[Nix])) != NULL)
+        if (stat((const char *)dir, &st) == 0 && st.st_mtime > newest)
+          newest = st.st_mtime;
+      FcStrListDone(dirs[Nix]);
+    }
+
+  return g_strdup_printf("%ld", (long)newest);
+}
+
+static GPtrArray *
+font_list_load(const char *stamp)
+{
+  char *file_name = font_list_file_name(), *contents = NULL, **lines;
+  GPtrArray *list = NULL;
+  int Nix;
+
+  if (g_file_get_contents(file_name, &contents, NULL, NULL)) {
+    lines = g_strsplit(contents, "\n", -1);
+    if (lines[0] && !strcmp(lines[0], stamp)) {
+      list = g_ptr_array_new();
+      for (Nix = 1 ; lines[Nix] ; Nix++)
+        if (lines[Nix][0])
+          g_ptr_array_add(list, g_strdup(lines[Nix]));
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+  g_free(file_name);
+
+  return list;
+}
+
+static void
+font_list_save(const char *stamp, GPtrArray *list)
+{
+  char *file_name = font_list_file_name(), *dir_name = g_path_get_dirname(file_name);
+  GString *str = g_string_new(stamp);
+  int Nix;
+
+  g_string_append_c(str, '\n');
+  for (Nix = 0 ; Nix < list->len ; Nix++)
+    g_string_append_printf(str, "%s\n", (char *)g_ptr_array_index(list, Nix));
+
+  g_mkdir_with_parents(dir_name, 0700);
+  g_file_set_contents(file_name, str->str, str->len, NULL);
+
+  g_string_free(str, TRUE);
+  g_free(dir_name);
+  g_free(file_name);
+}
+
+/* Lists the monospace faces the way Pango describes them, sorted as they are
+   shown */
+static GPtrArray *
+font_list_enumerate(FcConfig *config)
+{
+  FcPattern *pattern = FcPatternCreate();
+  FcObjectSet *os = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_WEIGHT, FC_SLANT, FC_WIDTH, FC_SPACING, NULL);
+  FcFontSet *set = FcFontList(config, pattern, os);
+  GPtrArray *pfds = g_ptr_array_new(), *list = g_ptr_array_new();
+  char *str, *prev = NULL;
+  int Nix, spacing;
+
+  for (Nix = 0 ; set && Nix < set->nfont ; Nix++)
+    if (FcPatternGetInteger(set->fonts[Nix], FC_SPACING, 0, &spacing) == FcResultMatch && spacing >= FC_DUAL)
+      g_ptr_array_add(pfds, pango_fc_font_description_from_pattern(set->fonts[Nix], FALSE));
+
+  g_qsort_with_data(pfds->pdata, pfds->len, sizeof(PangoFontDescription *), (GCompareDataFunc)compare_descriptions, NULL);
+
+  for (Nix = 0 ; Nix < pfds->len ; Nix++) {
+    str = pango_font_description_to_string(g_ptr_array_index(pfds, Nix));
+    /* Some faces come in several files */
+    if (prev && !strcmp(prev, str))
+      g_free(str);
+    else
+      g_ptr_array_add(list, (prev = str));
+    pango_font_description_free(g_ptr_array_index(pfds, Nix));
+  }
+
+  g_ptr_array_free(pfds, TRUE);
+  if (set)
+    FcFontSetDestroy(set);
+  FcObjectSetDestroy(os);
+  FcPatternDestroy(pattern);
+
+  return list;
+}
+
+static void fill_font_list(FontDialog *fd);
+
+static gboolean
+font_list_ready(GPtrArray *list)
+{
+  font_list = list;
+  font_list_pending = FALSE;
+
+  if (font_dialog.dlg)
+    fill_font_list(&font_dialog);
+
+  return FALSE;
+}
+
+static gpointer
+font_list_thread(gpointer null)
+{
+  /* A configuration of our own, so as not to share one with the rendering
+     going on in the main thread */
+  FcConfig *config = FcInitLoadConfigAndFonts();
+  char *stamp = font_list_stamp(config);
+  GPtrArray *list = font_list_load(stamp);
+
+  if (!list) {
+    list = font_list_enumerate(config);
+    font_list_save(stamp, list);
+  }
+
+  g_free(stamp);
+  FcConfigDestroy(config);
+
+  g_idle_add((GSourceFunc)font_list_ready, list);
+
+  return NULL;
 }
 
 static void
@@ -121,35 +279,27 @@ select_font(char *name, int size, FontDialog *fd)
   gboolean do_break = FALSE;
   GtkTreeIter itr;
   GtkTreeModel *tm;
-  char *str = g_strdup_printf("%s %d", name, size);
-  PangoFontDescription *pfd = pango_font_description_from_string(str),
-                       *pfd_list = NULL; 
-  PangoFontFamily *family = NULL;
-  PangoFontFace *face = NULL;
+  GtkTreeRowReference *row;
+  PangoFontDescription *pfd = pango_font_description_from_string(name);
+  char *str;
   int list_size = 0;
 
-  tm = gtk_tree_view_get_model(fd->tv_name);
-  if (gtk_tree_model_get_iter_first(tm, &itr))
-    do {
-      gtk_tree_model_get(tm, &itr, FONT_NAME_FAMILY_COLUMN, &family, FONT_NAME_FACE_COLUMN, &face, -1);
-      if (!strcmp(pango_font_family_get_name(family), pango_font_description_get_family(pfd))) {
-        pfd_list = pango_font_face_describe(face);
-        do_break = ((pango_font_description_get_weight(pfd_list)  == pango_font_description_get_weight(pfd)  &&
-                     pango_font_description_get_style(pfd_list)   == pango_font_description_get_style(pfd)   &&
-                     pango_font_description_get_stretch(pfd_list) == pango_font_description_get_stretch(pfd) &&
-                     pango_font_description_get_variant(pfd_list) == pango_font_description_get_variant(pfd)));
-        pango_font_description_free(pfd_list);
-        if (do_break) break;
-      }
-    } while (gtk_tree_model_iter_next(tm, &itr));
+  /* Look the font up the way the list describes it */
+  pango_font_description_unset_fields(pfd, PANGO_FONT_MASK_SIZE);
+  str = pango_font_description_to_string(pfd);
+  if (fd->name_rows && (row = g_hash_table_lookup(fd->name_rows, str)) != NULL) {
+    GtkTreePath *tp = gtk_tree_row_reference_get_path(row);
 
-  if (do_break)
-    select_iter(fd->tv_name, tm, &itr);
+    if (tp) {
+      if (gtk_tree_model_get_iter(fd->tm_name, &itr, tp))
+        select_iter(fd->tv_name, fd->tm_name, &itr);
+      gtk_tree_path_free(tp);
+    }
+  }
 
   pango_font_description_free(pfd);
   g_free(str);
 
-  do_break = FALSE;
   tm = gtk_tree_view_get_model(fd->tv_size);
   if (gtk_tree_model_get_iter_first(tm, &itr))
     do {
@@ -162,6 +312,35 @@ select_font(char *name, int size, FontDialog *fd)
     select_iter(fd->tv_size, tm, &itr);
 }
 
+static void
+fill_font_list(FontDialog *fd)
+{
+  GtkListStore *ls_name = GTK_LIST_STORE(fd->tm_name);
+  PangoFontDescription *pfd;
+  GtkTreeIter itr;
+  GtkTreePath *tp;
+  char *str;
+  int Nix;
+
+  gtk_list_store_clear(ls_name);
+  for (Nix = 0 ; Nix < font_list->len ; Nix++) {
+    str = g_ptr_array_index(font_list, Nix);
+    pfd = pango_font_description_from_string(str);
+    gtk_list_store_append(ls_name, &itr);
+    gtk_list_store_set(ls_name, &itr, FONT_NAME_STRING_COLUMN, str, FONT_NAME_PFD_COLUMN, pfd, -1);
+    pango_font_description_free(pfd);
+
+    tp = gtk_tree_model_get_path(fd->tm_name, &itr);
+    g_hash_table_insert(fd->name_rows, str, gtk_tree_row_reference_new(fd->tm_name, tp));
+    gtk_tree_path_free(tp);
+  }
+
+  if (fd->initial_name)
+    select_font(fd->initial_name, fd->initial_size, fd);
+  if (GTK_WIDGET_REALIZED(GTK_WIDGET(fd->tv_name)))
+    tv_realize(fd->tv_name, GTK_WIDGET(fd->dlg));
+}
+
 static void
 sel_changed(GtkTreeSelection *sel, FontDialog *fd)
 {
@@ -260,6 +439,8 @@ font_dialog_response(GtkWidget *dlg, gint response_id, FontDialog *fd)
     gconf_client_set_int(g_c, OSSO_XTERM_GCONF_SCROLLBACK, lines, NULL);
   }
   gtk_widget_destroy(GTK_WIDGET(fd->dlg));
+  g_hash_table_destroy(fd->name_rows);
+  g_free(fd->initial_name);
   memset(fd, 0, sizeof(FontDialog));
 }
 
@@ -274,7 +455,7 @@ create_font_dialog(FontDialog *fd)
     *align,
     *pan;
   GtkListStore
-    *ls_name = gtk_list_store_new(4, G_TYPE_STRING, G_TYPE_OBJECT, G_TYPE_OBJECT, PANGO_TYPE_FONT_DESCRIPTION),
+    *ls_name = gtk_list_store_new(2, G_TYPE_STRING, PANGO_TYPE_FONT_DESCRIPTION),
     *ls_size = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_INT);
   GtkCellLayout *cl;
   GtkCellRenderer *cr;
@@ -287,6 +468,7 @@ create_font_dialog(FontDialog *fd)
   g_signal_connect(G_OBJECT(fd->preview), "realize", (GCallback)preview_realize, fd);
 
   fd->tm_name = GTK_TREE_MODEL(ls_name);
+  fd->name_rows = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)gtk_tree_row_reference_free);
   fd->tv_name = g_object_new(GTK_TYPE_TREE_VIEW, "visible", TRUE, "hildon-ui-mode", HILDON_UI_MODE_EDIT, "model", ls_name, "enable-search", FALSE, NULL);
   fd->sel_name = gtk_tree_view_get_selection(fd->tv_name);
   g_signal_connect(G_OBJECT(gtk_tree_view_get_selection(fd->tv_name)), "changed", (GCallback)sel_changed, fd);
@@ -389,17 +571,29 @@ create_font_dialog(FontDialog *fd)
   gtk_container_add (GTK_CONTAINER (fd->dlg->vbox), hbox);
 }
 
+/* Lets go of the font list while the dialog is closed. The copy on disk
+   brings it back quickly enough. Returns the number of fonts dropped. */
+guint
+font_dialog_release_font_list(void)
+{
+  guint n;
+
+  if (font_dialog.dlg || font_list_pending || !font_list)
+    return 0;
+
+  n = font_list->len;
+  g_ptr_array_foreach(font_list, (GFunc)g_free, NULL);
+  g_ptr_array_free(font_list, TRUE);
+  font_list = NULL;
+
+  return n;
+}
+
 void
 show_font_dialog(GtkWindow *parent)
 {
-  PangoFontDescription *pfd_face = NULL;
-  PangoContext *pctx = gdk_pango_context_get();
-  PangoFontFamily **families = NULL;
-  PangoFontFace **faces = NULL;
-  int n_families = 0, Nix, n_faces = 0, Nix1, size = 0;
+  int size = 0;
   char *str = NULL, *name = NULL;
-  GtkListStore *ls_name;
-  GtkTreeIter itr_family;
   GConfClient *g_c = gconf_client_get_default();
   GdkColor clr;
 
@@ -412,29 +606,6 @@ show_font_dialog(GtkWindow *parent)
     if (GTK_WIDGET_REALIZED(GTK_WIDGET(font_dialog.tv_size)))
       hildon_pannable_area_jump_to(HILDON_PANNABLE_AREA(gtk_widget_get_parent(GTK_WIDGET(font_dialog.tv_size))), -1, 0);
 
-    /* Re-fill the font list */
-    ls_name = GTK_LIST_STORE(font_dialog.tm_name);
-    gtk_list_store_clear(ls_name);
-    pango_context_list_families(pctx, &families, &n_families);
-    for (Nix = 0 ; Nix < n_families ; Nix++)
-      if (pango_font_family_is_monospace(families[Nix])) {
-        pango_font_family_list_faces(families[Nix], &faces, &n_faces);
-        g_qsort_with_data(faces, n_faces, sizeof(PangoFontFace *), (GCompareDataFunc)compare_faces, NULL);
-        for (Nix1 = 0 ; Nix1 < n_faces ; Nix1++) {
-          pfd_face = pango_font_face_describe(faces[Nix1]);
-          str = pango_font_description_to_string(pfd_face);
-          gtk_list_store_append(ls_name, &itr_family);
-          gtk_list_store_set(ls_name, &itr_family, 
-            FONT_NAME_STRING_COLUMN, str,         FONT_NAME_FAMILY_COLUMN, families[Nix], 
-            FONT_NAME_FACE_COLUMN,   faces[Nix1], FONT_NAME_PFD_COLUMN,    pfd_face,
-            -1);
-          g_free(str);
-        }
-        g_free(faces); faces = NULL;
-        n_faces = 0;
-      }
-    g_free(families);
-
     /* Init dialog from gconf */
     /* Font name */
     name = gconf_client_get_string(g_c, OSSO_XTERM_GCONF_FONT_NAME, NULL);
@@ -445,10 +616,20 @@ show_font_dialog(GtkWindow *parent)
     size = gconf_client_get_int(g_c, OSSO_XTERM_GCONF_FONT_BASE_SIZE, NULL);
     if (!size)
       size = OSSO_XTERM_DEFAULT_FONT_BASE_SIZE;
-    if (name && size) 
-      select_font(name, size, &font_dialog);
-    g_free(name); name = NULL;
-    size = 0;
+    font_dialog.initial_name = name;
+    font_dialog.initial_size = size;
+    select_font(name, size, &font_dialog);
+
+    /* Fill the font list, or have it filled once it is known */
+    if (font_list)
+      fill_font_list(&font_dialog);
+    else if (!font_list_pending) {
+      font_list_pending = TRUE;
+      if (!g_thread_create(font_list_thread, NULL, FALSE, NULL)) {
+        font_list_pending = FALSE;
+        font_list_ready(font_list_enumerate(NULL));
+      }
+    }
 
     /* Foreground colour */
     str = gconf_client_get_string(g_c, OSSO_XTERM_GCONF_FONT_COLOR, NULL);
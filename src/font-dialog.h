@@ -6,6 +6,7 @@
 G_BEGIN_DECLS
 
 void show_font_dialog(GtkWindow *parent);
+guint font_dialog_release_font_list(void);
 
 G_END_DECLS
 
@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fontconfig/fontconfig.h>
+#include "font-fallback.h"
+
+#define HAS_PAGE(pages, page) ((pages)->bits[(page) >> 3] & (1 << ((page) & 7)))
+#define ADD_PAGE(pages, page) ((pages)->bits[(page) >> 3] |= (1 << ((page) & 7)))
+
+/* How long to wait for more pages to turn up before saving */
+#define SAVE_DELAY 5000
+
+typedef struct
+{
+  guint id;
+  FontFallbackFunc func;
+  gpointer user_data;
+} Watch;
+
+typedef struct
+{
+  guint page;
+  const gchar *family;
+} Fallback;
+
+/* Codepoints handed to a thread to find the fallbacks for, away from the
+   main loop, and what it found */
+typedef struct
+{
+  gchar *primary;
+  GArray *chars;
+  gchar **families;  /* Per codepoint, NULL where nothing covers it */
+} Batch;
+
+static gchar *primary = NULL;
+static GString *families = NULL;     /* ",Fallback,Fallback" */
+static GHashTable *listed = NULL;    /* The fallbacks in families */
+static FontFallbackPages seen;       /* Pages looked up for the primary font */
+static FontFallbackPages covered;    /* Pages a listed fallback covers */
+static FontFallbackPages changed;    /* Pages the watches are yet to hear of */
+static GHashTable *resolved = NULL;  /* "primary\tpage" -> family covering it */
+static GArray *pending = NULL;       /* Codepoints from pages yet to be resolved */
+static guint resolve_id = 0;
+static gboolean resolving = FALSE;   /* Whether a Batch is out with a thread */
+static guint notify_id = 0;
+static guint save_id = 0;
+static GSList *watches = NULL;
+static guint last_watch_id = 0;
+
+static gchar *
+cache_file_name(void)
+{
+  return g_build_filename(g_get_home_dir(), ".cache", "osso-xterm", "font-fallback", NULL);
+}
+
+static gchar *
+page_key(const gchar *family, guint page)
+{
+  return g_strdup_printf("%s\t%x", family, page);
+}
+
+/* Also brings the pages back after font_fallback_trim() */
+static void
+load(void)
+{
+  gchar *file_name = cache_file_name(), *contents = NULL, **lines;
+  guint Nix;
+
+  resolved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  if (!pending)
+    pending = g_array_new(FALSE, FALSE, sizeof(gunichar));
+
+  if (g_file_get_contents(file_name, &contents, NULL, NULL)) {
+    lines = g_strsplit(contents, "\n", -1);
+    for (Nix = 0 ; lines[Nix] ; Nix++) {
+      gchar **fields = g_strsplit(lines[Nix], "\t", 3);
+
+      if (g_strv_length(fields) == 3)
+        g_hash_table_insert(resolved,
+          page_key(fields[0], strtoul(fields[1], NULL, 16)), g_strdup(fields[2]));
+      g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+
+  g_free(file_name);
+}
+
+static void
+add_line(gchar *key, gchar *family, GString *str)
+{
+  g_string_append_printf(str, "%s\t%s\n", key, family);
+}
+
+static gboolean
+save(gpointer null)
+{
+  gchar *file_name = cache_file_name(), *dir_name = g_path_get_dirname(file_name);
+  GString *str = g_string_new(NULL);
+
+  save_id = 0;
+
+  g_hash_table_foreach(resolved, (GHFunc)add_line, str);
+  g_mkdir_with_parents(dir_name, 0700);
+  g_file_set_contents(file_name, str->str, str->len, NULL);
+
+  g_string_free(str, TRUE);
+  g_free(dir_name);
+  g_free(file_name);
+
+  return FALSE;
+}
+
+/* Has @family, which covers @page, listed after the fallbacks found before */
+static void
+list_family(const gchar *family, guint page)
+{
+  ADD_PAGE(&covered, page);
+
+  if (g_hash_table_lookup(listed, family))
+    return;
+  g_hash_table_insert(listed, g_strdup(family), GINT_TO_POINTER(TRUE));
+  g_string_append_printf(families, ",%s", family);
+}
+
+static void
+collect_fallback(const gchar *key, const gchar *family, GArray *fallbacks)
+{
+  gsize length = strlen(primary);
+  Fallback fallback;
+
+  if (strncmp(key, primary, length) || key[length] != '\t' || !strcmp(family, primary))
+    return;
+
+  fallback.page = strtoul(key + length + 1, NULL, 16);
+  fallback.family = family;
+  g_array_append_val(fallbacks, fallback);
+}
+
+static gint
+compare_fallbacks(const Fallback *a, const Fallback *b)
+{
+  return (a->page > b->page) - (a->page < b->page);
+}
+
+/* Lists the fallbacks known for a new primary font, ordered by the first page
+   each of them covers. Those found later are added by list_family(). */
+static void
+update_families(void)
+{
+  GArray *fallbacks = g_array_new(FALSE, FALSE, sizeof(Fallback));
+  guint Nix;
+
+  if (listed)
+    g_hash_table_destroy(listed);
+  listed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  if (families)
+    g_string_truncate(families, 0);
+  else
+    families = g_string_new(NULL);
+  memset(&covered, 0, sizeof(covered));
+
+  g_hash_table_foreach(resolved, (GHFunc)collect_fallback, fallbacks);
+  g_array_sort(fallbacks, (GCompareFunc)compare_fallbacks);
+  for (Nix = 0 ; Nix < fallbacks->len ; Nix++)
+    list_family(g_array_index(fallbacks, Fallback, Nix).family, g_array_index(fallbacks, Fallback, Nix).page);
+
+  g_array_free(fallbacks, TRUE);
+}
+
+static gboolean
+notify_watches(gpointer null)
+{
+  FontFallbackPages pages = changed;
+  GSList *itr, *copy;
+
+  notify_id = 0;
+  memset(&changed, 0, sizeof(changed));
+
+  copy = g_slist_copy(watches);
+  for (itr = copy ; itr ; itr = itr->next)
+    if (g_slist_find(watches, itr->data))
+      ((Watch *)(itr->data))->func(&pages, ((Watch *)(itr->data))->user_data);
+  g_slist_free(copy);
+
+  return FALSE;
+}
+
+/* Tells the watches about @page, along with any others that come up before
+   the main loop is idle */
+static void
+queue_notify(guint page)
+{
+  ADD_PAGE(&changed, page);
+  if (!notify_id)
+    notify_id = g_idle_add_full(G_PRIORITY_LOW, notify_watches, NULL, NULL);
+}
+
+/* The family fontconfig would fall back on for @c, were @primary asked for
+   it */
+static gchar *
+find_family(FcConfig *config, const gchar *primary, gunichar c)
+{
+  FcPattern *pattern = FcPatternCreate();
+  FcCharSet *charset = FcCharSetCreate();
+  FcFontSet *set;
+  FcResult result;
+  gchar *family = NULL;
+  int Nix;
+
+  FcCharSetAddChar(charset, c);
+  FcPatternAddString(pattern, FC_FAMILY, (const FcChar8 *)primary);
+  FcPatternAddCharSet(pattern, FC_CHARSET, charset);
+  FcConfigSubstitute(config, pattern, FcMatchPattern);
+  FcDefaultSubstitute(pattern);
+
+  set = FcFontSort(config, pattern, FcTrue, NULL, &result);
+  if (set) {
+    for (Nix = 0 ; Nix < set->nfont && !family ; Nix++) {
+      FcCharSet *font_charset;
+      FcChar8 *font_family;
+
+      if (FcPatternGetCharSet(set->fonts[Nix], FC_CHARSET, 0, &font_charset) == FcResultMatch &&
+          FcCharSetHasChar(font_charset, c) &&
+          FcPatternGetString(set->fonts[Nix], FC_FAMILY, 0, &font_family) == FcResultMatch)
+        family = g_strdup((const gchar *)font_family);
+    }
+    FcFontSetDestroy(set);
+  }
+
+  FcCharSetDestroy(charset);
+  FcPatternDestroy(pattern);
+
+  return family;
+}
+
+static gboolean resolve_pending(gpointer null);
+
+static gboolean
+batch_done(Batch *batch)
+{
+  guint Nix;
+
+  resolving = FALSE;
+
+  if (!resolved)
+    load();
+
+  for (Nix = 0 ; Nix < batch->chars->len ; Nix++) {
+    guint page = g_array_index(batch->chars, gunichar, Nix) >> 8;
+    gchar *family = batch->families[Nix];
+
+    /* The primary font may have changed meanwhile; what was found for the
+       old one is still worth keeping */
+    if (family && strcmp(family, batch->primary) &&
+        primary && !strcmp(primary, batch->primary)) {
+      list_family(family, page);
+      queue_notify(page);
+    }
+
+    /* Pages nothing covers are remembered too, so they are not searched
+       for again */
+    g_hash_table_insert(resolved, page_key(batch->primary, page),
+      family ? family : g_strdup(batch->primary));
+  }
+
+  g_free(batch->families);
+  g_array_free(batch->chars, TRUE);
+  g_free(batch->primary);
+  g_free(batch);
+
+  if (!save_id)
+    save_id = g_timeout_add(SAVE_DELAY, save, NULL);
+
+  /* Pages that turned up meanwhile */
+  if (pending->len && !resolve_id)
+    resolve_id = g_idle_add_full(G_PRIORITY_LOW, resolve_pending, NULL, NULL);
+
+  return FALSE;
+}
+
+/* Fontconfig before 2.10 is not safe to use from two threads at once, so the
+   thread has a configuration of its own rather than the one Pango uses */
+static gpointer
+batch_thread(Batch *batch)
+{
+  FcConfig *config = FcInitLoadConfigAndFonts();
+  guint Nix;
+
+  for (Nix = 0 ; Nix < batch->chars->len ; Nix++)
+    batch->families[Nix] = config
+      ? find_family(config, batch->primary, g_array_index(batch->chars, gunichar, Nix))
+      : NULL;
+
+  if (config)
+    FcConfigDestroy(config);
+
+  g_idle_add_full(G_PRIORITY_LOW, (GSourceFunc)batch_done, batch, NULL);
+
+  return NULL;
+}
+
+/* Hands the pending codepoints over to a thread, one batch at a time */
+static gboolean
+resolve_pending(gpointer null)
+{
+  Batch *batch;
+
+  resolve_id = 0;
+
+  if (resolving || !pending->len)
+    return FALSE;
+
+  batch = g_new0(Batch, 1);
+  batch->primary = g_strdup(primary);
+  batch->chars = pending;
+  batch->families = g_new0(gchar *, pending->len);
+  pending = g_array_new(FALSE, FALSE, sizeof(gunichar));
+
+  resolving = TRUE;
+  if (!g_thread_create((GThreadFunc)batch_thread, batch, FALSE, NULL))
+    batch_thread(batch);
+
+  return FALSE;
+}
+
+/* Sets the font terminals are using, which the fallbacks are for */
+void
+font_fallback_set_primary(const gchar *family)
+{
+  if (!resolved)
+    load();
+
+  if (primary && !strcmp(primary, family))
+    return;
+
+  g_free(primary);
+  primary = g_strdup(family);
+  memset(&seen, 0, sizeof(seen));
+  g_array_set_size(pending, 0);
+  update_families();
+}
+
+/* The fallbacks to list after the primary font, each preceded by a comma */
+const gchar *
+font_fallback_get_families(void)
+{
+  return families ? families->str : "";
+}
+
+/* Looks at @length bytes of UTF-8 terminal output for pages not seen before.
+   Those are resolved later, on a thread. The pages are also added to
+   @shown, the pages of the terminal showing @text, if not %NULL. */
+void
+font_fallback_note_text(const gchar *text, gsize length, FontFallbackPages *shown)
+{
+  const gchar *p = text, *end = text + length;
+  gunichar c;
+  guint page;
+
+  if (!primary)
+    return;
+
+  while (p < end) {
+    if (!((*p) & 0x80)) {
+      p++;
+      continue;
+    }
+
+    c = g_utf8_get_char_validated(p, end - p);
+    if (c == (gunichar)-1 || c == (gunichar)-2) {
+      p++;
+      continue;
+    }
+    p = g_utf8_next_char(p);
+
+    page = c >> 8;
+    if (shown) {
+      if (HAS_PAGE(shown, page))
+        continue;
+      ADD_PAGE(shown, page);
+
+      /* The terminal's font may predate the fallback for it */
+      if (HAS_PAGE(&covered, page))
+        queue_notify(page);
+    }
+
+    if (HAS_PAGE(&seen, page))
+      continue;
+    ADD_PAGE(&seen, page);
+
+    {
+      gchar *key = page_key(primary, page);
+
+      if (!resolved)
+        load();
+      if (!g_hash_table_lookup(resolved, key)) {
+        g_array_append_val(pending, c);
+        if (!resolve_id)
+          resolve_id = g_idle_add_full(G_PRIORITY_LOW, resolve_pending, NULL, NULL);
+      }
+      g_free(key);
+    }
+  }
+}
+
+/* Forgets the pages resolved so far, after saving them. The fallbacks already
+   found stay in use. Returns the number of pages forgotten. */
+guint
+font_fallback_trim(void)
+{
+  guint n;
+
+  if (!resolved)
+    return 0;
+
+  if (save_id) {
+    g_source_remove(save_id);
+    save(NULL);
+  }
+
+  n = g_hash_table_size(resolved);
+  g_hash_table_destroy(resolved);
+  resolved = NULL;
+
+  return n;
+}
+
+/* Whether any page is in both @a and @b */
+gboolean
+font_fallback_pages_overlap(const FontFallbackPages *a, const FontFallbackPages *b)
+{
+  guint Nix;
+
+  for (Nix = 0 ; Nix < sizeof(a->bits) ; Nix++)
+    if (a->bits[Nix] & b->bits[Nix])
+      return TRUE;
+
+  return FALSE;
+}
+
+/* Calls @func whenever fallbacks have been added for pages, or a terminal
+   shows pages one has been found for before */
+guint
+font_fallback_add_watch(FontFallbackFunc func, gpointer user_data)
+{
+  Watch *watch = g_new0(Watch, 1);
+
+  watch->id = ++last_watch_id;
+  watch->func = func;
+  watch->user_data = user_data;
+  watches = g_slist_prepend(watches, watch);
+
+  return watch->id;
+}
+
+void
+font_fallback_remove_watch(guint id)
+{
+  GSList *itr;
+
+  for (itr = watches ; itr ; itr = itr->next)
+    if (((Watch *)(itr->data))->id == id) {
+      g_free(itr->data);
+      watches = g_slist_delete_link(watches, itr);
+      break;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef _FONT_FALLBACK_H_
+#define _FONT_FALLBACK_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Remembers which font covers each 256 codepoint page of Unicode seen in
+   terminal output that the terminal font does not cover, and has those fonts
+   listed right after the terminal font. Pango then finds the glyphs in a font
+   it has been told about, instead of searching fontconfig for one. The search
+   for the fallback runs on a thread, and what has been found is saved under
+   ~/.cache, so it happens once per page per terminal font, not once per run. */
+
+#define FONT_FALLBACK_N_PAGES (0x110000 >> 8)
+
+/* A set of pages, a bit each */
+typedef struct
+{
+  guint8 bits[FONT_FALLBACK_N_PAGES / 8];
+} FontFallbackPages;
+
+/* @pages are those a fallback has been found for, or that a terminal shows
+   for the first time with a fallback already listed for them */
+typedef void (*FontFallbackFunc)(const FontFallbackPages *pages, gpointer user_data);
+
+void         font_fallback_set_primary(const gchar *family);
+const gchar *font_fallback_get_families(void);
+void         font_fallback_note_text(const gchar *text, gsize length, FontFallbackPages *shown);
+guint        font_fallback_trim(void);
+
+gboolean     font_fallback_pages_overlap(const FontFallbackPages *a, const FontFallbackPages *b);
+
+guint        font_fallback_add_watch(FontFallbackFunc func, gpointer user_data);
+void         font_fallback_remove_watch(guint id);
+
+G_END_DECLS
+
+#endif /* !_FONT_FALLBACK_H_ */
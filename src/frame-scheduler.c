@@ -0,0 +1,187 @@
+#include <gdk/gdk.h>
+#include "frame-scheduler.h"
+
+/* 60 frames per second */
+#define FRAME_INTERVAL 16
+
+typedef struct
+{
+  FrameUpdateFunc func;
+  gpointer data;
+} FrameUpdate;
+
+struct _FrameScheduler
+{
+  gint ref_count;
+
+  GArray *pending;
+  GArray *running; /* The updates being flushed, or NULL */
+  guint source_id;
+  GTimeVal last_flush;
+
+  FrameSchedulerStats stats;
+};
+
+FrameScheduler *
+frame_scheduler_new(void)
+{
+  FrameScheduler *sched = g_new0(FrameScheduler, 1);
+
+  sched->ref_count = 1;
+  sched->pending = g_array_new(FALSE, FALSE, sizeof(FrameUpdate));
+
+  return sched;
+}
+
+FrameScheduler *
+frame_scheduler_ref(FrameScheduler *sched)
+{
+  g_return_val_if_fail(sched != NULL, NULL);
+
+  sched->ref_count++;
+
+  return sched;
+}
+
+void
+frame_scheduler_unref(FrameScheduler *sched)
+{
+  g_return_if_fail(sched != NULL);
+
+  if (--(sched->ref_count) == 0) {
+#ifdef DEBUG
+    g_debug("%s: %" G_GUINT64_FORMAT " updates queued, %" G_GUINT64_FORMAT " coalesced, "
+            "%" G_GUINT64_FORMAT " run in %" G_GUINT64_FORMAT " frames", __FUNCTION__,
+            sched->stats.queued, sched->stats.coalesced, sched->stats.run, sched->stats.frames);
+#endif
+    if (sched->source_id)
+      g_source_remove(sched->source_id);
+    g_array_free(sched->pending, TRUE);
+    g_free(sched);
+  }
+}
+
+static gboolean
+frame_scheduler_dispatch(FrameScheduler *sched)
+{
+  sched->source_id = 0;
+  frame_scheduler_flush(sched);
+
+  return FALSE;
+}
+
+void
+frame_scheduler_queue(FrameScheduler *sched, FrameUpdateFunc func, gpointer data)
+{
+  GTimeVal now;
+  glong elapsed;
+  guint Nix;
+
+  g_return_if_fail(sched != NULL);
+  g_return_if_fail(func != NULL);
+
+  sched->stats.queued++;
+
+  for (Nix = 0 ; Nix < sched->pending->len ; Nix++) {
+    FrameUpdate *update = &g_array_index(sched->pending, FrameUpdate, Nix);
+
+    if (update->func == func && update->data == data) {
+      sched->stats.coalesced++;
+      return;
+    }
+  }
+
+  {
+    FrameUpdate update = { func, data };
+    g_array_append_val(sched->pending, update);
+  }
+
+  if (sched->source_id)
+    return;
+
+  /* Run right before the next redraw, unless the last frame was too recent */
+  g_get_current_time(&now);
+  elapsed = (now.tv_sec - sched->last_flush.tv_sec) * 1000
+          + (now.tv_usec - sched->last_flush.tv_usec) / 1000;
+  if (elapsed >= 0 && elapsed < FRAME_INTERVAL)
+    sched->source_id = g_timeout_add_full(GDK_PRIORITY_REDRAW - 1, FRAME_INTERVAL - elapsed,
+                                          (GSourceFunc)frame_scheduler_dispatch, sched, NULL);
+  else
+    sched->source_id = g_idle_add_full(GDK_PRIORITY_REDRAW - 1,
+                                       (GSourceFunc)frame_scheduler_dispatch, sched, NULL);
+}
+
+/* Drops the pending updates for @data, which is going away */
+void
+frame_scheduler_cancel(FrameScheduler *sched, gpointer data)
+{
+  guint Nix;
+
+  g_return_if_fail(sched != NULL);
+
+  for (Nix = sched->pending->len ; Nix > 0 ; Nix--)
+    if (g_array_index(sched->pending, FrameUpdate, Nix - 1).data == data)
+      g_array_remove_index(sched->pending, Nix - 1);
+
+  /* An earlier update of the frame being flushed may have destroyed @data */
+  if (sched->running)
+    for (Nix = 0 ; Nix < sched->running->len ; Nix++)
+      if (g_array_index(sched->running, FrameUpdate, Nix).data == data)
+        g_array_index(sched->running, FrameUpdate, Nix).func = NULL;
+
+  if (sched->pending->len == 0 && sched->source_id) {
+    g_source_remove(sched->source_id);
+    sched->source_id = 0;
+  }
+}
+
+/* Runs the pending updates now */
+void
+frame_scheduler_flush(FrameScheduler *sched)
+{
+  guint Nix;
+
+  g_return_if_fail(sched != NULL);
+
+  if (sched->running)
+    return;
+
+  if (sched->source_id) {
+    g_source_remove(sched->source_id);
+    sched->source_id = 0;
+  }
+
+  if (sched->pending->len == 0)
+    return;
+
+  g_get_current_time(&(sched->last_flush));
+  sched->stats.frames++;
+
+  /* Updates may queue further updates, which go to the next frame. Keep
+     ourselves alive in case an update drops the last reference. */
+  frame_scheduler_ref(sched);
+  sched->running = sched->pending;
+  sched->pending = g_array_new(FALSE, FALSE, sizeof(FrameUpdate));
+
+  for (Nix = 0 ; Nix < sched->running->len ; Nix++) {
+    FrameUpdate update = g_array_index(sched->running, FrameUpdate, Nix);
+
+    if (update.func) {
+      sched->stats.run++;
+      update.func(update.data);
+    }
+  }
+
+  g_array_free(sched->running, TRUE);
+  sched->running = NULL;
+  frame_scheduler_unref(sched);
+}
+
+void
+frame_scheduler_get_stats(FrameScheduler *sched, FrameSchedulerStats *stats)
+{
+  g_return_if_fail(sched != NULL);
+  g_return_if_fail(stats != NULL);
+
+  *stats = sched->stats;
+}
@@ -0,0 +1,35 @@
+#ifndef _FRAME_SCHEDULER_H_
+#define _FRAME_SCHEDULER_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Collects UI updates queued from signal handlers and runs each of them at
+   most once per frame, just before GTK redraws. An update is identified by
+   its function and data, so queueing it again before it has run is free. */
+typedef struct _FrameScheduler FrameScheduler;
+
+typedef void (*FrameUpdateFunc)(gpointer data);
+
+typedef struct
+{
+  guint64 queued;    /* Calls to frame_scheduler_queue() */
+  guint64 coalesced; /* ... that found the update already pending */
+  guint64 run;       /* Updates actually run */
+  guint64 frames;    /* Flushes */
+} FrameSchedulerStats;
+
+FrameScheduler *frame_scheduler_new(void);
+FrameScheduler *frame_scheduler_ref(FrameScheduler *sched);
+void            frame_scheduler_unref(FrameScheduler *sched);
+
+void            frame_scheduler_queue(FrameScheduler *sched, FrameUpdateFunc func, gpointer data);
+void            frame_scheduler_cancel(FrameScheduler *sched, gpointer data);
+void            frame_scheduler_flush(FrameScheduler *sched);
+
+void            frame_scheduler_get_stats(FrameScheduler *sched, FrameSchedulerStats *stats);
+
+G_END_DECLS
+
+#endif /* !_FRAME_SCHEDULER_H_ */
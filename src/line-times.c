@@ -0,0 +1,142 @@
+#include "line-times.h"
+
+/* Rows between two places decoding can start from */
+#define BLOCK_ROWS 256
+
+typedef struct
+{
+  guint offset;   /* Of the block's first row in data */
+  gint64 msec;    /* Of the row before it */
+} Block;
+
+struct _LineTimes
+{
+  glong first_row;
+  glong n_rows;
+  gint64 last_msec;
+  GByteArray *data;   /* A varint per row, the milliseconds since the row before */
+  GArray *blocks;
+};
+
+LineTimes *
+line_times_new(void)
+{
+  LineTimes *times = g_new0(LineTimes, 1);
+
+  times->data = g_byte_array_new();
+  times->blocks = g_array_new(FALSE, FALSE, sizeof(Block));
+
+  return times;
+}
+
+void
+line_times_free(LineTimes *times)
+{
+  if (!times)
+    return;
+
+  g_byte_array_free(times->data, TRUE);
+  g_array_free(times->blocks, TRUE);
+  g_free(times);
+}
+
+static void
+append(LineTimes *times, gint64 msec)
+{
+  guint8 buf[10];
+  guint64 delta;
+  guint n = 0;
+
+  /* The clock going back is taken for no time passing */
+  delta = msec > times->last_msec ? (guint64)(msec - times->last_msec) : 0;
+
+  if (times->n_rows % BLOCK_ROWS == 0) {
+    Block block = { times->data->len, times->last_msec };
+
+    g_array_append_val(times->blocks, block);
+  }
+
+  do {
+    buf[n++] = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+    delta >>= 7;
+  } while (delta);
+  g_byte_array_append(times->data, buf, n);
+
+  times->last_msec = MAX(msec, times->last_msec);
+  times->n_rows++;
+}
+
+/* Gives the rows up to @row that have no time yet @msec. A @row before the
+   first one known means the terminal has started numbering them over. */
+void
+line_times_record(LineTimes *times, glong row, gint64 msec)
+{
+  if (times->n_rows == 0 || row < times->first_row) {
+    line_times_clear(times);
+    times->first_row = row;
+  }
+
+  while (times->first_row + times->n_rows <= row)
+    append(times, msec);
+}
+
+gboolean
+line_times_lookup(LineTimes *times, glong row, gint64 *msec)
+{
+  const guint8 *p;
+  Block *block;
+  guint64 delta;
+  glong index, Nix;
+  guint shift;
+
+  if (row < times->first_row || row >= times->first_row + times->n_rows)
+    return FALSE;
+
+  index = row - times->first_row;
+  block = &g_array_index(times->blocks, Block, index / BLOCK_ROWS);
+  p = times->data->data + block->offset;
+  (*msec) = block->msec;
+
+  for (Nix = 0 ; Nix <= index % BLOCK_ROWS ; Nix++) {
+    delta = 0;
+    shift = 0;
+    do {
+      delta |= (guint64)((*p) & 0x7f) << shift;
+      shift += 7;
+    } while (*(p++) & 0x80);
+    (*msec) += delta;
+  }
+
+  return TRUE;
+}
+
+/* Lets go of the rows before @first_row, a block at a time */
+void
+line_times_forget(LineTimes *times, glong first_row)
+{
+  guint n = 0, offset, Nix;
+
+  while ((n + 1) * BLOCK_ROWS <= times->n_rows && times->first_row + (glong)((n + 1) * BLOCK_ROWS) <= first_row)
+    n++;
+  if (n == 0)
+    return;
+
+  offset = n < times->blocks->len ? g_array_index(times->blocks, Block, n).offset : times->data->len;
+  g_byte_array_remove_range(times->data, 0, offset);
+  g_array_remove_range(times->blocks, 0, n);
+  for (Nix = 0 ; Nix < times->blocks->len ; Nix++)
+    g_array_index(times->blocks, Block, Nix).offset -= offset;
+
+  times->first_row += n * BLOCK_ROWS;
+  times->n_rows -= n * BLOCK_ROWS;
+}
+
+void
+line_times_clear(LineTimes *times)
+{
+  g_byte_array_set_size(times->data, 0);
+  g_array_set_size(times->blocks, 0);
+  times->first_row = 0;
+  times->n_rows = 0;
+  times->last_msec = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef _LINE_TIMES_H_
+#define _LINE_TIMES_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* When each row of a terminal first got output, in milliseconds since the
+   epoch. Rows are numbered the way Vte numbers them. Each time is kept as
+   the difference from the row before, in as few bytes as it takes, which is
+   one for all the rows that came in with the same read. */
+typedef struct _LineTimes LineTimes;
+
+LineTimes *line_times_new(void);
+void       line_times_free(LineTimes *times);
+
+void       line_times_record(LineTimes *times, glong row, gint64 msec);
+gboolean   line_times_lookup(LineTimes *times, glong row, gint64 *msec);
+void       line_times_forget(LineTimes *times, glong first_row);
+void       line_times_clear(LineTimes *times);
+
+G_END_DECLS
+
+#endif /* !_LINE_TIMES_H_ */
@@ -1,6 +1,10 @@
+#include <string.h>
 #include <hildon/hildon.h>
 #include <gdk/gdkkeysyms.h>
 #include "maemo-vte.h"
+#include "font-fallback.h"
+#include "line-times.h"
+#include "terminal-modes.h"
 #include "vte-marshallers.h"
 
 typedef struct
@@ -14,8 +18,49 @@ enum
   PAN_MODE_PROPERTY = 1,
   CONTROL_MASK_PROPERTY,
   MATCH_PROPERTY,
+  CAN_PAN_PROPERTY,
+  SHOW_DAMAGE_PROPERTY,
+  THROTTLED_PROPERTY,
 };
 
+enum
+{
+  WATCH_MATCH_SIGNAL,
+  LAST_SIGNAL
+};
+
+/* How long the pannable area has to stay still before the terminal is lined
+   up with its rows again */
+#define SNAP_TIMEOUT 150
+
+/* How long the terminal has to keep its size before the child is told about
+   it. Rotating, or showing and hiding the toolbar, goes through several sizes
+   on the way, and each one would otherwise have the child redraw. */
+#define RESIZE_SETTLE_TIMEOUT 100
+
+/* Colours the repainted areas are outlined in when showing damage, one after
+   the other, so that successive repaints can be told apart */
+static const double damage_colours[][3] = {
+  { 1.0, 0.0, 0.0 },
+  { 0.0, 0.8, 0.0 },
+  { 0.0, 0.0, 1.0 },
+  { 1.0, 0.0, 1.0 },
+};
+
+/* How long new output is left to accumulate before it is run through the
+   watch automaton */
+#define WATCH_SCAN_INTERVAL 100
+
+/* Seconds a pattern stays quiet after being reported, so output that keeps
+   matching does not report it on every scan */
+#define WATCH_HOLDOFF 10
+
+/* How much output a hibernating terminal takes off its pty. Past that, the
+   child is left to block until the terminal wakes up. */
+#define MAX_BACKLOG (256 * 1024)
+
+static guint mvte_signals[LAST_SIGNAL] = { 0 };
+
 struct _MaemoVtePrivate
 {
   GtkIMContext *imc;
@@ -24,109 +69,251 @@ struct _MaemoVtePrivate
   gboolean control_mask;
   gboolean been_panning;
   char *match;
-};
 
-#define PERFORM_SYNC(mvte,src) \
-  ((mvte)->priv->foreign_vadj && \
-   (((mvte)->priv->pan_mode) || \
-    ((src) != (mvte)->priv->foreign_vadj)))
+  OutputWatch *watch;
+  guint watch_state;
+  glong watch_row;
+  glong watch_col;
+  guint watch_scan_id;
+  glong *watch_reported;   /* When each pattern was last reported, in seconds */
+
+  FrameScheduler *scheduler;
+  guint sync_id;
+  gboolean can_pan;
+
+  gint pixel_offset;
+  guint snap_id;
+
+  TerminalPty *pty;
+  guint resize_id;
+  gsize read_budget;
+  gboolean throttled;
+
+  ScreenSnapshot *preview;
+  gboolean showing_preview;
+
+  LineTimes *line_times;
+
+  TerminalModes *modes;    /* Of the output from the pty */
+  ScreenSnapshot *hibernated;
+  glong hibernated_column;
+  glong hibernated_row;
+  GByteArray *backlog;
+
+  gboolean show_damage;
+  guint damage_id;
+  guint flash_serial;
+  guint64 damage_cells;
+  guint64 damage_pixels;
+  guint cells_per_second;
+  guint pixels_per_second;
+
+  MaemoVteStats stats;
+  GTimer *frame_timer;
+
+  FontFallbackPages shown_pages;
+};
 
 static void set_control_mask(MaemoVte *mvte, gboolean on);
+static void set_show_damage(MaemoVte *mvte, gboolean show_damage);
 
+/* While panning, the foreign value may lie part of the way into a row. VTE
+   only ever draws whole rows, so its window is moved up by the remainder and
+   made a row taller to cover the gap this leaves at the bottom. Moving the
+   window keeps what has already been drawn, so only the row coming into view
+   needs drawing. */
 static void
-set_up_sync(MaemoVte *mvte, GtkAdjustment **p_src, GtkAdjustment **p_dst, double *p_factor)
+apply_pixel_offset(MaemoVte *mvte)
 {
-  if (!PERFORM_SYNC(mvte,(*p_src)))
-    (*p_src) = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
-
-  if ((*p_src) == mvte->priv->foreign_vadj) {
-    (*p_dst) = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
-    (*p_factor) = 1.0 / ((double)(VTE_TERMINAL(mvte)->char_height));
+  GtkWidget *widget = GTK_WIDGET(mvte);
+  GtkAdjustment *adj = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
+  GtkAdjustment *foreign = mvte->priv->foreign_vadj;
+  glong ch = VTE_TERMINAL(mvte)->char_height;
+  gint offset = 0;
+
+  if (!GTK_WIDGET_REALIZED(widget))
+    return;
+
+  if (mvte->priv->pan_mode && foreign && adj && ch > 0)
+    offset = CLAMP((glong)foreign->value - (glong)adj->value * ch, 0, ch - 1);
+
+  if (offset != mvte->priv->pixel_offset) {
+    mvte->priv->pixel_offset = offset;
+    gdk_window_move_resize(widget->window,
+      widget->allocation.x, widget->allocation.y - offset,
+      widget->allocation.width, widget->allocation.height + (offset ? ch : 0));
   }
-  else {
-    (*p_dst) = mvte->priv->foreign_vadj;
-    (*p_factor) = ((double)(VTE_TERMINAL(mvte)->char_height));
+}
+
+static gboolean
+snap_to_row(MaemoVte *mvte)
+{
+  GtkAdjustment *foreign = mvte->priv->foreign_vadj;
+  glong ch = VTE_TERMINAL(mvte)->char_height;
+  glong value;
+
+  mvte->priv->snap_id = 0;
+
+  if (foreign && ch > 0) {
+    value = (((glong)foreign->value + ch / 2) / ch) * ch;
+    value = CLAMP(value, (glong)foreign->lower, MAX((glong)foreign->lower, (glong)(foreign->upper - foreign->page_size)));
+    if (value != (glong)foreign->value)
+      gtk_adjustment_set_value(foreign, value);
   }
+
+  return FALSE;
 }
 
+/* The foreign adjustment counts pixels, VTE's counts rows. VTE's adjustment
+   changes with every line of output, so following it is left to once per
+   frame. While panning, the foreign adjustment leads and VTE follows at once,
+   and the foreign value is free to lie anywhere within the row VTE shows. */
 static void
-sync_vadj(GtkAdjustment *src, MaemoVte *mvte)
+sync_to_foreign(MaemoVte *mvte)
 {
-  GtkAdjustment *dst;
-  double factor;
+  GtkAdjustment *src = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
+  GtkAdjustment *dst = mvte->priv->foreign_vadj;
+  glong ch = VTE_TERMINAL(mvte)->char_height;
+  glong upper, lower, page_size, value;
+  gboolean can_pan;
+
+  if (mvte->priv->sync_id) {
+    g_source_remove(mvte->priv->sync_id);
+    mvte->priv->sync_id = 0;
+  }
 
-  set_up_sync(mvte, &src, &dst, &factor);
+  if (!src) return;
 
-  if (!(src && dst)) return;
+  upper     = (glong)src->upper;
+  lower     = (glong)src->lower;
+  page_size = (glong)src->page_size;
+  value     = (glong)src->value;
 
-  if (!(dst->upper          == src->upper * factor && 
-        dst->lower          == src->lower * factor && 
-        dst->step_increment == src->step_increment * factor && 
-        dst->page_increment == src->page_increment * factor && 
-        dst->page_size      == src->page_size * factor)) {
-    dst->upper          = src->upper * factor;
-    dst->lower          = src->lower * factor;
-    dst->step_increment = src->step_increment * factor;
-    dst->page_increment = src->page_increment * factor;
-    dst->page_size      = src->page_size * factor;
+  can_pan = (upper - page_size > lower);
+  if (can_pan != mvte->priv->can_pan) {
+    mvte->priv->can_pan = can_pan;
+    g_object_notify(G_OBJECT(mvte), "can-pan");
+  }
+
+  if (!dst || ch <= 0) return;
+
+  if (!((glong)dst->upper          == upper * ch &&
+        (glong)dst->lower          == lower * ch &&
+        (glong)dst->step_increment == (glong)src->step_increment * ch &&
+        (glong)dst->page_increment == (glong)src->page_increment * ch &&
+        (glong)dst->page_size      == page_size * ch)) {
+    dst->upper          = upper * ch;
+    dst->lower          = lower * ch;
+    dst->step_increment = (glong)src->step_increment * ch;
+    dst->page_increment = (glong)src->page_increment * ch;
+    dst->page_size      = page_size * ch;
     mvte->priv->been_panning = TRUE;
     gtk_adjustment_changed(dst);
   }
+
+  if ((glong)dst->value / ch != value) {
+    dst->value = value * ch;
+    mvte->priv->been_panning = TRUE;
+    gtk_adjustment_value_changed(dst);
+  }
+
+  apply_pixel_offset(mvte);
+}
+
+static gboolean
+sync_to_foreign_idle(MaemoVte *mvte)
+{
+  mvte->priv->sync_id = 0;
+  sync_to_foreign(mvte);
+
+  return FALSE;
+}
+
+static void
+queue_sync_to_foreign(MaemoVte *mvte)
+{
+  if (mvte->priv->scheduler)
+    frame_scheduler_queue(mvte->priv->scheduler, (FrameUpdateFunc)sync_to_foreign, mvte);
+  else if (!(mvte->priv->sync_id))
+    mvte->priv->sync_id = g_idle_add_full(GDK_PRIORITY_REDRAW - 1, (GSourceFunc)sync_to_foreign_idle, mvte, NULL);
 }
 
 static void
-sync_vadj_value(GtkAdjustment *src, MaemoVte *mvte)
+vte_vadj_changed(GtkAdjustment *adj, MaemoVte *mvte)
 {
-  GtkAdjustment *dst;
-  double factor;
+  queue_sync_to_foreign(mvte);
+}
 
-  set_up_sync(mvte, &src, &dst, &factor);
+static void
+foreign_vadj_changed(GtkAdjustment *foreign, MaemoVte *mvte)
+{
+  GtkAdjustment *adj = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
+  glong ch = VTE_TERMINAL(mvte)->char_height;
 
-  if (!(src && dst)) return;
+  if (!(mvte->priv->pan_mode && adj && ch > 0)) {
+    /* Whatever changed it, VTE knows better */
+    queue_sync_to_foreign(mvte);
+    return;
+  }
 
-/*  g_printerr("%s : before : src : "
-                  "upper: %f, lower: %f, page_size: %f, value: %f, step_inc: %f, page_inc: %f\n",
-                  __FUNCTION__, src->upper, src->lower, src->page_size, src->value, src->step_increment, src->page_increment);
-  g_printerr("%s : before : dst : "
-                  "upper: %f, lower: %f, page_size: %f, value: %f, step_inc: %f, page_inc: %f\n",
-                  __FUNCTION__, dst->upper, dst->lower, dst->page_size, dst->value, dst->step_increment, dst->page_increment);
-*/
-  if (dst->value != src->value * factor) {
-    dst->value = src->value * factor;
+  if (!((glong)adj->upper          == (glong)foreign->upper / ch &&
+        (glong)adj->lower          == (glong)foreign->lower / ch &&
+        (glong)adj->step_increment == (glong)foreign->step_increment / ch &&
+        (glong)adj->page_increment == (glong)foreign->page_increment / ch &&
+        (glong)adj->page_size      == (glong)foreign->page_size / ch)) {
+    adj->upper          = (glong)foreign->upper / ch;
+    adj->lower          = (glong)foreign->lower / ch;
+    adj->step_increment = (glong)foreign->step_increment / ch;
+    adj->page_increment = (glong)foreign->page_increment / ch;
+    adj->page_size      = (glong)foreign->page_size / ch;
     mvte->priv->been_panning = TRUE;
-    gtk_adjustment_value_changed(dst);
+    gtk_adjustment_changed(adj);
   }
-/*
-  g_printerr("%s : after : src : "
-                  "upper: %f, lower: %f, page_size: %f, value: %f, step_inc: %f, page_inc: %f\n",
-                  __FUNCTION__, src->upper, src->lower, src->page_size, src->value, src->step_increment, src->page_increment);
-  g_printerr("%s : after : dst : "
-                  "upper: %f, lower: %f, page_size: %f, value: %f, step_inc: %f, page_inc: %f\n",
-                  __FUNCTION__, dst->upper, dst->lower, dst->page_size, dst->value, dst->step_increment, dst->page_increment);
-*/
+}
+
+static void
+foreign_vadj_value_changed(GtkAdjustment *foreign, MaemoVte *mvte)
+{
+  GtkAdjustment *adj = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
+  glong ch = VTE_TERMINAL(mvte)->char_height;
+
+  if (!(mvte->priv->pan_mode && adj && ch > 0)) {
+    queue_sync_to_foreign(mvte);
+    return;
+  }
+
+  if ((glong)adj->value != (glong)foreign->value / ch) {
+    adj->value = (glong)foreign->value / ch;
+    mvte->priv->been_panning = TRUE;
+    gtk_adjustment_value_changed(adj);
+  }
+
+  apply_pixel_offset(mvte);
+
+  if (mvte->priv->snap_id)
+    g_source_remove(mvte->priv->snap_id);
+  mvte->priv->snap_id = mvte->priv->pixel_offset
+    ? g_timeout_add(SNAP_TIMEOUT, (GSourceFunc)snap_to_row, mvte)
+    : 0;
 }
 
 static void
 set_scroll_adjustments(MaemoVte *mvte, GtkAdjustment *hadjustment, GtkAdjustment *vadjustment)
 {
-  GtkAdjustment *my_vadj = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
   /* This function ignores hadjustment */
 
   if (mvte->priv->foreign_vadj) {
-    g_signal_handlers_disconnect_by_func(G_OBJECT(mvte->priv->foreign_vadj), sync_vadj,       mvte);
-    g_signal_handlers_disconnect_by_func(G_OBJECT(mvte->priv->foreign_vadj), sync_vadj_value, mvte);
-    g_signal_handlers_disconnect_by_func(G_OBJECT(my_vadj),                  sync_vadj,       mvte);
-    g_signal_handlers_disconnect_by_func(G_OBJECT(my_vadj),                  sync_vadj_value, mvte);
+    g_signal_handlers_disconnect_by_func(G_OBJECT(mvte->priv->foreign_vadj), foreign_vadj_changed,       mvte);
+    g_signal_handlers_disconnect_by_func(G_OBJECT(mvte->priv->foreign_vadj), foreign_vadj_value_changed, mvte);
     g_object_unref(mvte->priv->foreign_vadj);
     mvte->priv->foreign_vadj = NULL;
   }
 
   if (vadjustment) {
     mvte->priv->foreign_vadj = g_object_ref(vadjustment);
-    g_signal_connect(G_OBJECT(vadjustment), "changed",       (GCallback)sync_vadj,       mvte);
-    g_signal_connect(G_OBJECT(vadjustment), "value-changed", (GCallback)sync_vadj_value, mvte);
-    g_signal_connect(G_OBJECT(my_vadj),     "changed",       (GCallback)sync_vadj,       mvte);
-    g_signal_connect(G_OBJECT(my_vadj),     "value-changed", (GCallback)sync_vadj_value, mvte);
+    g_signal_connect(G_OBJECT(vadjustment), "changed",       (GCallback)foreign_vadj_changed,       mvte);
+    g_signal_connect(G_OBJECT(vadjustment), "value-changed", (GCallback)foreign_vadj_value_changed, mvte);
+    queue_sync_to_foreign(mvte);
   }
 }
 
@@ -135,13 +322,26 @@ set_pan_mode(MaemoVte *mvte, gboolean pan_mode)
 {
   if (pan_mode != mvte->priv->pan_mode) {
     mvte->priv->pan_mode = pan_mode;
-    if (!pan_mode) {
-      sync_vadj(vte_terminal_get_adjustment(VTE_TERMINAL(mvte)), mvte);
-      sync_vadj_value(vte_terminal_get_adjustment(VTE_TERMINAL(mvte)), mvte);
-    }
+    if (!pan_mode)
+      sync_to_foreign(mvte);
     g_object_notify(G_OBJECT(mvte), "pan-mode");
   }
 }
+
+/* Lets the adjustment sync run along with the other per-frame updates of the
+   window showing @mvte */
+void
+maemo_vte_set_frame_scheduler(MaemoVte *mvte, FrameScheduler *scheduler)
+{
+  if (mvte->priv->scheduler == scheduler)
+    return;
+
+  if (mvte->priv->scheduler) {
+    frame_scheduler_cancel(mvte->priv->scheduler, mvte);
+    frame_scheduler_unref(mvte->priv->scheduler);
+  }
+  mvte->priv->scheduler = scheduler ? frame_scheduler_ref(scheduler) : NULL;
+}
 #if (0)
 static void
 dump_key_event(GdkEventKey *event)
@@ -245,6 +445,113 @@ set_control_mask(MaemoVte *mvte, gboolean new_value)
   }
 }
 
+static gboolean
+always_selected(VteTerminal *vte, glong column, glong row, gpointer null)
+{
+  return TRUE;
+}
+
+static void
+watch_matched(OutputWatch *watch, guint pattern, gboolean *matched)
+{
+  matched[pattern] = TRUE;
+}
+
+static void
+watch_skip_to_cursor(MaemoVte *mvte)
+{
+  vte_terminal_get_cursor_position(VTE_TERMINAL(mvte), &(mvte->priv->watch_col), &(mvte->priv->watch_row));
+  mvte->priv->watch_state = 0;
+}
+
+static gboolean
+watch_scan(MaemoVte *mvte)
+{
+  VteTerminal *vte = VTE_TERMINAL(mvte);
+  GtkAdjustment *adj = vte_terminal_get_adjustment(vte);
+  glong row, col;
+
+  mvte->priv->watch_scan_id = 0;
+
+  if (!(mvte->priv->watch))
+    return FALSE;
+
+  vte_terminal_get_cursor_position(vte, &col, &row);
+
+  /* Only the text between where the previous scan stopped and the cursor is
+     new. If that spot has scrolled away or the cursor has moved back before it,
+     the screen has been redrawn and we start over from the cursor. */
+  if (mvte->priv->watch_row < (glong)(adj->lower) ||
+      mvte->priv->watch_row > row ||
+      (mvte->priv->watch_row == row && mvte->priv->watch_col > col))
+    watch_skip_to_cursor(mvte);
+  else if (mvte->priv->watch_row < row || mvte->priv->watch_col < col) {
+    char *text = vte_terminal_get_text_range(vte,
+      mvte->priv->watch_row, mvte->priv->watch_col, row, col - 1,
+      always_selected, NULL, NULL);
+
+    if (text) {
+      guint n_patterns = output_watch_get_n_patterns(mvte->priv->watch), Nix;
+      gboolean *matched = g_new0(gboolean, n_patterns);
+      GTimeVal now;
+
+      mvte->priv->watch_state = output_watch_scan(mvte->priv->watch, mvte->priv->watch_state,
+        text, strlen(text), (OutputWatchFunc)watch_matched, matched);
+
+      /* Report each pattern once per scan, however often it occurred, and
+         then not again until WATCH_HOLDOFF has passed */
+      g_get_current_time(&now);
+      for (Nix = 0 ; Nix < n_patterns ; Nix++)
+        if (matched[Nix] &&
+            (!(mvte->priv->watch_reported[Nix]) ||
+             now.tv_sec < mvte->priv->watch_reported[Nix] ||
+             now.tv_sec - mvte->priv->watch_reported[Nix] >= WATCH_HOLDOFF)) {
+          mvte->priv->watch_reported[Nix] = now.tv_sec;
+          g_signal_emit(mvte, mvte_signals[WATCH_MATCH_SIGNAL], 0,
+            output_watch_get_patterns(mvte->priv->watch)[Nix]);
+        }
+
+      g_free(matched);
+      g_free(text);
+    }
+
+    mvte->priv->watch_row = row;
+    mvte->priv->watch_col = col;
+  }
+
+  return FALSE;
+}
+
+static void
+contents_changed(MaemoVte *mvte, gpointer null)
+{
+  if (mvte->priv->watch && !(mvte->priv->watch_scan_id))
+    mvte->priv->watch_scan_id = g_timeout_add(WATCH_SCAN_INTERVAL, (GSourceFunc)watch_scan, mvte);
+}
+
+/* Replaces the set of patterns searched for in the output with @watch. Only
+   output arriving after this call is searched. */
+void
+maemo_vte_set_watch(MaemoVte *mvte, OutputWatch *watch)
+{
+  if (mvte->priv->watch == watch)
+    return;
+
+  if (mvte->priv->watch)
+    output_watch_unref(mvte->priv->watch);
+  mvte->priv->watch = watch ? output_watch_ref(watch) : NULL;
+
+  g_free(mvte->priv->watch_reported);
+  mvte->priv->watch_reported = watch ? g_new0(glong, output_watch_get_n_patterns(watch)) : NULL;
+
+  if (mvte->priv->watch_scan_id) {
+    g_source_remove(mvte->priv->watch_scan_id);
+    mvte->priv->watch_scan_id = 0;
+  }
+
+  watch_skip_to_cursor(mvte);
+}
+
 static void
 set_property(GObject *obj, guint property_id, const GValue *value, GParamSpec *pspec)
 {
@@ -257,6 +564,10 @@ set_property(GObject *obj, guint property_id, const GValue *value, GParamSpec *p
       set_control_mask(MAEMO_VTE(obj), g_value_get_boolean(value));
       break;
 
+    case SHOW_DAMAGE_PROPERTY:
+      set_show_damage(MAEMO_VTE(obj), g_value_get_boolean(value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, property_id, pspec);
   }
@@ -278,6 +589,18 @@ get_property(GObject *obj, guint property_id, GValue *value, GParamSpec *pspec)
       g_value_set_string(value, MAEMO_VTE(obj)->priv->match);
       break;
 
+    case CAN_PAN_PROPERTY:
+      g_value_set_boolean(value, MAEMO_VTE(obj)->priv->can_pan);
+      break;
+
+    case SHOW_DAMAGE_PROPERTY:
+      g_value_set_boolean(value, MAEMO_VTE(obj)->priv->show_damage);
+      break;
+
+    case THROTTLED_PROPERTY:
+      g_value_set_boolean(value, MAEMO_VTE(obj)->priv->throttled);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, property_id, pspec);
   }
@@ -394,6 +717,471 @@ imc_retrieve_surrounding(GtkIMContext *imc, MaemoVte *mvte)
   gtk_im_context_set_surrounding(imc, "", -1, 0);
 }
 
+static gboolean
+damage_tick(MaemoVte *mvte)
+{
+  mvte->priv->cells_per_second = mvte->priv->damage_cells;
+  mvte->priv->pixels_per_second = mvte->priv->damage_pixels;
+  mvte->priv->damage_cells = 0;
+  mvte->priv->damage_pixels = 0;
+
+  if (mvte->priv->pixels_per_second)
+    g_debug("%s %p: %u cells, %u pixels repainted in the last second", MAEMO_VTE_TYPE_STRING, mvte,
+            mvte->priv->cells_per_second, mvte->priv->pixels_per_second);
+
+  return TRUE;
+}
+
+static void
+set_show_damage(MaemoVte *mvte, gboolean show_damage)
+{
+  if (show_damage == mvte->priv->show_damage)
+    return;
+
+  mvte->priv->show_damage = show_damage;
+  mvte->priv->damage_cells = 0;
+  mvte->priv->damage_pixels = 0;
+  mvte->priv->cells_per_second = 0;
+  mvte->priv->pixels_per_second = 0;
+
+  if (show_damage)
+    mvte->priv->damage_id = g_timeout_add(1000, (GSourceFunc)damage_tick, mvte);
+  else if (mvte->priv->damage_id) {
+    g_source_remove(mvte->priv->damage_id);
+    mvte->priv->damage_id = 0;
+  }
+
+  /* Get rid of old outlines, or start with a clean slate */
+  gtk_widget_queue_draw(GTK_WIDGET(mvte));
+  g_object_notify(G_OBJECT(mvte), "show-damage");
+}
+
+/* Counts what VTE has just repainted and outlines it. The outline stays until
+   the area is next repainted, so areas that keep being repainted flicker
+   through the colours. */
+static void
+outline_damage(MaemoVte *mvte, GdkEventExpose *event)
+{
+  VteTerminal *vte = VTE_TERMINAL(mvte);
+  const double *colour = damage_colours[mvte->priv->flash_serial++ % G_N_ELEMENTS(damage_colours)];
+  GdkRectangle *rects = NULL;
+  cairo_t *cr;
+  gint n_rects, Nix;
+
+  gdk_region_get_rectangles(event->region, &rects, &n_rects);
+
+  cr = gdk_cairo_create(event->window);
+  cairo_set_line_width(cr, 1.0);
+
+  for (Nix = 0 ; Nix < n_rects ; Nix++) {
+    GdkRectangle *r = &rects[Nix];
+
+    mvte->priv->damage_pixels += r->width * r->height;
+    if (vte->char_width > 0 && vte->char_height > 0)
+      mvte->priv->damage_cells +=
+        ((r->x + r->width + vte->char_width - 1) / vte->char_width - r->x / vte->char_width) *
+        ((r->y + r->height + vte->char_height - 1) / vte->char_height - r->y / vte->char_height);
+
+    cairo_rectangle(cr, r->x + 0.5, r->y + 0.5, MAX(r->width - 1, 0), MAX(r->height - 1, 0));
+  }
+
+  cairo_set_source_rgba(cr, colour[0], colour[1], colour[2], 0.15);
+  cairo_fill_preserve(cr);
+  cairo_set_source_rgb(cr, colour[0], colour[1], colour[2]);
+  cairo_stroke(cr);
+
+  cairo_destroy(cr);
+  g_free(rects);
+}
+
+static gboolean
+expose_event(GtkWidget *widget, GdkEventExpose *event)
+{
+  MaemoVte *mvte = MAEMO_VTE(widget);
+  gulong us;
+  gboolean ret;
+
+  g_timer_start(mvte->priv->frame_timer);
+  ret = GTK_WIDGET_CLASS(MAEMO_VTE_PARENT_CLASS)->expose_event
+    ? GTK_WIDGET_CLASS(MAEMO_VTE_PARENT_CLASS)->expose_event(widget, event)
+    : FALSE;
+
+  if (event->window == widget->window) {
+    us = (gulong)(g_timer_elapsed(mvte->priv->frame_timer, NULL) * G_USEC_PER_SEC);
+    mvte->priv->stats.frames++;
+    mvte->priv->stats.frame_time += us;
+    mvte->priv->stats.max_frame_time = MAX(mvte->priv->stats.max_frame_time, us);
+
+    if (mvte->priv->show_damage)
+      outline_damage(mvte, event);
+  }
+
+  return ret;
+}
+
+/* Output shown, input sent and frames drawn by @mvte since it was created */
+void
+maemo_vte_get_stats(MaemoVte *mvte, MaemoVteStats *stats)
+{
+  (*stats) = mvte->priv->stats;
+}
+
+/* The pages of Unicode the output of @mvte has used */
+const FontFallbackPages *
+maemo_vte_get_shown_pages(MaemoVte *mvte)
+{
+  return &(mvte->priv->shown_pages);
+}
+
+/* How much of @mvte was repainted in the last second, while showing damage */
+void
+maemo_vte_get_damage_rate(MaemoVte *mvte, guint *cells, guint *pixels)
+{
+  if (cells)
+    (*cells) = mvte->priv->cells_per_second;
+  if (pixels)
+    (*pixels) = mvte->priv->pixels_per_second;
+}
+
+static void
+update_pty_size(MaemoVte *mvte)
+{
+  if (mvte->priv->resize_id) {
+    g_source_remove(mvte->priv->resize_id);
+    mvte->priv->resize_id = 0;
+  }
+
+  /* The pty only signals the child when the size really changes */
+  if (mvte->priv->pty)
+    terminal_pty_set_size(mvte->priv->pty, VTE_TERMINAL(mvte)->column_count, VTE_TERMINAL(mvte)->row_count);
+}
+
+static gboolean
+resize_settled(MaemoVte *mvte)
+{
+  mvte->priv->resize_id = 0;
+  update_pty_size(mvte);
+
+  return FALSE;
+}
+
+static void
+queue_pty_size(MaemoVte *mvte)
+{
+  if (!(mvte->priv->pty))
+    return;
+
+  if (mvte->priv->resize_id)
+    g_source_remove(mvte->priv->resize_id);
+  mvte->priv->resize_id = g_timeout_add(RESIZE_SETTLE_TIMEOUT, (GSourceFunc)resize_settled, mvte);
+}
+
+static void
+size_allocate(GtkWidget *widget, GtkAllocation *allocation)
+{
+  MaemoVte *mvte = MAEMO_VTE(widget);
+
+  GTK_WIDGET_CLASS(MAEMO_VTE_PARENT_CLASS)->size_allocate(widget, allocation);
+
+  /* VTE has just put its window back in place */
+  mvte->priv->pixel_offset = 0;
+  apply_pixel_offset(mvte);
+
+  /* Now that the terminal has its real size */
+  if (mvte->priv->preview) {
+    screen_snapshot_feed(mvte->priv->preview, VTE_TERMINAL(mvte));
+    screen_snapshot_free(mvte->priv->preview);
+    mvte->priv->preview = NULL;
+  }
+
+  queue_pty_size(mvte);
+}
+
+static void
+update_throttled(MaemoVte *mvte)
+{
+  gboolean throttled = mvte->priv->pty ? terminal_pty_is_throttled(mvte->priv->pty) : FALSE;
+
+  if (throttled != mvte->priv->throttled) {
+    mvte->priv->throttled = throttled;
+    g_object_notify(G_OBJECT(mvte), "throttled");
+  }
+}
+
+/* Once per read, not per row: the rows the output reached get the time it
+   came in. Rows gone from the scrollback go from the times as well. */
+static void
+record_line_times(MaemoVte *mvte)
+{
+  GtkAdjustment *adj = vte_terminal_get_adjustment(VTE_TERMINAL(mvte));
+  GTimeVal now;
+  glong column, row;
+
+  g_get_current_time(&now);
+  vte_terminal_get_cursor_position(VTE_TERMINAL(mvte), &column, &row);
+  line_times_record(mvte->priv->line_times, row, (gint64)now.tv_sec * 1000 + now.tv_usec / 1000);
+  line_times_forget(mvte->priv->line_times, (glong)(adj->lower));
+}
+
+static void
+pty_output(TerminalPty *pty, MaemoVte *mvte)
+{
+  GByteArray *output;
+
+  /* Kept for later, as long as there is room */
+  if (mvte->priv->hibernated) {
+    if (mvte->priv->backlog->len < MAX_BACKLOG) {
+      output = terminal_pty_steal_output(pty);
+      mvte->priv->stats.bytes_read += output->len;
+      g_byte_array_append(mvte->priv->backlog, output->data, output->len);
+      g_byte_array_free(output, TRUE);
+    }
+    return;
+  }
+
+  output = terminal_pty_steal_output(pty);
+
+  update_throttled(mvte);
+
+  /* The child is up, so the preview makes way for it */
+  if (output->len > 0 && mvte->priv->showing_preview) {
+    mvte->priv->showing_preview = FALSE;
+    if (mvte->priv->preview) {
+      screen_snapshot_free(mvte->priv->preview);
+      mvte->priv->preview = NULL;
+    }
+    else
+      vte_terminal_reset(VTE_TERMINAL(mvte), TRUE, TRUE);
+  }
+
+  mvte->priv->stats.bytes_read += output->len;
+  if (output->len > 0) {
+    if (!g_strcmp0(vte_terminal_get_encoding(VTE_TERMINAL(mvte)), "UTF-8"))
+      font_fallback_note_text((const gchar *)(output->data), output->len, &(mvte->priv->shown_pages));
+    terminal_modes_feed(mvte->priv->modes, (const gchar *)(output->data), output->len);
+    vte_terminal_feed(VTE_TERMINAL(mvte), (const char *)(output->data), output->len);
+    if (mvte->priv->line_times)
+      record_line_times(mvte);
+  }
+  g_byte_array_free(output, TRUE);
+}
+
+static void
+pty_exited(TerminalPty *pty, gint status, MaemoVte *mvte)
+{
+  /* Whatever the child left behind goes on screen before it is announced */
+  pty_output(pty, mvte);
+  g_signal_emit_by_name(mvte, "child-exited");
+}
+
+static void
+commit(VteTerminal *vte, gchar *text, guint length, gpointer null)
+{
+  MaemoVte *mvte = MAEMO_VTE(vte);
+
+  /* VTE sends it to its own pty, if it has one */
+  mvte->priv->stats.bytes_written += length;
+  if (mvte->priv->pty)
+    terminal_pty_write(mvte->priv->pty, text, length);
+}
+
+/* Hands the child on @pty over to @mvte, which shows its output, sends it
+   what the user types, and keeps the pty the size of the terminal. VTE itself
+   has no pty in this case, so its own child handling stays out of the way. */
+void
+maemo_vte_set_pty(MaemoVte *mvte, TerminalPty *pty)
+{
+  if (mvte->priv->pty)
+    terminal_pty_free(mvte->priv->pty);
+  mvte->priv->pty = pty;
+  terminal_modes_reset(mvte->priv->modes);
+
+  if (pty) {
+    terminal_pty_set_callbacks(pty, (TerminalPtyOutputFunc)pty_output, (TerminalPtyExitFunc)pty_exited, mvte);
+    terminal_pty_set_read_budget(pty, mvte->priv->read_budget);
+    update_pty_size(mvte);
+    update_throttled(mvte);
+  }
+  else
+    mvte->priv->throttled = FALSE;
+}
+
+/* The pty set with maemo_vte_set_pty(), or NULL */
+TerminalPty *
+maemo_vte_get_pty(MaemoVte *mvte)
+{
+  return mvte->priv->pty;
+}
+
+/* Shows @snapshot, faint, until the first output from the pty set with
+   maemo_vte_set_pty() comes in. Takes ownership of @snapshot. */
+void
+maemo_vte_show_preview(MaemoVte *mvte, ScreenSnapshot *snapshot)
+{
+  if (mvte->priv->preview)
+    screen_snapshot_free(mvte->priv->preview);
+  mvte->priv->preview = NULL;
+  mvte->priv->showing_preview = (snapshot != NULL);
+
+  if (!snapshot)
+    return;
+
+  if (GTK_WIDGET_REALIZED(GTK_WIDGET(mvte))) {
+    screen_snapshot_feed(snapshot, VTE_TERMINAL(mvte));
+    screen_snapshot_free(snapshot);
+  }
+  else
+    mvte->priv->preview = snapshot;
+}
+
+/* Whether the preview is still up, with nothing from the child shown yet */
+gboolean
+maemo_vte_is_showing_preview(MaemoVte *mvte)
+{
+  return mvte->priv->showing_preview;
+}
+
+/* Empties the terminal down to a plain text copy of its rows and scrollback,
+   and gives up its window along with everything drawn in it. The pty is kept,
+   and its output set aside until maemo_vte_wake(). Only a terminal with a pty
+   set with maemo_vte_set_pty(), and nothing left of a preview, can hibernate,
+   and only while the text is all there is to it: not on the alternate screen,
+   nor with modes, character sets, a scroll region or attributes other than a
+   reset leaves them, which the text would not bring back. */
+gboolean
+maemo_vte_hibernate(MaemoVte *mvte)
+{
+  VteTerminal *vte = VTE_TERMINAL(mvte);
+  GtkAdjustment *adj = vte_terminal_get_adjustment(vte);
+  glong column, row;
+  gchar *text;
+
+  if (mvte->priv->hibernated || !(mvte->priv->pty) || mvte->priv->showing_preview ||
+      !terminal_modes_are_default(mvte->priv->modes, vte->row_count))
+    return FALSE;
+
+  text = vte_terminal_get_text_range(vte, (glong)(adj->lower), 0, (glong)(adj->upper) - 1, vte->column_count - 1,
+                                     always_selected, NULL, NULL);
+  vte_terminal_get_cursor_position(vte, &column, &row);
+  mvte->priv->hibernated = screen_snapshot_new_with_scrollback(vte->column_count, vte->row_count, text);
+  mvte->priv->hibernated_column = column;
+  mvte->priv->hibernated_row = MAX((glong)(adj->upper) - 1 - row, 0);
+  mvte->priv->backlog = g_byte_array_new();
+  g_free(text);
+
+  /* Clearing the history frees VTE's rows, which cost far more than text */
+  vte_terminal_set_scrollback_lines(vte, 0);
+  vte_terminal_reset(vte, TRUE, TRUE);
+  /* The rows are numbered over again once woken */
+  if (mvte->priv->line_times)
+    line_times_clear(mvte->priv->line_times);
+  if (GTK_WIDGET_REALIZED(GTK_WIDGET(mvte)))
+    gtk_widget_unrealize(GTK_WIDGET(mvte));
+
+  return TRUE;
+}
+
+/* Puts back what maemo_vte_hibernate() kept, followed by the output that came
+   in since. The scrollback is expected to have been given its size back. */
+void
+maemo_vte_wake(MaemoVte *mvte)
+{
+  GByteArray *backlog = mvte->priv->backlog;
+
+  if (!(mvte->priv->hibernated))
+    return;
+
+  screen_snapshot_restore(mvte->priv->hibernated, VTE_TERMINAL(mvte),
+                          mvte->priv->hibernated_column, mvte->priv->hibernated_row);
+  screen_snapshot_free(mvte->priv->hibernated);
+  mvte->priv->hibernated = NULL;
+  mvte->priv->backlog = NULL;
+
+  if (backlog->len > 0) {
+    if (!g_strcmp0(vte_terminal_get_encoding(VTE_TERMINAL(mvte)), "UTF-8"))
+      font_fallback_note_text((const gchar *)(backlog->data), backlog->len, &(mvte->priv->shown_pages));
+    terminal_modes_feed(mvte->priv->modes, (const gchar *)(backlog->data), backlog->len);
+    vte_terminal_feed(VTE_TERMINAL(mvte), (const char *)(backlog->data), backlog->len);
+  }
+  g_byte_array_free(backlog, TRUE);
+
+  /* Whatever was left on the pty for want of room */
+  if (mvte->priv->pty)
+    pty_output(mvte->priv->pty, mvte);
+}
+
+gboolean
+maemo_vte_is_hibernating(MaemoVte *mvte)
+{
+  return (mvte->priv->hibernated != NULL);
+}
+
+/* Lets go of the scrollback a hibernating terminal keeps, leaving the rows
+   that were on screen. Returns about how many bytes that gave back. */
+gsize
+maemo_vte_trim_hibernated(MaemoVte *mvte)
+{
+  if (!(mvte->priv->hibernated))
+    return 0;
+
+  return screen_snapshot_trim(mvte->priv->hibernated, VTE_TERMINAL(mvte)->row_count);
+}
+
+/* What a hibernating terminal keeps of its rows, or NULL if it is awake. The
+   rows are numbered from 0, the way they will be once woken, and so is the
+   cursor row. */
+ScreenSnapshot *
+maemo_vte_get_hibernated(MaemoVte *mvte, glong *cursor_column, glong *cursor_row)
+{
+  if (!(mvte->priv->hibernated))
+    return NULL;
+
+  if (cursor_column)
+    (*cursor_column) = mvte->priv->hibernated_column;
+  if (cursor_row)
+    (*cursor_row) = MAX((glong)screen_snapshot_get_n_lines(mvte->priv->hibernated) - 1 -
+                        mvte->priv->hibernated_row, 0);
+
+  return mvte->priv->hibernated;
+}
+
+/* Starts or stops noting when each row gets its first output. Only output
+   from a pty set with maemo_vte_set_pty() is timed. */
+void
+maemo_vte_set_line_times(MaemoVte *mvte, gboolean enabled)
+{
+  if (enabled == (mvte->priv->line_times != NULL))
+    return;
+
+  if (enabled)
+    mvte->priv->line_times = line_times_new();
+  else {
+    line_times_free(mvte->priv->line_times);
+    mvte->priv->line_times = NULL;
+  }
+}
+
+/* When @row, numbered the way VTE does, got its first output, in
+   milliseconds since the epoch */
+gboolean
+maemo_vte_get_line_time(MaemoVte *mvte, glong row, gint64 *msec)
+{
+  return mvte->priv->line_times && line_times_lookup(mvte->priv->line_times, row, msec);
+}
+
+/* Limits how much output is read per second, or lifts the limit if 0. Only
+   a pty set with maemo_vte_set_pty() can be limited. */
+void
+maemo_vte_set_read_budget(MaemoVte *mvte, gsize bytes_per_second)
+{
+  if (bytes_per_second == mvte->priv->read_budget)
+    return;
+
+  mvte->priv->read_budget = bytes_per_second;
+  if (mvte->priv->pty)
+    terminal_pty_set_read_budget(mvte->priv->pty, bytes_per_second);
+}
+
 static void
 realize(GtkWidget *widget)
 {
@@ -414,6 +1202,18 @@ realize(GtkWidget *widget)
   }
 }
 
+/* VTE drops its input method along with its window */
+static void
+unrealize(GtkWidget *widget)
+{
+  void (*parent_unrealize)(GtkWidget *widget) = GTK_WIDGET_CLASS(g_type_class_peek(g_type_parent(MAEMO_VTE_TYPE)))->unrealize;
+
+  MAEMO_VTE(widget)->priv->imc = NULL;
+
+  if (parent_unrealize)
+    parent_unrealize(widget);
+}
+
 static void
 finalize(GObject *obj)
 {
@@ -421,6 +1221,30 @@ finalize(GObject *obj)
   MaemoVte *mvte = MAEMO_VTE(obj);
 
   g_free(mvte->priv->match);
+  if (mvte->priv->watch_scan_id)
+    g_source_remove(mvte->priv->watch_scan_id);
+  if (mvte->priv->watch)
+    output_watch_unref(mvte->priv->watch);
+  g_free(mvte->priv->watch_reported);
+  maemo_vte_set_frame_scheduler(mvte, NULL);
+  if (mvte->priv->sync_id)
+    g_source_remove(mvte->priv->sync_id);
+  if (mvte->priv->snap_id)
+    g_source_remove(mvte->priv->snap_id);
+  maemo_vte_set_pty(mvte, NULL);
+  screen_snapshot_free(mvte->priv->preview);
+  screen_snapshot_free(mvte->priv->hibernated);
+  line_times_free(mvte->priv->line_times);
+  terminal_modes_free(mvte->priv->modes);
+  if (mvte->priv->backlog)
+    g_byte_array_free(mvte->priv->backlog, TRUE);
+  if (mvte->priv->resize_id)
+    g_source_remove(mvte->priv->resize_id);
+  if (mvte->priv->damage_id)
+    g_source_remove(mvte->priv->damage_id);
+  g_timer_destroy(mvte->priv->frame_timer);
+  if (mvte->priv->foreign_vadj)
+    g_object_unref(mvte->priv->foreign_vadj);
   if (parent_finalize)
     parent_finalize(obj);
 }
@@ -456,12 +1280,27 @@ class_init(gpointer g_class, gpointer null)
     g_param_spec_string("match", "Match", "The latest regex match the user has clicked on",
       NULL, G_PARAM_READABLE));
 
+  g_object_class_install_property(gobject_class, CAN_PAN_PROPERTY,
+    g_param_spec_boolean("can-pan", "Can pan", "Whether there is more to the terminal than fits on the screen",
+      FALSE, G_PARAM_READABLE));
+
+  g_object_class_install_property(gobject_class, SHOW_DAMAGE_PROPERTY,
+    g_param_spec_boolean("show-damage", "Show damage", "Outline repainted areas and count them per second",
+      FALSE, G_PARAM_READWRITE));
+
+  g_object_class_install_property(gobject_class, THROTTLED_PROPERTY,
+    g_param_spec_boolean("throttled", "Throttled", "Whether output is held back for going over the read budget",
+      FALSE, G_PARAM_READABLE));
+
   widget_class->button_press_event = button_press_event;
   widget_class->motion_notify_event = motion_notify_event;
   widget_class->button_release_event = button_release_event;
   widget_class->key_press_event = key_press_release_event;
   widget_class->key_release_event = key_press_release_event;
   widget_class->realize = realize;
+  widget_class->unrealize = unrealize;
+  widget_class->size_allocate = size_allocate;
+  widget_class->expose_event = expose_event;
 
   widget_class->set_scroll_adjustments_signal =
     g_signal_new(
@@ -477,6 +1316,17 @@ class_init(gpointer g_class, gpointer null)
 
   mvte_class->set_scroll_adjustments = set_scroll_adjustments;
 
+  mvte_signals[WATCH_MATCH_SIGNAL] =
+    g_signal_new(
+      "watch-match",
+      G_OBJECT_CLASS_TYPE(g_class),
+      G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(MaemoVteClass, watch_match),
+      NULL, NULL,
+      g_cclosure_marshal_VOID__STRING,
+      G_TYPE_NONE, 1,
+      G_TYPE_STRING);
+
   g_type_class_add_private(g_class, sizeof(MaemoVtePrivate));
 }
 
@@ -491,9 +1341,34 @@ instance_init(GTypeInstance *instance, gpointer g_class)
   mvte->priv->pan_mode = FALSE;
   mvte->priv->control_mask = FALSE;
   mvte->priv->match = NULL;
+  mvte->priv->watch = NULL;
+  mvte->priv->watch_state = 0;
+  mvte->priv->watch_row = 0;
+  mvte->priv->watch_col = 0;
+  mvte->priv->watch_scan_id = 0;
+  mvte->priv->scheduler = NULL;
+  mvte->priv->sync_id = 0;
+  mvte->priv->can_pan = FALSE;
+  mvte->priv->pixel_offset = 0;
+  mvte->priv->snap_id = 0;
+  mvte->priv->pty = NULL;
+  mvte->priv->read_budget = 0;
+  mvte->priv->throttled = FALSE;
+  mvte->priv->preview = NULL;
+  mvte->priv->showing_preview = FALSE;
+  mvte->priv->show_damage = FALSE;
+  mvte->priv->damage_id = 0;
+  mvte->priv->flash_serial = 0;
+  memset(&(mvte->priv->stats), 0, sizeof(MaemoVteStats));
+  mvte->priv->frame_timer = g_timer_new();
+  mvte->priv->modes = terminal_modes_new();
+  set_show_damage(mvte, g_getenv("OSSO_XTERM_SHOW_DAMAGE") != NULL);
+  g_signal_connect(G_OBJECT(instance), "commit", (GCallback)commit, NULL);
+  g_signal_connect(G_OBJECT(instance), "contents-changed", (GCallback)contents_changed, NULL);
+  g_signal_connect(G_OBJECT(instance), "char-size-changed", (GCallback)queue_sync_to_foreign, NULL);
   if ((adj = vte_terminal_get_adjustment(VTE_TERMINAL(instance))) != NULL) {
-    g_signal_connect(G_OBJECT(adj), "changed",       (GCallback)sync_vadj,       instance);
-    g_signal_connect(G_OBJECT(adj), "value-changed", (GCallback)sync_vadj_value, instance);
+    g_signal_connect(G_OBJECT(adj), "changed",       (GCallback)vte_vadj_changed, instance);
+    g_signal_connect(G_OBJECT(adj), "value-changed", (GCallback)vte_vadj_changed, instance);
   }
 }
 
@@ -2,6 +2,11 @@
 #define _MAEMO_VTE_H_
 
 #include <vte/vte.h>
+#include "output-watch.h"
+#include "frame-scheduler.h"
+#include "terminal-pty.h"
+#include "screen-snapshot.h"
+#include "font-fallback.h"
 
 G_BEGIN_DECLS
 
@@ -16,14 +21,43 @@ struct _MaemoVte
   MaemoVtePrivate *priv;
 };
 
+/* Bytes read count only output from a pty set with maemo_vte_set_pty(). Frame
+   times are in microseconds. */
+typedef struct
+{
+  guint64 bytes_read;
+  guint64 bytes_written;
+  guint frames;
+  guint64 frame_time;
+  gulong max_frame_time;
+} MaemoVteStats;
+
 struct _MaemoVteClass
 {
   VteTerminalClass parent_class;
 
   void (*set_scroll_adjustments) (MaemoVte *vs, GtkAdjustment *hadjustment, GtkAdjustment *vadjustment);
+  void (*watch_match) (MaemoVte *mvte, const char *pattern);
 };
 
 GType maemo_vte_get_type( void );
+void maemo_vte_set_watch(MaemoVte *mvte, OutputWatch *watch);
+void maemo_vte_set_frame_scheduler(MaemoVte *mvte, FrameScheduler *scheduler);
+void maemo_vte_set_pty(MaemoVte *mvte, TerminalPty *pty);
+TerminalPty *maemo_vte_get_pty(MaemoVte *mvte);
+void maemo_vte_set_read_budget(MaemoVte *mvte, gsize bytes_per_second);
+void maemo_vte_show_preview(MaemoVte *mvte, ScreenSnapshot *snapshot);
+gboolean maemo_vte_is_showing_preview(MaemoVte *mvte);
+gboolean maemo_vte_hibernate(MaemoVte *mvte);
+void maemo_vte_wake(MaemoVte *mvte);
+gboolean maemo_vte_is_hibernating(MaemoVte *mvte);
+gsize maemo_vte_trim_hibernated(MaemoVte *mvte);
+ScreenSnapshot *maemo_vte_get_hibernated(MaemoVte *mvte, glong *cursor_column, glong *cursor_row);
+void maemo_vte_set_line_times(MaemoVte *mvte, gboolean enabled);
+gboolean maemo_vte_get_line_time(MaemoVte *mvte, glong row, gint64 *msec);
+void maemo_vte_get_damage_rate(MaemoVte *mvte, guint *cells, guint *pixels);
+void maemo_vte_get_stats(MaemoVte *mvte, MaemoVteStats *stats);
+const FontFallbackPages *maemo_vte_get_shown_pages(MaemoVte *mvte);
 
 #define MAEMO_VTE_TYPE_STRING "MaemoVte"
 #define MAEMO_VTE_TYPE (maemo_vte_get_type())
@@ -28,6 +28,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include <gtk/gtk.h>
 #include <glib-object.h>
@@ -37,27 +41,76 @@
 #include "terminal-manager.h"
 #include "stock-icons.h"
 #include "terminal-gconf.h"
+#include "terminal-pty.h"
 
-static gint osso_xterm_incoming(const gchar *interface,
-    const gchar *method,
-    GArray *arguments,
-    gpointer data,
-    osso_rpc_t *retval)
+/* Upper bound on the rows returned by a single get_text_range call, so that
+ * a client reading a long scrollback pages through it and the main loop gets
+ * to draw in between */
+#define OSSO_XTERM_DBUS_MAX_PAGE_ROWS 500
+
+static gint
+incoming_error(osso_rpc_t *retval, const gchar *message)
 {
-  gchar *command = NULL;
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = g_strdup(message);
+  return OSSO_ERROR;
+}
+
+static gboolean
+get_int_argument(GArray *arguments, guint index, gint *value)
+{
+  osso_rpc_t *arg;
+
+  if (index >= arguments->len)
+    return FALSE;
 
-  if (strcmp(method, "run_command")) {
-    retval->type = DBUS_TYPE_STRING;
-    retval->value.s = g_strdup("Meh");
-    return OSSO_ERROR;
+  arg = &g_array_index(arguments, osso_rpc_t, index);
+  switch (arg->type) {
+    case DBUS_TYPE_INT32:
+      *value = arg->value.i;
+      return TRUE;
+
+    case DBUS_TYPE_UINT32:
+      *value = (gint)arg->value.u;
+      return TRUE;
+
+    default:
+      return FALSE;
   }
+}
+
+static const gchar *
+get_string_argument(GArray *arguments, guint index)
+{
+  if (index >= arguments->len ||
+      g_array_index(arguments, osso_rpc_t, index).type != DBUS_TYPE_STRING)
+    return NULL;
+
+  return g_array_index(arguments, osso_rpc_t, index).value.s;
+}
+
+static TerminalWidget *
+get_terminal_argument(TerminalManager *manager, GArray *arguments, guint index)
+{
+  gint id;
+
+  if (!get_int_argument(arguments, index, &id))
+    return NULL;
+
+  return terminal_manager_find_terminal(manager, (guint)id);
+}
+
+static gint
+incoming_run_command(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  gchar *command = NULL;
 
   if (arguments->len && 
       g_array_index(arguments, osso_rpc_t, 0).type == DBUS_TYPE_STRING) {
     command = g_array_index(arguments, osso_rpc_t, 0).value.s;
   }
 
-  retval->value.b = terminal_manager_new_window(TERMINAL_MANAGER(data),
+  retval->value.b = terminal_manager_new_window(manager,
       command,
       NULL);
 
@@ -66,10 +119,392 @@ static gint osso_xterm_incoming(const gchar *interface,
   return OSSO_OK;
 }
 
+/* One line per terminal: "<id>\t<columns>x<rows>\t<title>" */
+static gint
+incoming_list_terminals(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  GString *str = g_string_new(NULL);
+  GSList *iter;
+  GList *terminals, *titer;
+
+  for (iter = manager->windows ; iter ; iter = iter->next) {
+    terminals = terminal_window_get_terminals(TERMINAL_WINDOW(iter->data));
+    for (titer = terminals ; titer ; titer = titer->next) {
+      TerminalWidget *widget = TERMINAL_WIDGET(titer->data);
+      gchar *title = terminal_widget_get_title(widget);
+      gint columns, rows;
+
+      terminal_widget_get_size(widget, &columns, &rows);
+      g_string_append_printf(str, "%u\t%dx%d\t%s\n",
+          terminal_widget_get_id(widget), columns, rows, title);
+      g_free(title);
+    }
+    g_list_free(terminals);
+  }
+
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = g_string_free(str, FALSE);
+
+  return OSSO_OK;
+}
+
+/* "<first row> <end row>", the end being exclusive */
+static gint
+incoming_get_row_range(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget = get_terminal_argument(manager, arguments, 0);
+  glong first_row, end_row;
+
+  if (!widget)
+    return incoming_error(retval, "No such terminal");
+
+  terminal_widget_get_row_range(widget, &first_row, &end_row);
+
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = g_strdup_printf("%ld %ld", first_row, end_row);
+
+  return OSSO_OK;
+}
+
+static gint
+incoming_get_visible_text(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget = get_terminal_argument(manager, arguments, 0);
+  gchar *text;
+
+  if (!widget)
+    return incoming_error(retval, "No such terminal");
+
+  text = terminal_widget_get_visible_text(widget);
+
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = text ? text : g_strdup("");
+
+  return OSSO_OK;
+}
+
+static gint
+incoming_get_text_range(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget = get_terminal_argument(manager, arguments, 0);
+  gint first_row, n_rows;
+  gchar *text;
+
+  if (!widget)
+    return incoming_error(retval, "No such terminal");
+
+  if (!(get_int_argument(arguments, 1, &first_row) &&
+        get_int_argument(arguments, 2, &n_rows)))
+    return incoming_error(retval, "Expected first row and number of rows");
+
+  text = terminal_widget_get_text_range(widget, first_row,
+      MIN(n_rows, OSSO_XTERM_DBUS_MAX_PAGE_ROWS));
+
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = text ? text : g_strdup("");
+
+  return OSSO_OK;
+}
+
+/* "<column> <row>" */
+static gint
+incoming_get_cursor_position(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget = get_terminal_argument(manager, arguments, 0);
+  glong column, row;
+
+  if (!widget)
+    return incoming_error(retval, "No such terminal");
+
+  terminal_widget_get_cursor_position(widget, &column, &row);
+
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = g_strdup_printf("%ld %ld", column, row);
+
+  return OSSO_OK;
+}
+
+static gint
+incoming_add_watch(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget = get_terminal_argument(manager, arguments, 0);
+  const gchar *pattern = get_string_argument(arguments, 1);
+
+  if (!widget)
+    return incoming_error(retval, "No such terminal");
+
+  if (!(pattern && *pattern))
+    return incoming_error(retval, "Expected a pattern");
+
+  terminal_widget_add_watch_pattern(widget, pattern);
+
+  retval->type = DBUS_TYPE_BOOLEAN;
+  retval->value.b = TRUE;
+
+  return OSSO_OK;
+}
+
+static gint
+incoming_clear_watches(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget = get_terminal_argument(manager, arguments, 0);
+
+  if (!widget)
+    return incoming_error(retval, "No such terminal");
+
+  terminal_widget_clear_watch_patterns(widget);
+
+  retval->type = DBUS_TYPE_BOOLEAN;
+  retval->value.b = TRUE;
+
+  return OSSO_OK;
+}
+
+/* "<id>\t<name>=<value> ...\n" */
+static void
+append_stats(GString *str, TerminalWidget *widget)
+{
+  TerminalWidgetStats stats;
+
+  terminal_widget_get_stats(widget, &stats);
+  g_string_append_printf(str,
+      "%u\tread=%" G_GUINT64_FORMAT " written=%" G_GUINT64_FORMAT
+      " frames=%u frame_avg_us=%lu frame_max_us=%lu"
+      " scrollback_lines=%ld scrollback_bytes=%lu"
+      " font_cache_hits=%u font_cache_misses=%u"
+      " pid=%d cpu_ms=%" G_GUINT64_FORMAT "\n",
+      terminal_widget_get_id(widget), stats.bytes_read, stats.bytes_written,
+      stats.frames, stats.avg_frame_time, stats.max_frame_time,
+      stats.scrollback_lines, (gulong)stats.scrollback_bytes,
+      stats.font_cache_hits, stats.font_cache_misses,
+      (gint)stats.pid, stats.cpu_time);
+}
+
+/* "window\tupdates_queued=<n> ...\n", showing how many of the updates queued
+ * on the window's frame scheduler were coalesced */
+static void
+append_frame_stats(GString *str, TerminalWindow *window)
+{
+  FrameSchedulerStats stats;
+
+  terminal_window_get_frame_stats(window, &stats);
+  g_string_append_printf(str,
+      "window\tupdates_queued=%" G_GUINT64_FORMAT " updates_coalesced=%" G_GUINT64_FORMAT
+      " updates_run=%" G_GUINT64_FORMAT " update_frames=%" G_GUINT64_FORMAT "\n",
+      stats.queued, stats.coalesced, stats.run, stats.frames);
+}
+
+/* A line per window, followed by a line per terminal in it */
+static gchar *
+get_all_stats(TerminalManager *manager)
+{
+  GString *str = g_string_new(NULL);
+  GSList *iter;
+  GList *terminals, *titer;
+
+  for (iter = manager->windows ; iter ; iter = iter->next) {
+    append_frame_stats(str, TERMINAL_WINDOW(iter->data));
+    terminals = terminal_window_get_terminals(TERMINAL_WINDOW(iter->data));
+    for (titer = terminals ; titer ; titer = titer->next)
+      append_stats(str, TERMINAL_WIDGET(titer->data));
+    g_list_free(terminals);
+  }
+
+  return g_string_free(str, FALSE);
+}
+
+/* The stats of the given terminal, or of all of them */
+static gint
+incoming_get_stats(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  TerminalWidget *widget;
+
+  retval->type = DBUS_TYPE_STRING;
+
+  if (arguments->len) {
+    GString *str = g_string_new(NULL);
+
+    if (!(widget = get_terminal_argument(manager, arguments, 0))) {
+      g_string_free(str, TRUE);
+      return incoming_error(retval, "No such terminal");
+    }
+    append_stats(str, widget);
+    retval->value.s = g_string_free(str, FALSE);
+  }
+  else
+    retval->value.s = get_all_stats(manager);
+
+  return OSSO_OK;
+}
+
+/* "rss_kb=<resident size> windows=<live windows> terminals=<live terminals>",
+ * the counts including those closed but not yet freed. Polled between the
+ * open/close cycles of a leak check, these should settle rather than grow. */
+static gint
+incoming_get_memory(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval)
+{
+  gchar *statm = NULL;
+  unsigned long size = 0, resident = 0;
+
+  if (g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+    if (sscanf(statm, "%lu %lu", &size, &resident) != 2)
+      resident = 0;
+    g_free(statm);
+  }
+
+  retval->type = DBUS_TYPE_STRING;
+  retval->value.s = g_strdup_printf("rss_kb=%lu windows=%u terminals=%u",
+      resident * (sysconf(_SC_PAGESIZE) / 1024),
+      terminal_window_get_n_live(), terminal_widget_get_n_live());
+
+  return OSSO_OK;
+}
+
+static const struct {
+  const gchar *method;
+  gint (*handler)(TerminalManager *manager, GArray *arguments, osso_rpc_t *retval);
+} incoming_methods[] = {
+  { "run_command",         incoming_run_command },
+  { "list_terminals",      incoming_list_terminals },
+  { "get_row_range",       incoming_get_row_range },
+  { "get_visible_text",    incoming_get_visible_text },
+  { "get_text_range",      incoming_get_text_range },
+  { "get_cursor_position", incoming_get_cursor_position },
+  { "add_watch",           incoming_add_watch },
+  { "clear_watches",       incoming_clear_watches },
+  { "get_stats",           incoming_get_stats },
+  { "get_memory",          incoming_get_memory },
+};
+
+static gint osso_xterm_incoming(const gchar *interface,
+    const gchar *method,
+    GArray *arguments,
+    gpointer data,
+    osso_rpc_t *retval)
+{
+  int Nix;
+
+  for (Nix = 0 ; Nix < G_N_ELEMENTS(incoming_methods) ; Nix++)
+    if (!strcmp(method, incoming_methods[Nix].method))
+      return incoming_methods[Nix].handler(TERMINAL_MANAGER(data), arguments, retval);
+
+  return incoming_error(retval, "Meh");
+}
+
+/* SIGUSR1 only writes to this pipe, the stats are logged from the main loop */
+static int stats_pipe[2] = { -1, -1 };
+
+static void
+stats_signal(int signum)
+{
+  int saved_errno = errno;
+
+  while (write(stats_pipe[1], "", 1) < 0 && errno == EINTR);
+  errno = saved_errno;
+}
+
+static gboolean
+stats_requested(GIOChannel *channel, GIOCondition condition, TerminalManager *manager)
+{
+  gchar buf[16], *stats, **lines;
+  int Nix;
+
+  while (read(stats_pipe[0], buf, sizeof(buf)) > 0);
+
+  stats = get_all_stats(manager);
+  lines = g_strsplit(stats, "\n", -1);
+  for (Nix = 0 ; lines[Nix] ; Nix++)
+    if (lines[Nix][0])
+      g_message("stats: %s", lines[Nix]);
+  g_strfreev(lines);
+  g_free(stats);
+
+  return TRUE;
+}
+
+static void
+add_stats_dumper(TerminalManager *manager)
+{
+  struct sigaction sa;
+  GIOChannel *channel;
+
+  if (pipe(stats_pipe) < 0)
+    return;
+  fcntl(stats_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(stats_pipe[1], F_SETFL, O_NONBLOCK);
+  fcntl(stats_pipe[0], F_SETFD, FD_CLOEXEC);
+  fcntl(stats_pipe[1], F_SETFD, FD_CLOEXEC);
+
+  channel = g_io_channel_unix_new(stats_pipe[0]);
+  g_io_add_watch(channel, G_IO_IN, (GIOFunc)stats_requested, manager);
+  g_io_channel_unref(channel);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stats_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* The system warns before it starts killing things to get memory back */
+static void
+hw_state_changed(osso_hw_state_t *state, TerminalManager *manager)
+{
+  TerminalWidget *widget;
+
+  /* We may not be around to do it on closing */
+  if (state->save_unsaved_data_ind && manager->current &&
+      (widget = terminal_window_get_active(manager->current)) != NULL)
+    terminal_widget_save_last_session(widget);
+
+  if (state->memory_low_ind || state->save_unsaved_data_ind)
+    terminal_manager_shed_memory(manager);
+}
+
+static void
+add_hw_state_handler(osso_context_t *osso_context, TerminalManager *manager)
+{
+  osso_hw_state_t state = { 0, };
+
+  state.memory_low_ind = TRUE;
+  state.save_unsaved_data_ind = TRUE;
+  if (osso_hw_set_event_cb(osso_context, &state, (osso_hw_cb_f *)hw_state_changed, manager) != OSSO_OK)
+    g_warning("Cannot hear of the system running low on memory");
+}
+
+static gboolean
+get_bool_setting(GConfClient *gconf_client, const gchar *key, gboolean default_value)
+{
+  GConfValue *gconf_value = gconf_client_get(gconf_client, key, NULL);
+  gboolean value = default_value;
+
+  if (gconf_value) {
+    if (gconf_value->type == GCONF_VALUE_BOOL)
+      value = gconf_value_get_bool(gconf_value);
+    gconf_value_free(gconf_value);
+  }
+
+  return value;
+}
+
+/* osso-xterm-sessiond takes a moment to come up, which terminals are not
+   made to wait for: they get a pty of their own until it is there. Starting
+   it now gives it the time it takes to bring the first window up. */
+static void
+start_session_holder()
+{
+  GConfClient *gconf_client = gconf_client_get_default();
+
+  if (get_bool_setting(gconf_client, OSSO_XTERM_GCONF_THREADED_PTY, OSSO_XTERM_DEFAULT_THREADED_PTY) &&
+      get_bool_setting(gconf_client, OSSO_XTERM_GCONF_SESSION_HOLDER, OSSO_XTERM_DEFAULT_SESSION_HOLDER))
+    terminal_pty_start_holder();
+  g_object_unref(gconf_client);
+}
+
 static void
 gconf_setting_changed(GConfClient *client, guint connection_id, GConfEntry *entry, gpointer null)
 {
-	g_unlink(OSSO_XTERM_SCREENSHOT_FILE_NAME);
+	terminal_window_expire_screenshot(gconf_entry_get_key(entry));
 }
 
 static void
@@ -99,6 +534,10 @@ main (int argc, char **argv)
 
   g_set_application_name (_("X Terminal"));
 
+  /* Terminal output is read on threads of its own */
+  if (!g_thread_supported ())
+    g_thread_init (NULL);
+
   gtk_init (&argc, &argv);
 
   add_stock_icons();
@@ -141,6 +580,8 @@ main (int argc, char **argv)
     exit(EXIT_SUCCESS);
   }
 
+  start_session_holder();
+
   manager = terminal_manager_get_instance();
   g_object_add_weak_pointer(G_OBJECT(manager), &manager);
 
@@ -152,7 +593,10 @@ main (int argc, char **argv)
   }
 
   g_object_set_data(G_OBJECT(manager), "osso", osso_context);
-  if (!terminal_manager_new_window(manager, command, &error))
+  /* Asking for a command asks for a new terminal, not for old ones */
+  if (!command)
+    terminal_manager_reattach_sessions(manager);
+  else if (!terminal_manager_new_window(manager, command, &error))
     {
       g_printerr (_("Unable to launch terminal: %s\n"), error ? error->message : "Unknown error");
       if (error)
@@ -163,8 +607,10 @@ main (int argc, char **argv)
   osso_rpc_set_default_cb_f(osso_context,
       osso_xterm_incoming,
       manager);
+  add_hw_state_handler(osso_context, TERMINAL_MANAGER(manager));
 
 	add_screenshot_remover();
+  add_stats_dumper(TERMINAL_MANAGER(manager));
 
   gtk_main ();
 
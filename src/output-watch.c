@@ -0,0 +1,200 @@
+#include "output-watch.h"
+
+/* The automaton is a full DFA over byte classes: every byte occurring in a
+   pattern gets a class of its own, all other bytes share class 0. This keeps
+   the transition table at n_states * n_classes entries while making each
+   scanned byte cost exactly one table lookup. State 0 is the root. */
+struct _OutputWatch
+{
+  gint ref_count;
+
+  gchar **patterns;
+  guint n_patterns;
+
+  guint8 classes[256];
+  guint n_classes;
+
+  guint n_states;
+  guint *delta;
+  gint *match;       /* Pattern ending at a state, or -1 */
+  guint *match_link; /* Nearest state on the failure chain that has a match, or 0 */
+};
+
+static guint
+add_state(GArray *delta, GArray *match, guint n_classes)
+{
+  guint state = match->len;
+  gint no_match = -1;
+
+  g_array_set_size(delta, delta->len + n_classes);
+  g_array_append_val(match, no_match);
+
+  return state;
+}
+
+OutputWatch *
+output_watch_new(const gchar * const *patterns)
+{
+  OutputWatch *watch;
+  GArray *delta, *match;
+  guint *parent, *parent_class, *fail, *queue;
+  guint Nix, Nix1, n_classes = 1, head, tail;
+  const guchar *p;
+
+  if (!(patterns && patterns[0]))
+    return NULL;
+
+  watch = g_new0(OutputWatch, 1);
+  watch->ref_count = 1;
+  watch->patterns = g_strdupv((gchar **)patterns);
+  watch->n_patterns = g_strv_length(watch->patterns);
+
+  for (Nix = 0 ; Nix < watch->n_patterns ; Nix++)
+    for (p = (const guchar *)watch->patterns[Nix] ; *p ; p++)
+      if (!watch->classes[*p])
+        watch->classes[*p] = n_classes++;
+  watch->n_classes = n_classes;
+
+  /* Build the trie */
+  delta = g_array_new(FALSE, TRUE, sizeof(guint));
+  match = g_array_new(FALSE, FALSE, sizeof(gint));
+  add_state(delta, match, n_classes);
+
+  for (Nix = 0 ; Nix < watch->n_patterns ; Nix++) {
+    guint state = 0;
+
+    if (!watch->patterns[Nix][0])
+      continue;
+
+    for (p = (const guchar *)watch->patterns[Nix] ; *p ; p++) {
+      guint *next = &g_array_index(delta, guint, state * n_classes + watch->classes[*p]);
+
+      if (!(*next)) {
+        guint new_state = add_state(delta, match, n_classes);
+
+        /* add_state() may have moved the table */
+        g_array_index(delta, guint, state * n_classes + watch->classes[*p]) = new_state;
+        state = new_state;
+      }
+      else
+        state = *next;
+    }
+
+    if (g_array_index(match, gint, state) < 0)
+      g_array_index(match, gint, state) = Nix;
+  }
+
+  watch->n_states = match->len;
+  watch->delta = (guint *)g_array_free(delta, FALSE);
+  watch->match = (gint *)g_array_free(match, FALSE);
+  watch->match_link = g_new0(guint, watch->n_states);
+
+  /* Remember how each state was reached, so trie edges can be told apart from
+     the failure transitions filled in below */
+  parent = g_new0(guint, watch->n_states);
+  parent_class = g_new0(guint, watch->n_states);
+  for (Nix = 0 ; Nix < watch->n_states ; Nix++)
+    for (Nix1 = 0 ; Nix1 < n_classes ; Nix1++) {
+      guint child = watch->delta[Nix * n_classes + Nix1];
+
+      if (child) {
+        parent[child] = Nix;
+        parent_class[child] = Nix1;
+      }
+    }
+
+  /* Turn the trie into a DFA, breadth first so that failure states are always
+     complete by the time they are needed */
+  fail = g_new0(guint, watch->n_states);
+  queue = g_new(guint, watch->n_states);
+  head = tail = 0;
+  queue[tail++] = 0;
+
+  while (head < tail) {
+    guint state = queue[head++];
+
+    for (Nix = 0 ; Nix < n_classes ; Nix++) {
+      guint *next = &watch->delta[state * n_classes + Nix];
+
+      if (*next && parent[*next] == state && parent_class[*next] == Nix) {
+        guint child = *next;
+
+        fail[child] = state ? watch->delta[fail[state] * n_classes + Nix] : 0;
+        watch->match_link[child] = (watch->match[fail[child]] >= 0)
+          ? fail[child]
+          : watch->match_link[fail[child]];
+        queue[tail++] = child;
+      }
+      else
+        *next = state ? watch->delta[fail[state] * n_classes + Nix] : 0;
+    }
+  }
+
+  g_free(queue);
+  g_free(fail);
+  g_free(parent_class);
+  g_free(parent);
+
+  return watch;
+}
+
+OutputWatch *
+output_watch_ref(OutputWatch *watch)
+{
+  g_return_val_if_fail(watch != NULL, NULL);
+
+  g_atomic_int_inc(&(watch->ref_count));
+
+  return watch;
+}
+
+void
+output_watch_unref(OutputWatch *watch)
+{
+  g_return_if_fail(watch != NULL);
+
+  if (g_atomic_int_dec_and_test(&(watch->ref_count))) {
+    g_strfreev(watch->patterns);
+    g_free(watch->delta);
+    g_free(watch->match);
+    g_free(watch->match_link);
+    g_free(watch);
+  }
+}
+
+guint
+output_watch_get_n_patterns(OutputWatch *watch)
+{
+  return watch->n_patterns;
+}
+
+const gchar * const *
+output_watch_get_patterns(OutputWatch *watch)
+{
+  return (const gchar * const *)(watch->patterns);
+}
+
+/* Feeds @length bytes of @text to the automaton, starting from @state (0 for
+   fresh text), calls @func for every pattern occurrence ending in it and
+   returns the state to continue from */
+guint
+output_watch_scan(OutputWatch *watch, guint state, const gchar *text, gsize length,
+                  OutputWatchFunc func, gpointer user_data)
+{
+  const guchar *p = (const guchar *)text, *end = p + length;
+  guint matched;
+
+  if (state >= watch->n_states)
+    state = 0;
+
+  for (; p < end ; p++) {
+    state = watch->delta[state * watch->n_classes + watch->classes[*p]];
+
+    if (watch->match[state] >= 0)
+      func(watch, watch->match[state], user_data);
+    for (matched = watch->match_link[state] ; matched ; matched = watch->match_link[matched])
+      func(watch, watch->match[matched], user_data);
+  }
+
+  return state;
+}
@@ -0,0 +1,27 @@
+#ifndef _OUTPUT_WATCH_H_
+#define _OUTPUT_WATCH_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A set of literal patterns compiled into a single Aho-Corasick automaton.
+   Text is fed to it in arbitrary pieces, the caller carrying the state from
+   one piece to the next, so a match may straddle two pieces. */
+typedef struct _OutputWatch OutputWatch;
+
+typedef void (*OutputWatchFunc)(OutputWatch *watch, guint pattern, gpointer user_data);
+
+OutputWatch         *output_watch_new(const gchar * const *patterns);
+OutputWatch         *output_watch_ref(OutputWatch *watch);
+void                 output_watch_unref(OutputWatch *watch);
+
+guint                output_watch_get_n_patterns(OutputWatch *watch);
+const gchar * const *output_watch_get_patterns(OutputWatch *watch);
+
+guint                output_watch_scan(OutputWatch *watch, guint state, const gchar *text, gsize length,
+                                       OutputWatchFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* !_OUTPUT_WATCH_H_ */
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "screen-snapshot.h"
+
+/* First line of a saved snapshot, followed by the columns and rows */
+#define SNAPSHOT_MAGIC "osso-xterm-snapshot 1"
+
+/* Shown faint, so it does not pass for live output. Without the colours of
+   the rows it was taken from, it could not anyway. */
+#define PREVIEW_START "\033[0m\033[2J\033[H\033[2m"
+#define PREVIEW_END   "\033[0m"
+
+struct _ScreenSnapshot
+{
+  gint columns;
+  gint rows;
+  GPtrArray *lines;   /* Interned or copies of their own, see add_line() */
+};
+
+/* A line kept by any snapshot, with the number of times it is kept */
+typedef struct
+{
+  guint uses;
+  gchar text[1];
+} Line;
+
+/* Text -> Line. Output that repeats itself, like progress and heartbeat
+   lines, and the blank rows of a screen, then costs a pointer per
+   repetition. */
+static GHashTable *interned = NULL;
+
+/* The Line of @text if it is interned, rather than a copy of its own */
+static Line *
+lookup_interned(const gchar *text)
+{
+  Line *line = interned ? g_hash_table_lookup(interned, text) : NULL;
+
+  return (line && line->text == text) ? line : NULL;
+}
+
+static const gchar *
+intern_line(const gchar *text)
+{
+  Line *line;
+  gsize length;
+
+  if (!interned)
+    interned = g_hash_table_new(g_str_hash, g_str_equal);
+
+  if ((line = g_hash_table_lookup(interned, text)) != NULL) {
+    line->uses++;
+    return line->text;
+  }
+
+  length = strlen(text);
+  line = g_malloc(G_STRUCT_OFFSET(Line, text) + length + 1);
+  line->uses = 1;
+  memcpy(line->text, text, length + 1);
+  g_hash_table_insert(interned, line->text, line);
+
+  return line->text;
+}
+
+/* Returns how many bytes this gave back, none while the line is kept elsewhere */
+static gsize
+release_line(const gchar *text)
+{
+  Line *line = lookup_interned(text);
+  gsize length = strlen(text);
+
+  if (!line) {
+    g_free((gchar *)text);
+    return length + 1;
+  }
+
+  if (--(line->uses) > 0)
+    return 0;
+
+  g_hash_table_remove(interned, text);
+  g_free(line);
+
+  return G_STRUCT_OFFSET(Line, text) + length + 1;
+}
+
+/* Adds @text to the lines of @snapshot. A line seen only once costs less as
+   a copy of its own than interned, with an entry in the table besides, so
+   only blank lines, lines kept interned already and lines seen before in
+   @seen are. A line seen the second time has its first copy interned too. */
+static void
+add_line(ScreenSnapshot *snapshot, GHashTable *seen, const gchar *text)
+{
+  const gchar *p;
+  gpointer index;
+  gchar *copy;
+
+  for (p = text ; *p == ' ' ; p++);
+  if (!*p || (interned && g_hash_table_lookup(interned, text))) {
+    g_ptr_array_add(snapshot->lines, (gpointer)intern_line(text));
+    return;
+  }
+
+  if (!g_hash_table_lookup_extended(seen, text, NULL, &index)) {
+    copy = g_strdup(text);
+    g_hash_table_insert(seen, copy, GUINT_TO_POINTER(snapshot->lines->len));
+    g_ptr_array_add(snapshot->lines, copy);
+    return;
+  }
+
+  copy = g_ptr_array_index(snapshot->lines, GPOINTER_TO_UINT(index));
+  g_hash_table_remove(seen, copy);
+  g_ptr_array_index(snapshot->lines, GPOINTER_TO_UINT(index)) = (gpointer)intern_line(copy);
+  g_free(copy);
+  g_ptr_array_add(snapshot->lines, (gpointer)intern_line(text));
+}
+
+static ScreenSnapshot *
+snapshot_new(gint columns, gint rows, gboolean scrollback, const gchar *text)
+{
+  ScreenSnapshot *snapshot = g_new0(ScreenSnapshot, 1);
+  gchar **lines = g_strsplit(text ? text : "", "\n", -1);
+  GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+  gint n_lines = g_strv_length(lines), Nix;
+  gchar *p, *line, c;
+
+  snapshot->columns = MAX(columns, 1);
+  snapshot->rows = MAX(rows, 1);
+  snapshot->lines = g_ptr_array_new();
+
+  /* get_text() ends the last row with a newline too */
+  if (n_lines > 0 && !lines[n_lines - 1][0])
+    n_lines--;
+
+  for (Nix = scrollback ? 0 : MAX(0, n_lines - snapshot->rows) ; Nix < n_lines ; Nix++) {
+    line = lines[Nix];
+
+    /* Nothing in it may act on the terminal it is fed to */
+    for (p = line ; *p ; p++)
+      if ((guchar)(*p) < 0x20)
+        *p = ' ';
+    if (!g_utf8_validate(line, -1, NULL)) {
+      add_line(snapshot, seen, "");
+      continue;
+    }
+
+    /* Scrollback is wrapped rather than cut, so none of it is lost */
+    do {
+      p = g_utf8_offset_to_pointer(line, MIN(g_utf8_strlen(line, -1), snapshot->columns));
+      c = *p;
+      *p = '\0';
+      add_line(snapshot, seen, line);
+      *p = c;
+      line = p;
+    } while (scrollback && *line);
+  }
+
+  g_hash_table_destroy(seen);
+  g_strfreev(lines);
+
+  return snapshot;
+}
+
+/* Takes the rows of a @columns by @rows terminal from @text, one per line.
+   Only the last @rows lines are kept, each cut to @columns characters. */
+ScreenSnapshot *
+screen_snapshot_new(gint columns, gint rows, const gchar *text)
+{
+  return snapshot_new(columns, rows, FALSE, text);
+}
+
+/* Like screen_snapshot_new(), but keeps every line of @text, the scrollback
+   as well as the screen */
+ScreenSnapshot *
+screen_snapshot_new_with_scrollback(gint columns, gint rows, const gchar *text)
+{
+  return snapshot_new(columns, rows, TRUE, text);
+}
+
+void
+screen_snapshot_free(ScreenSnapshot *snapshot)
+{
+  if (!snapshot)
+    return;
+
+  screen_snapshot_trim(snapshot, 0);
+  g_ptr_array_free(snapshot->lines, TRUE);
+  g_free(snapshot);
+}
+
+gboolean
+screen_snapshot_save(ScreenSnapshot *snapshot, const gchar *file_name)
+{
+  gchar *dir_name = g_path_get_dirname(file_name);
+  GString *str = g_string_new(NULL);
+  gboolean ret;
+  guint Nix;
+
+  g_string_append_printf(str, SNAPSHOT_MAGIC " %d %d\n", snapshot->columns, snapshot->rows);
+  for (Nix = 0 ; Nix < snapshot->lines->len ; Nix++)
+    g_string_append_printf(str, "%s\n", (gchar *)g_ptr_array_index(snapshot->lines, Nix));
+
+  /* Earlier versions made the directory readable by all */
+  g_mkdir_with_parents(dir_name, 0700);
+  g_chmod(dir_name, 0700);
+  ret = g_file_set_contents(file_name, str->str, str->len, NULL);
+
+  g_string_free(str, TRUE);
+  g_free(dir_name);
+
+  return ret;
+}
+
+ScreenSnapshot *
+screen_snapshot_load(const gchar *file_name)
+{
+  ScreenSnapshot *snapshot = NULL;
+  gchar *contents = NULL, *text;
+  gint columns, rows;
+
+  if (!g_file_get_contents(file_name, &contents, NULL, NULL))
+    return NULL;
+
+  if (g_str_has_prefix(contents, SNAPSHOT_MAGIC " ") &&
+      sscanf(contents + strlen(SNAPSHOT_MAGIC), " %d %d", &columns, &rows) == 2 &&
+      (text = strchr(contents, '\n')) != NULL)
+    snapshot = screen_snapshot_new(columns, rows, text + 1);
+
+  g_free(contents);
+
+  return snapshot;
+}
+
+/* Lets go of all but the last @n_lines lines. Returns about how many bytes
+   that gave back. */
+gsize
+screen_snapshot_trim(ScreenSnapshot *snapshot, guint n_lines)
+{
+  gsize freed = 0;
+  guint n, Nix;
+
+  if (snapshot->lines->len <= n_lines)
+    return 0;
+
+  n = snapshot->lines->len - n_lines;
+  for (Nix = 0 ; Nix < n ; Nix++)
+    freed += release_line(g_ptr_array_index(snapshot->lines, Nix));
+  g_ptr_array_remove_range(snapshot->lines, 0, n);
+
+  return freed;
+}
+
+guint
+screen_snapshot_get_n_lines(ScreenSnapshot *snapshot)
+{
+  return snapshot->lines->len;
+}
+
+/* The lines from @first_line on, each ended with a newline the way Vte's
+   get_text() ends its rows, clipped to the lines there are */
+gchar *
+screen_snapshot_get_text(ScreenSnapshot *snapshot, guint first_line, guint n_lines)
+{
+  GString *str = g_string_new(NULL);
+  guint Nix;
+
+  for (Nix = first_line ; Nix < snapshot->lines->len && Nix - first_line < n_lines ; Nix++) {
+    g_string_append(str, g_ptr_array_index(snapshot->lines, Nix));
+    g_string_append_c(str, '\n');
+  }
+
+  return g_string_free(str, FALSE);
+}
+
+/* Puts the rows on @vte, in place of whatever it showed */
+void
+screen_snapshot_feed(ScreenSnapshot *snapshot, VteTerminal *vte)
+{
+  GString *str = g_string_new(PREVIEW_START);
+  guint Nix;
+
+  for (Nix = 0 ; Nix < snapshot->lines->len ; Nix++) {
+    if (Nix > 0)
+      g_string_append(str, "\r\n");
+    g_string_append(str, g_ptr_array_index(snapshot->lines, Nix));
+  }
+  g_string_append(str, PREVIEW_END);
+
+  vte_terminal_feed(vte, str->str, str->len);
+  g_string_free(str, TRUE);
+}
+
+/* Puts the lines back on a @vte emptied since, as plain text, the older ones
+   in its scrollback. The cursor goes @cursor_column across and @cursor_row
+   up from the last line. */
+void
+screen_snapshot_restore(ScreenSnapshot *snapshot, VteTerminal *vte, glong cursor_column, glong cursor_row)
+{
+  GString *str = g_string_new("\033[0m");
+  glong bottom = MIN((glong)snapshot->lines->len, vte->row_count);
+  guint Nix;
+
+  for (Nix = 0 ; Nix < snapshot->lines->len ; Nix++) {
+    if (Nix > 0)
+      g_string_append(str, "\r\n");
+    g_string_append(str, g_ptr_array_index(snapshot->lines, Nix));
+  }
+  g_string_append_printf(str, "\033[%ld;%ldH", MAX(bottom - cursor_row, 1), cursor_column + 1);
+
+  vte_terminal_feed(vte, str->str, str->len);
+  g_string_free(str, TRUE);
+}
+
+/* Where the screen of the last terminal closed is kept */
+gchar *
+screen_snapshot_last_session_file_name(void)
+{
+  return g_build_filename(g_get_home_dir(), ".cache", "osso-xterm", "last-session", NULL);
+}
@@ -0,0 +1,34 @@
+#ifndef _SCREEN_SNAPSHOT_H_
+#define _SCREEN_SNAPSHOT_H_
+
+#include <vte/vte.h>
+
+G_BEGIN_DECLS
+
+/* The text of a terminal's rows, without the terminal. It can be kept on disk
+   and fed to a terminal again, so something real is on screen while a new
+   child is still starting up, or so a terminal put to sleep can be woken
+   up with its scrollback. Only the text is kept: colours, bold, underline
+   and the like are lost, so what it brings back is a text-only preview. */
+typedef struct _ScreenSnapshot ScreenSnapshot;
+
+ScreenSnapshot *screen_snapshot_new(gint columns, gint rows, const gchar *text);
+ScreenSnapshot *screen_snapshot_new_with_scrollback(gint columns, gint rows, const gchar *text);
+void            screen_snapshot_free(ScreenSnapshot *snapshot);
+
+gboolean        screen_snapshot_save(ScreenSnapshot *snapshot, const gchar *file_name);
+ScreenSnapshot *screen_snapshot_load(const gchar *file_name);
+
+gsize           screen_snapshot_trim(ScreenSnapshot *snapshot, guint n_lines);
+guint           screen_snapshot_get_n_lines(ScreenSnapshot *snapshot);
+gchar          *screen_snapshot_get_text(ScreenSnapshot *snapshot, guint first_line, guint n_lines);
+
+void            screen_snapshot_feed(ScreenSnapshot *snapshot, VteTerminal *vte);
+void            screen_snapshot_restore(ScreenSnapshot *snapshot, VteTerminal *vte,
+                                        glong cursor_column, glong cursor_row);
+
+gchar          *screen_snapshot_last_session_file_name(void);
+
+G_END_DECLS
+
+#endif /* !_SCREEN_SNAPSHOT_H_ */
@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "session-protocol.h"
+
+/* Where osso-xterm-sessiond listens */
+gchar *
+session_socket_path(void)
+{
+  return g_build_filename(g_get_home_dir(), ".cache", "osso-xterm", "sessiond", NULL);
+}
+
+/* Adds a frame of @type with @length bytes of @data to @buf */
+void
+session_frame_append(GByteArray *buf, gchar type, const void *data, gsize length)
+{
+  guint8 header[SESSION_FRAME_HEADER_SIZE];
+
+  header[0] = type;
+  header[1] = (length >> 24) & 0xff;
+  header[2] = (length >> 16) & 0xff;
+  header[3] = (length >> 8) & 0xff;
+  header[4] = length & 0xff;
+
+  g_byte_array_append(buf, header, sizeof(header));
+  if (length > 0)
+    g_byte_array_append(buf, data, length);
+}
+
+/* Whether a whole frame is at the start of @buf. Its payload follows the
+   header, and is @length bytes long. */
+gboolean
+session_frame_parse(GByteArray *buf, gchar *type, guint32 *length)
+{
+  if (buf->len < SESSION_FRAME_HEADER_SIZE)
+    return FALSE;
+
+  *type = buf->data[0];
+  *length = (buf->data[1] << 24) | (buf->data[2] << 16) | (buf->data[3] << 8) | buf->data[4];
+
+  return buf->len >= SESSION_FRAME_HEADER_SIZE + *length;
+}
+
+static gboolean
+write_all(int fd, const guint8 *data, gsize length)
+{
+  ssize_t n;
+
+  while (length > 0) {
+    n = write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    data += n;
+    length -= n;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+read_all(int fd, guint8 *data, gsize length)
+{
+  ssize_t n;
+
+  while (length > 0) {
+    n = read(fd, data, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    data += n;
+    length -= n;
+  }
+
+  return TRUE;
+}
+
+/* Sends a frame on the blocking socket @fd */
+gboolean
+session_write_frame(int fd, gchar type, const void *data, gsize length)
+{
+  GByteArray *buf = g_byte_array_sized_new(SESSION_FRAME_HEADER_SIZE + length);
+  gboolean ret;
+
+  session_frame_append(buf, type, data, length);
+  ret = write_all(fd, buf->data, buf->len);
+  g_byte_array_free(buf, TRUE);
+
+  return ret;
+}
+
+/* Waits for a frame on the blocking socket @fd and puts its payload in
+   @payload. Reads nothing beyond it. */
+gboolean
+session_read_frame(int fd, gchar *type, GByteArray *payload)
+{
+  guint8 header[SESSION_FRAME_HEADER_SIZE];
+  guint32 length;
+
+  if (!read_all(fd, header, sizeof(header)))
+    return FALSE;
+
+  *type = header[0];
+  length = (header[1] << 24) | (header[2] << 16) | (header[3] << 8) | header[4];
+  if (length > SESSION_FRAME_MAX_SIZE)
+    return FALSE;
+
+  g_byte_array_set_size(payload, length);
+
+  return read_all(fd, payload->data, length);
+}
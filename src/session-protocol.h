@@ -0,0 +1,44 @@
+#ifndef _SESSION_PROTOCOL_H_
+#define _SESSION_PROTOCOL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* What osso-xterm and osso-xterm-sessiond, which holds the ptys of its
+   terminals so they outlive it, say to each other over a Unix socket. Every
+   message is a frame: a type byte, the length of the payload as a 32-bit big
+   endian number, then the payload. A connection starts with one of NEW,
+   ATTACH or LIST from osso-xterm. */
+
+/* From osso-xterm */
+#define SESSION_FRAME_NEW     'N' /* columns, rows, directory, command, argc, argv, envc, envv; each ending in '\0' */
+#define SESSION_FRAME_ATTACH  'A' /* "id" */
+#define SESSION_FRAME_LIST    'L' /* Nothing */
+#define SESSION_FRAME_INPUT   'I' /* Bytes for the child */
+#define SESSION_FRAME_RESIZE  'R' /* "columns rows" */
+#define SESSION_FRAME_KILL    'K' /* Nothing. Hangs up on the child rather than leaving it. */
+
+/* From osso-xterm-sessiond */
+#define SESSION_FRAME_SESSION 'S' /* "id pid", for NEW and ATTACH, and once per detached session for LIST */
+#define SESSION_FRAME_END     'E' /* Nothing. No more sessions to LIST. */
+#define SESSION_FRAME_ERROR   'F' /* Why NEW or ATTACH failed */
+#define SESSION_FRAME_OUTPUT  'O' /* Bytes from the child */
+#define SESSION_FRAME_EXIT    'X' /* "status" */
+
+#define SESSION_FRAME_HEADER_SIZE 5
+
+/* Frames bigger than this are taken for garbage */
+#define SESSION_FRAME_MAX_SIZE (1024 * 1024)
+
+gchar    *session_socket_path(void);
+
+void      session_frame_append(GByteArray *buf, gchar type, const void *data, gsize length);
+gboolean  session_frame_parse(GByteArray *buf, gchar *type, guint32 *length);
+
+gboolean  session_write_frame(int fd, gchar type, const void *data, gsize length);
+gboolean  session_read_frame(int fd, gchar *type, GByteArray *payload);
+
+G_END_DECLS
+
+#endif /* !_SESSION_PROTOCOL_H_ */
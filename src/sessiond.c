@@ -0,0 +1,748 @@
+/* osso-xterm-sessiond holds the ptys of osso-xterm's terminals, so their
+   children outlive osso-xterm if it crashes or is killed for memory. Each
+   session keeps the last of its output in a ring, which is all a new
+   osso-xterm gets to see when it attaches again. */
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "session-protocol.h"
+
+/* Output kept per session, in bytes */
+#define DEFAULT_RING_SIZE (64 * 1024)
+
+/* Output queued for a client, beyond which the child is left to block, and
+   input queued for a child, beyond which the client is */
+#define MAX_QUEUED (256 * 1024)
+
+/* How long to stay around with nothing to hold, in seconds */
+#define IDLE_EXIT_TIMEOUT 60
+
+#define READ_SIZE 4096
+
+typedef struct _Client Client;
+
+typedef struct
+{
+  guint id;
+  GPid pid;
+  int fd;
+  guint pty_watch;
+  guint child_watch;
+
+  /* Input the child has not taken yet */
+  GByteArray *input;
+  guint input_watch;
+
+  guint8 *ring;
+  gsize ring_start;
+  gsize ring_len;
+  gboolean ring_wrapped;   /* The start of the output is lost */
+
+  Client *client;
+  gboolean killed;
+  gint status;
+} Session;
+
+struct _Client
+{
+  int fd;
+  GIOChannel *channel;
+  guint in_watch;
+  guint out_watch;
+  GByteArray *in;
+  GByteArray *out;
+  Session *session;
+};
+
+static GMainLoop *loop = NULL;
+static GHashTable *sessions = NULL;  /* id -> Session */
+static GSList *clients = NULL;
+static gint ring_size = DEFAULT_RING_SIZE;
+static guint last_id = 0;
+static guint idle_exit_id = 0;
+
+static void client_close(Client *client);
+static void session_update_reading(Session *session);
+static void client_update_reading(Client *client);
+static gboolean client_readable(GIOChannel *channel, GIOCondition condition, Client *client);
+
+static gboolean
+idle_exit(gpointer null)
+{
+  idle_exit_id = 0;
+  g_main_loop_quit(loop);
+
+  return FALSE;
+}
+
+static void
+update_idle_exit(void)
+{
+  gboolean idle = (g_hash_table_size(sessions) == 0 && clients == NULL);
+
+  if (idle && !idle_exit_id)
+    idle_exit_id = g_timeout_add_seconds(IDLE_EXIT_TIMEOUT, idle_exit, NULL);
+  else if (!idle && idle_exit_id) {
+    g_source_remove(idle_exit_id);
+    idle_exit_id = 0;
+  }
+}
+
+/* Keeps the last ring_size bytes of the child's output */
+static void
+ring_append(Session *session, const guint8 *data, gsize length)
+{
+  gsize pos, chunk;
+
+  if (!session->ring)
+    session->ring = g_malloc(ring_size);
+
+  while (length > 0) {
+    pos = (session->ring_start + session->ring_len) % ring_size;
+    chunk = MIN(length, ring_size - pos);
+    memcpy(session->ring + pos, data, chunk);
+    data += chunk;
+    length -= chunk;
+
+    session->ring_len += chunk;
+    if (session->ring_len > (gsize)ring_size) {
+      session->ring_start = (session->ring_start + session->ring_len - ring_size) % ring_size;
+      session->ring_len = ring_size;
+      session->ring_wrapped = TRUE;
+    }
+  }
+}
+
+static void
+client_flush(Client *client);
+
+static gboolean
+client_writable(GIOChannel *channel, GIOCondition condition, Client *client)
+{
+  client->out_watch = 0;
+  client_flush(client);
+
+  return FALSE;
+}
+
+/* Writes what the socket takes now and waits to write the rest */
+static void
+client_flush(Client *client)
+{
+  ssize_t n;
+
+  while (client->out->len > 0) {
+    n = write(client->fd, client->out->data, client->out->len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != EAGAIN) {
+      /* Gone; what it did not read is in the ring still */
+      g_byte_array_set_size(client->out, 0);
+      break;
+    }
+    if (n <= 0)
+      break;
+    g_byte_array_remove_range(client->out, 0, n);
+  }
+
+  if (client->out->len > 0 && !client->out_watch)
+    client->out_watch = g_io_add_watch(client->channel, G_IO_OUT, (GIOFunc)client_writable, client);
+
+  if (client->session)
+    session_update_reading(client->session);
+}
+
+static void
+client_send(Client *client, gchar type, const void *data, gsize length)
+{
+  session_frame_append(client->out, type, data, length);
+  client_flush(client);
+}
+
+static void
+client_send_session(Client *client, Session *session)
+{
+  gchar *str = g_strdup_printf("%u %d", session->id, session->pid);
+
+  client_send(client, SESSION_FRAME_SESSION, str, strlen(str));
+  g_free(str);
+}
+
+static void
+session_free(Session *session)
+{
+  if (session->pty_watch)
+    g_source_remove(session->pty_watch);
+  if (session->child_watch)
+    g_source_remove(session->child_watch);
+  if (session->input_watch)
+    g_source_remove(session->input_watch);
+  if (session->fd >= 0)
+    close(session->fd);
+  if (session->client) {
+    session->client->session = NULL;
+    client_update_reading(session->client);
+  }
+
+  g_hash_table_remove(sessions, GUINT_TO_POINTER(session->id));
+  g_byte_array_free(session->input, TRUE);
+  g_free(session->ring);
+  g_free(session);
+
+  update_idle_exit();
+}
+
+static gboolean
+pty_readable(GIOChannel *channel, GIOCondition condition, Session *session)
+{
+  guint8 buf[READ_SIZE];
+  ssize_t n;
+
+  n = read(session->fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return TRUE;
+
+  if (n <= 0) {
+    /* EOF, or EIO once the child has gone. The child watch reports that. */
+    session->pty_watch = 0;
+    return FALSE;
+  }
+
+  ring_append(session, buf, n);
+  if (session->client)
+    client_send(session->client, SESSION_FRAME_OUTPUT, buf, n);
+
+  return TRUE;
+}
+
+/* The pty is read while there is room for its output. Without a client,
+   output only goes to the ring, so there always is. */
+static void
+session_update_reading(Session *session)
+{
+  gboolean want = (session->fd >= 0 && session->child_watch &&
+                   !(session->client && session->client->out->len >= MAX_QUEUED));
+
+  if (want && !session->pty_watch) {
+    GIOChannel *channel = g_io_channel_unix_new(session->fd);
+
+    session->pty_watch = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                        (GIOFunc)pty_readable, session);
+    g_io_channel_unref(channel);
+  }
+  else if (!want && session->pty_watch) {
+    g_source_remove(session->pty_watch);
+    session->pty_watch = 0;
+  }
+}
+
+/* Tells the client how the child ended, and forgets about it */
+static void
+session_report_exit(Session *session)
+{
+  gchar *str = g_strdup_printf("%d", session->status);
+
+  client_send(session->client, SESSION_FRAME_EXIT, str, strlen(str));
+  g_free(str);
+  session_free(session);
+}
+
+static void
+child_exited(GPid pid, gint status, Session *session)
+{
+  session->child_watch = 0;
+  session->status = status;
+  g_spawn_close_pid(pid);
+
+  if (session->pty_watch) {
+    g_source_remove(session->pty_watch);
+    session->pty_watch = 0;
+  }
+
+  /* Nobody is going to read what it was sent */
+  if (session->input_watch) {
+    g_source_remove(session->input_watch);
+    session->input_watch = 0;
+  }
+  g_byte_array_set_size(session->input, 0);
+
+  /* Whatever the child left behind. Anything it started may still hold the
+     pty, so this stops at whatever is there now. */
+  {
+    guint8 buf[READ_SIZE];
+    ssize_t n;
+
+    while ((n = read(session->fd, buf, sizeof(buf))) > 0) {
+      ring_append(session, buf, n);
+      if (session->client)
+        client_send(session->client, SESSION_FRAME_OUTPUT, buf, n);
+    }
+  }
+
+  if (session->client)
+    session_report_exit(session);
+  else if (session->killed)
+    session_free(session);
+  /* else it is kept until someone comes to see how it ended */
+}
+
+/* Splits the payload of NEW into its fields */
+static Session *
+session_spawn(const guint8 *payload, gsize length, GError **error)
+{
+  gchar **fields, **argv, **envv, **p;
+  gchar *copy = g_malloc(length + 1), *data = copy;
+  struct winsize ws;
+  Session *session;
+  gint n_fields = 0, argc, envc, Nix;
+  pid_t pid;
+  int fd;
+
+  memcpy(copy, payload, length);
+  copy[length] = '\0';
+
+  for (Nix = 0 ; Nix < (gint)length ; Nix++)
+    if (!payload[Nix])
+      n_fields++;
+  fields = g_new0(gchar *, n_fields + 1);
+  for (Nix = 0, p = fields ; Nix < n_fields ; Nix++, p++) {
+    *p = data;
+    data += strlen(data) + 1;
+  }
+
+  argc = (n_fields > 4) ? atoi(fields[4]) : -1;
+  envc = (argc >= 0 && n_fields > 5 + argc) ? atoi(fields[5 + argc]) : -1;
+  if (argc < 1 || envc < 0 || n_fields != 6 + argc + envc) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_INVAL, "Malformed request");
+    g_free(copy);
+    g_free(fields);
+    return NULL;
+  }
+
+  argv = g_new0(gchar *, argc + 1);
+  memcpy(argv, fields + 5, argc * sizeof(gchar *));
+  envv = g_new0(gchar *, envc + 1);
+  memcpy(envv, fields + 6 + argc, envc * sizeof(gchar *));
+
+  memset(&ws, 0, sizeof(ws));
+  ws.ws_col = atoi(fields[0]);
+  ws.ws_row = atoi(fields[1]);
+
+  pid = forkpty(&fd, NULL, NULL, &ws);
+  if (pid == 0) {
+    extern gchar **environ;
+
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    if (fields[2][0] && chdir(fields[2]) < 0)
+      chdir("/");
+    environ = envv;
+    execvp(fields[3], argv);
+    _exit(127);
+  }
+
+  session = NULL;
+  if (pid < 0)
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FORK, "%s", g_strerror(errno));
+  else {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    session = g_new0(Session, 1);
+    session->id = ++last_id;
+    session->pid = pid;
+    session->fd = fd;
+    session->input = g_byte_array_new();
+    session->child_watch = g_child_watch_add(pid, (GChildWatchFunc)child_exited, session);
+    g_hash_table_insert(sessions, GUINT_TO_POINTER(session->id), session);
+    session_update_reading(session);
+  }
+
+  g_free(envv);
+  g_free(argv);
+  g_free(copy);
+  g_free(fields);
+
+  return session;
+}
+
+static void
+session_flush_input(Session *session);
+
+static gboolean
+pty_writable(GIOChannel *channel, GIOCondition condition, Session *session)
+{
+  session->input_watch = 0;
+  session_flush_input(session);
+
+  return FALSE;
+}
+
+/* Writes what the child takes now and waits to write the rest. The client
+   is not read from while the child is this far behind. */
+static void
+session_flush_input(Session *session)
+{
+  ssize_t n;
+
+  while (session->input->len > 0) {
+    n = write(session->fd, session->input->data, session->input->len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != EAGAIN) {
+      /* The child is gone, which the child watch reports */
+      g_byte_array_set_size(session->input, 0);
+      break;
+    }
+    if (n <= 0)
+      break;
+    g_byte_array_remove_range(session->input, 0, n);
+  }
+
+  if (session->input->len > 0 && !session->input_watch) {
+    GIOChannel *channel = g_io_channel_unix_new(session->fd);
+
+    session->input_watch = g_io_add_watch(channel, G_IO_OUT | G_IO_HUP | G_IO_ERR,
+                                          (GIOFunc)pty_writable, session);
+    g_io_channel_unref(channel);
+  }
+
+  if (session->client)
+    client_update_reading(session->client);
+}
+
+static void
+session_write(Session *session, const guint8 *data, gsize length)
+{
+  g_byte_array_append(session->input, data, length);
+  session_flush_input(session);
+}
+
+/* How much of the ring to leave out of a replay. Once the ring has wrapped,
+   it may start halfway through an escape sequence or a UTF-8 character, so
+   the replay starts past the first newline, or at the first escape, which
+   are where the child was back to plain text. */
+static gsize
+ring_replay_skip(Session *session)
+{
+  gsize Nix;
+  guint8 c;
+
+  if (!session->ring_wrapped)
+    return 0;
+
+  for (Nix = 0 ; Nix < session->ring_len ; Nix++) {
+    c = session->ring[(session->ring_start + Nix) % ring_size];
+    if (c == '\n')
+      return Nix + 1;
+    if (c == 0x1b)
+      return Nix;
+  }
+
+  return session->ring_len;
+}
+
+/* Gives @session to @client, showing it what the ring holds */
+static void
+session_attach(Session *session, Client *client)
+{
+  gsize skip, start, len, first;
+
+  if (session->client && session->client != client) {
+    session->client->session = NULL;
+    client_close(session->client);
+  }
+  session->client = client;
+  client->session = session;
+
+  client_send_session(client, session);
+  skip = ring_replay_skip(session);
+  start = (session->ring_start + skip) % ring_size;
+  len = session->ring_len - skip;
+  if (len > 0) {
+    first = MIN(len, ring_size - start);
+    client_send(client, SESSION_FRAME_OUTPUT, session->ring + start, first);
+    if (first < len)
+      client_send(client, SESSION_FRAME_OUTPUT, session->ring, len - first);
+  }
+
+  /* It ended while nobody was looking */
+  if (!session->child_watch)
+    session_report_exit(session);
+  else {
+    session_update_reading(session);
+    client_update_reading(client);
+  }
+}
+
+static void
+list_detached(gpointer id, Session *session, Client *client)
+{
+  if (!session->client && !session->killed)
+    client_send_session(client, session);
+}
+
+static void
+client_handle_frame(Client *client, gchar type, const guint8 *payload, guint32 length)
+{
+  GError *error = NULL;
+  Session *session;
+  gchar *str;
+  gint columns, rows;
+
+  switch (type) {
+    case SESSION_FRAME_NEW:
+      if (client->session)
+        break;
+      session = session_spawn(payload, length, &error);
+      if (session)
+        session_attach(session, client);
+      else {
+        client_send(client, SESSION_FRAME_ERROR, error->message, strlen(error->message));
+        g_error_free(error);
+      }
+      break;
+
+    case SESSION_FRAME_ATTACH:
+      if (client->session)
+        break;
+      str = g_strndup((const gchar *)payload, length);
+      session = g_hash_table_lookup(sessions, GUINT_TO_POINTER(strtoul(str, NULL, 10)));
+      g_free(str);
+      if (session && !session->killed)
+        session_attach(session, client);
+      else
+        client_send(client, SESSION_FRAME_ERROR, "No such session", strlen("No such session"));
+      break;
+
+    case SESSION_FRAME_LIST:
+      g_hash_table_foreach(sessions, (GHFunc)list_detached, client);
+      client_send(client, SESSION_FRAME_END, NULL, 0);
+      break;
+
+    case SESSION_FRAME_INPUT:
+      if (client->session && client->session->child_watch)
+        session_write(client->session, payload, length);
+      break;
+
+    case SESSION_FRAME_RESIZE:
+      str = g_strndup((const gchar *)payload, length);
+      if (client->session && client->session->fd >= 0 &&
+          sscanf(str, "%d %d", &columns, &rows) == 2) {
+        struct winsize ws;
+
+        memset(&ws, 0, sizeof(ws));
+        ws.ws_col = columns;
+        ws.ws_row = rows;
+        ioctl(client->session->fd, TIOCSWINSZ, &ws);
+      }
+      g_free(str);
+      break;
+
+    case SESSION_FRAME_KILL:
+      session = client->session;
+      if (session) {
+        session->killed = TRUE;
+        session->client = NULL;
+        client->session = NULL;
+        if (session->child_watch)
+          kill(session->pid, SIGHUP);
+        else
+          session_free(session);
+      }
+      break;
+  }
+}
+
+static gboolean
+client_readable(GIOChannel *channel, GIOCondition condition, Client *client)
+{
+  guint8 buf[READ_SIZE];
+  guint32 length = 0;
+  gchar type;
+  ssize_t n;
+
+  n = read(client->fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return TRUE;
+  if (n <= 0) {
+    client_close(client);
+    return FALSE;
+  }
+
+  g_byte_array_append(client->in, buf, n);
+  while (session_frame_parse(client->in, &type, &length)) {
+    client_handle_frame(client, type, client->in->data + SESSION_FRAME_HEADER_SIZE, length);
+    g_byte_array_remove_range(client->in, 0, SESSION_FRAME_HEADER_SIZE + length);
+  }
+
+  if (client->in->len >= SESSION_FRAME_HEADER_SIZE && length > SESSION_FRAME_MAX_SIZE) {
+    client_close(client);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* The client is read while its session has room for its input. Frames
+   already read are handled regardless, so this only holds back more. */
+static void
+client_update_reading(Client *client)
+{
+  gboolean want = !(client->session && client->session->input->len >= MAX_QUEUED);
+
+  if (want && !client->in_watch)
+    client->in_watch = g_io_add_watch(client->channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                      (GIOFunc)client_readable, client);
+  else if (!want && client->in_watch) {
+    g_source_remove(client->in_watch);
+    client->in_watch = 0;
+  }
+}
+
+/* The session, if any, carries on without @client */
+static void
+client_close(Client *client)
+{
+  if (client->in_watch)
+    g_source_remove(client->in_watch);
+  if (client->out_watch)
+    g_source_remove(client->out_watch);
+  if (client->session) {
+    client->session->client = NULL;
+    session_update_reading(client->session);
+  }
+
+  g_io_channel_unref(client->channel);
+  close(client->fd);
+  g_byte_array_free(client->in, TRUE);
+  g_byte_array_free(client->out, TRUE);
+  clients = g_slist_remove(clients, client);
+  g_free(client);
+
+  update_idle_exit();
+}
+
+static gboolean
+accept_client(GIOChannel *channel, GIOCondition condition, gpointer null)
+{
+  Client *client;
+  int fd;
+
+  fd = accept(g_io_channel_unix_get_fd(channel), NULL, NULL);
+  if (fd < 0)
+    return TRUE;
+
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+
+  client = g_new0(Client, 1);
+  client->fd = fd;
+  client->channel = g_io_channel_unix_new(fd);
+  client->in = g_byte_array_new();
+  client->out = g_byte_array_new();
+  client_update_reading(client);
+  clients = g_slist_prepend(clients, client);
+  update_idle_exit();
+
+  return TRUE;
+}
+
+static int
+listen_socket(const gchar *path)
+{
+  struct sockaddr_un addr;
+  gchar *dir_name = g_path_get_dirname(path);
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+  g_mkdir_with_parents(dir_name, 0700);
+  g_free(dir_name);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  /* Someone is holding sessions already */
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  g_unlink(path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  return fd;
+}
+
+int
+main(int argc, char **argv)
+{
+  GOptionEntry entries[] = {
+    { "ring-size", 'r', 0, G_OPTION_ARG_INT, &ring_size, "Bytes of output kept per session", "BYTES" },
+    { NULL }
+  };
+  GOptionContext *context;
+  GIOChannel *channel;
+  gchar *path;
+  int fd;
+
+  context = g_option_context_new("- hold the ptys of osso-xterm");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, NULL))
+    return EXIT_FAILURE;
+  g_option_context_free(context);
+  ring_size = MAX(ring_size, READ_SIZE);
+
+  /* osso-xterm going away must not take us along */
+  setsid();
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+  umask(077);
+
+  path = session_socket_path();
+  fd = listen_socket(path);
+  if (fd < 0) {
+    g_free(path);
+    return EXIT_FAILURE;
+  }
+
+  sessions = g_hash_table_new(g_direct_hash, g_direct_equal);
+  loop = g_main_loop_new(NULL, FALSE);
+
+  channel = g_io_channel_unix_new(fd);
+  g_io_add_watch(channel, G_IO_IN, accept_client, NULL);
+  g_io_channel_unref(channel);
+  update_idle_exit();
+
+  g_main_loop_run(loop);
+
+  g_unlink(path);
+  close(fd);
+  g_free(path);
+
+  return EXIT_SUCCESS;
+}
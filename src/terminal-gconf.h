@@ -34,7 +34,8 @@
 #define OSSO_XTERM_GCONF_FONT_BASE_SIZE   OSSO_XTERM_GCONF_PATH "/font_size"
 #define OSSO_XTERM_DEFAULT_FONT_BASE_SIZE 16
 
-/* Integer */
+/* Integer, the zoom new terminals start at. Zooming a terminal no longer
+   writes it, so it only changes when set by hand. */
 #define OSSO_XTERM_GCONF_FONT_SIZE   OSSO_XTERM_GCONF_PATH "/font_size_delta"
 #define OSSO_XTERM_DEFAULT_FONT_SIZE 0
 
@@ -80,4 +81,40 @@
 #define OSSO_XTERM_GCONF_ALWAYS_SCROLL   OSSO_XTERM_GCONF_PATH "/alwaysscroll"
 #define OSSO_XTERM_DEFAULT_ALWAYS_SCROLL TRUE
 
+/* Boolean. Only the reading moves off the main thread: Vte 0.12 still
+   decodes and parses the output there. The children also get no utmp,
+   wtmp or lastlog entries, which Vte makes for its own, so it is opt-in. */
+#define OSSO_XTERM_GCONF_THREADED_PTY   OSSO_XTERM_GCONF_PATH "/threaded_pty"
+#define OSSO_XTERM_DEFAULT_THREADED_PTY FALSE
+
+/* Boolean, only used along with OSSO_XTERM_GCONF_THREADED_PTY */
+#define OSSO_XTERM_GCONF_SESSION_HOLDER   OSSO_XTERM_GCONF_PATH "/session_holder"
+#define OSSO_XTERM_DEFAULT_SESSION_HOLDER TRUE
+
+/* Boolean */
+#define OSSO_XTERM_GCONF_LINE_TIMES   OSSO_XTERM_GCONF_PATH "/line_times"
+#define OSSO_XTERM_DEFAULT_LINE_TIMES FALSE
+
+/* Boolean. The screen may hold anything that was typed or shown, so it is
+   only kept in ~/.cache/osso-xterm/last-session when asked for. */
+#define OSSO_XTERM_GCONF_SAVE_LAST_SESSION   OSSO_XTERM_GCONF_PATH "/save_last_session"
+#define OSSO_XTERM_DEFAULT_SAVE_LAST_SESSION FALSE
+
+/* List of strings */
+#define OSSO_XTERM_GCONF_WATCH_PATTERNS OSSO_XTERM_GCONF_PATH "/watch_patterns"
+
+/* Bytes per second, 0 for no limit */
+#define OSSO_XTERM_GCONF_BACKGROUND_READ_BUDGET   OSSO_XTERM_GCONF_PATH "/background_read_budget"
+#define OSSO_XTERM_DEFAULT_BACKGROUND_READ_BUDGET 32768
+
+/* Seconds out of use before a hidden terminal hibernates, 0 for never. A
+   terminal woken up gets its text back without the colours, so by default
+   none hibernate until that is kept as well. */
+#define OSSO_XTERM_GCONF_HIBERNATE_AFTER   OSSO_XTERM_GCONF_PATH "/hibernate_after"
+#define OSSO_XTERM_DEFAULT_HIBERNATE_AFTER 0
+
+/* Terminals kept awake at most, 0 for no limit */
+#define OSSO_XTERM_GCONF_MAX_LIVE_TERMINALS   OSSO_XTERM_GCONF_PATH "/max_live_terminals"
+#define OSSO_XTERM_DEFAULT_MAX_LIVE_TERMINALS 0
+
 #endif /* _TERMINAL_GCONF_H_ */
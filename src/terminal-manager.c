@@ -1,11 +1,20 @@
 /* -*- Mode: C; indent-tabs-mode: s; c-basic-offset: 2; tab-width: 2 -*- */
 /* vim:set et ai sw=2 ts=2 sts=2: tw=80 cino="(0,W2s,i2s,t0,l1,:0" */
+#include <stdlib.h>
 #include <libintl.h>
 #include <locale.h>
 #define _(String) gettext(String)
 
 #include "terminal-manager.h"
 #include "terminal-window.h"
+#include "terminal-gconf.h"
+#include "terminal-pty.h"
+#include "font-cache.h"
+#include "font-dialog.h"
+#include "font-fallback.h"
+
+/* How often terminals are looked at for hibernating, in seconds */
+#define HIBERNATE_CHECK_INTERVAL 30
 
 enum signals {
   S_NEW_WINDOW = 0,
@@ -25,6 +34,23 @@ static void terminal_manager_last_window_closed (TerminalManager *manager);
 static gboolean terminal_manager_focus_in_actions (TerminalWindow *window,
 						   GdkEventFocus *event,
 						   TerminalManager *manager);
+static void terminal_manager_gconf_watch (GConfClient *client,
+					  guint conn_id,
+					  GConfEntry *entry,
+					  TerminalManager *manager);
+static void terminal_manager_gconf_read_budget (GConfClient *client,
+						guint conn_id,
+						GConfEntry *entry,
+						TerminalManager *manager);
+static void terminal_manager_update_read_budgets (TerminalManager *manager);
+static void terminal_manager_gconf_hibernation (GConfClient *client,
+						guint conn_id,
+						GConfEntry *entry,
+						TerminalManager *manager);
+static gboolean terminal_manager_hibernate_idle (TerminalManager *manager);
+static void terminal_manager_window_active_changed (TerminalWindow *window,
+						    TerminalManager *manager);
+static void terminal_manager_finalize (GObject *object);
 
 G_DEFINE_TYPE (TerminalManager, terminal_manager, HILDON_TYPE_PROGRAM);
 
@@ -40,6 +66,8 @@ TerminalManager *terminal_manager_get_instance (void)
 
 static void terminal_manager_class_init (TerminalManagerClass *klass)
 {
+  G_OBJECT_CLASS(klass)->finalize = terminal_manager_finalize;
+
   klass->last_window_closed = terminal_manager_last_window_closed;
 
   sigs[S_NEW_WINDOW] = g_signal_new("new_window",
@@ -78,38 +106,287 @@ static void terminal_manager_init (TerminalManager *manager)
 {
   manager->windows = NULL;
   manager->current = NULL;
+  manager->watch = NULL;
+
+  manager->gconf_client = gconf_client_get_default();
+  gconf_client_add_dir(manager->gconf_client,
+		       OSSO_XTERM_GCONF_PATH,
+		       GCONF_CLIENT_PRELOAD_NONE,
+		       NULL);
+  manager->watch_conid = gconf_client_notify_add(manager->gconf_client,
+						 OSSO_XTERM_GCONF_WATCH_PATTERNS,
+						 (GConfClientNotifyFunc)terminal_manager_gconf_watch,
+						 manager,
+						 NULL, NULL);
+  terminal_manager_gconf_watch(manager->gconf_client, 0, NULL, manager);
+
+  manager->read_budget_conid = gconf_client_notify_add(manager->gconf_client,
+						       OSSO_XTERM_GCONF_BACKGROUND_READ_BUDGET,
+						       (GConfClientNotifyFunc)terminal_manager_gconf_read_budget,
+						       manager,
+						       NULL, NULL);
+  terminal_manager_gconf_read_budget(manager->gconf_client, 0, NULL, manager);
+
+  manager->hibernate_after_conid = gconf_client_notify_add(manager->gconf_client,
+							   OSSO_XTERM_GCONF_HIBERNATE_AFTER,
+							   (GConfClientNotifyFunc)terminal_manager_gconf_hibernation,
+							   manager,
+							   NULL, NULL);
+  manager->max_live_conid = gconf_client_notify_add(manager->gconf_client,
+						    OSSO_XTERM_GCONF_MAX_LIVE_TERMINALS,
+						    (GConfClientNotifyFunc)terminal_manager_gconf_hibernation,
+						    manager,
+						    NULL, NULL);
+  terminal_manager_gconf_hibernation(manager->gconf_client, 0, NULL, manager);
+  manager->hibernate_id = g_timeout_add_seconds(HIBERNATE_CHECK_INTERVAL,
+						(GSourceFunc)terminal_manager_hibernate_idle,
+						manager);
 }
 
-gboolean terminal_manager_new_window (TerminalManager *manager,
-				      const gchar *command,
-				      GError **error)
+static void terminal_manager_finalize (GObject *object)
 {
-  TerminalWindow *window = TERMINAL_WINDOW(terminal_window_new());
+  TerminalManager *manager = TERMINAL_MANAGER(object);
 
-  if (terminal_window_launch(window, command, error)) {
+  gconf_client_notify_remove(manager->gconf_client, manager->watch_conid);
+  gconf_client_notify_remove(manager->gconf_client, manager->read_budget_conid);
+  gconf_client_notify_remove(manager->gconf_client, manager->hibernate_after_conid);
+  gconf_client_notify_remove(manager->gconf_client, manager->max_live_conid);
+  if (manager->hibernate_id)
+    g_source_remove(manager->hibernate_id);
+  gconf_client_remove_dir(manager->gconf_client, OSSO_XTERM_GCONF_PATH, NULL);
+  g_object_unref(manager->gconf_client);
+
+  if (manager->watch)
+    output_watch_unref(manager->watch);
+
+  G_OBJECT_CLASS(terminal_manager_parent_class)->finalize(object);
+}
+
+static void terminal_manager_set_window_watch (TerminalWindow *window,
+					       TerminalManager *manager)
+{
+  GList *terminals, *iter;
+
+  terminals = terminal_window_get_terminals(window);
+  for (iter = terminals ; iter ; iter = iter->next)
+    terminal_widget_set_shared_watch(TERMINAL_WIDGET(iter->data), manager->watch);
+  g_list_free(terminals);
+}
+
+/* The watch patterns are compiled once here and the result shared by all
+   terminals */
+static void terminal_manager_gconf_watch (GConfClient *client,
+					  guint conn_id,
+					  GConfEntry *entry,
+					  TerminalManager *manager)
+{
+  GSList *patterns, *iter;
+  GPtrArray *array = g_ptr_array_new();
+
+  patterns = gconf_client_get_list(client,
+				   OSSO_XTERM_GCONF_WATCH_PATTERNS,
+				   GCONF_VALUE_STRING,
+				   NULL);
+  for (iter = patterns ; iter ; iter = iter->next)
+    if (iter->data && *((gchar *)(iter->data)))
+      g_ptr_array_add(array, iter->data);
+  g_ptr_array_add(array, NULL);
+
+  if (manager->watch)
+    output_watch_unref(manager->watch);
+  manager->watch = output_watch_new((const gchar * const *)array->pdata);
+
+  g_ptr_array_free(array, TRUE);
+  g_slist_foreach(patterns, (GFunc)g_free, NULL);
+  g_slist_free(patterns);
+
+  g_slist_foreach(manager->windows, (GFunc)terminal_manager_set_window_watch, manager);
+}
+
+/* Only the tab shown in the current window reads its output as fast as it
+   comes. The others get the configured budget, so a runaway child in the
+   background cannot slow down the terminal in use. */
+static void terminal_manager_update_read_budgets (TerminalManager *manager)
+{
+  GSList *iter;
+  GList *terminals, *titer;
+  TerminalWidget *active;
+
+  for (iter = manager->windows ; iter ; iter = iter->next) {
+    terminals = terminal_window_get_terminals(TERMINAL_WINDOW(iter->data));
+    active = terminal_window_get_active(TERMINAL_WINDOW(iter->data));
+    for (titer = terminals ; titer ; titer = titer->next)
+      terminal_widget_set_read_budget(TERMINAL_WIDGET(titer->data),
+				      (iter->data == manager->current && titer->data == active)
+				      ? 0 : manager->read_budget);
+    g_list_free(terminals);
+  }
+}
+
+static void terminal_manager_gconf_read_budget (GConfClient *client,
+						guint conn_id,
+						GConfEntry *entry,
+						TerminalManager *manager)
+{
+  GConfValue *value = gconf_client_get(client, OSSO_XTERM_GCONF_BACKGROUND_READ_BUDGET, NULL);
+
+  manager->read_budget = OSSO_XTERM_DEFAULT_BACKGROUND_READ_BUDGET;
+  if (value) {
+    if (value->type == GCONF_VALUE_INT)
+      manager->read_budget = MAX(0, gconf_value_get_int(value));
+    gconf_value_free(value);
+  }
+
+  terminal_manager_update_read_budgets(manager);
+}
+
+static gint terminal_manager_compare_idle (TerminalWidget *a, TerminalWidget *b)
+{
+  glong idle_a = terminal_widget_get_idle_time(a), idle_b = terminal_widget_get_idle_time(b);
+
+  return (idle_a < idle_b) - (idle_a > idle_b);
+}
+
+/* Hibernates the terminals out of use for too long, then, longest out of use
+   first, as many more as it takes to get down to the most kept awake. The
+   tab in use in each window counts as in use all along. */
+static gboolean terminal_manager_hibernate_idle (TerminalManager *manager)
+{
+  GSList *iter;
+  GList *terminals, *titer, *idle = NULL;
+  TerminalWidget *active;
+  guint live = 0;
+
+  for (iter = manager->windows ; iter ; iter = iter->next) {
+    terminals = terminal_window_get_terminals(TERMINAL_WINDOW(iter->data));
+    /* Only the tab in use in a window that can be seen is in use; that of
+       a window in the background hibernates like any other */
+    active = (iter->data == manager->current || GTK_WIDGET_MAPPED(iter->data))
+           ? terminal_window_get_active(TERMINAL_WINDOW(iter->data)) : NULL;
+    for (titer = terminals ; titer ; titer = titer->next) {
+      if (titer->data == active)
+	terminal_widget_touch(active);
+      else if (!terminal_widget_is_hibernating(titer->data))
+	idle = g_list_prepend(idle, titer->data);
+      if (!terminal_widget_is_hibernating(titer->data))
+	live++;
+    }
+    g_list_free(terminals);
+  }
+
+  idle = g_list_sort(idle, (GCompareFunc)terminal_manager_compare_idle);
+  for (titer = idle ; titer ; titer = titer->next)
+    if (((manager->hibernate_after > 0 &&
+	  terminal_widget_get_idle_time(titer->data) >= manager->hibernate_after) ||
+	 (manager->max_live > 0 && live > manager->max_live)) &&
+	terminal_widget_hibernate(titer->data))
+      live--;
+  g_list_free(idle);
+
+  return TRUE;
+}
+
+static void terminal_manager_gconf_hibernation (GConfClient *client,
+						guint conn_id,
+						GConfEntry *entry,
+						TerminalManager *manager)
+{
+  GConfValue *value;
 
-    g_signal_connect(window,
+  manager->hibernate_after = OSSO_XTERM_DEFAULT_HIBERNATE_AFTER;
+  if ((value = gconf_client_get(client, OSSO_XTERM_GCONF_HIBERNATE_AFTER, NULL))) {
+    if (value->type == GCONF_VALUE_INT)
+      manager->hibernate_after = MAX(0, gconf_value_get_int(value));
+    gconf_value_free(value);
+  }
+
+  manager->max_live = OSSO_XTERM_DEFAULT_MAX_LIVE_TERMINALS;
+  if ((value = gconf_client_get(client, OSSO_XTERM_GCONF_MAX_LIVE_TERMINALS, NULL))) {
+    if (value->type == GCONF_VALUE_INT)
+      manager->max_live = MAX(0, gconf_value_get_int(value));
+    gconf_value_free(value);
+  }
+
+  terminal_manager_hibernate_idle(manager);
+}
+
+/* Gives back what can be done without: the scrollback of every terminal but
+   the one in use, hibernating ones included, the fonts the font cache keeps
+   loaded for no terminal, the fallback font matches resolved for each page
+   and the font list kept for the font dialog. Those matches are the only
+   match cache of ours; the text VTE matches URLs against is its own, and
+   let go of whenever the screen changes. Glyphs are VTE's and Pango's too,
+   and go along with the fonts only if nothing else holds them. */
+void terminal_manager_shed_memory (TerminalManager *manager)
+{
+  GSList *iter;
+  GList *terminals, *titer;
+  TerminalWidget *active;
+  gsize scrollback = 0, trimmed;
+  guint n_trimmed = 0, fonts, pages, font_list;
+
+  for (iter = manager->windows ; iter ; iter = iter->next) {
+    terminals = terminal_window_get_terminals(TERMINAL_WINDOW(iter->data));
+    active = terminal_window_get_active(TERMINAL_WINDOW(iter->data));
+    for (titer = terminals ; titer ; titer = titer->next)
+      if (!(iter->data == manager->current && titer->data == active) &&
+	  (trimmed = terminal_widget_trim_scrollback(titer->data)) > 0) {
+	scrollback += trimmed;
+	n_trimmed++;
+      }
+    g_list_free(terminals);
+  }
+
+  fonts = font_cache_trim();
+  pages = font_fallback_trim();
+  font_list = font_dialog_release_font_list();
+
+  g_message("Low on memory: freed about %lu KB of scrollback from %u terminals, "
+	    "let go of %u unused fonts, %u fallback font matches and a list of %u fonts",
+	    (gulong)(scrollback / 1024), n_trimmed, fonts, pages, font_list);
+}
+
+/* Takes @window, which has something running in it, on */
+static void terminal_manager_add_window (TerminalManager *manager,
+					 TerminalWindow *window)
+{
+  g_signal_connect(window,
 		     "destroy",
 		     G_CALLBACK(terminal_manager_window_destroy),
 		     manager);
-    g_signal_connect(window,
+  g_signal_connect(window,
 		     "new_window",
 		     G_CALLBACK(terminal_manager_window_new_window),
 		     manager);
+  g_signal_connect(window,
+		     "active-changed",
+		     G_CALLBACK(terminal_manager_window_active_changed),
+		     manager);
 
-    /* when focused */
-    g_signal_connect (window, 
-                      "focus-in-event", 
-                      G_CALLBACK (terminal_manager_focus_in_actions), 
-                      manager);
+  /* when focused */
+  g_signal_connect (window, 
+                    "focus-in-event", 
+                    G_CALLBACK (terminal_manager_focus_in_actions), 
+                    manager);
 
-    manager->windows = g_slist_append(manager->windows, window);
-    g_object_set_data(G_OBJECT(window), "osso", g_object_get_data(G_OBJECT(manager), "osso"));
+  manager->windows = g_slist_append(manager->windows, window);
+  terminal_manager_set_window_watch(window, manager);
+  g_object_set_data(G_OBJECT(window), "osso", g_object_get_data(G_OBJECT(manager), "osso"));
 
-    hildon_program_add_window(HILDON_PROGRAM(manager), HILDON_WINDOW(window));
+  hildon_program_add_window(HILDON_PROGRAM(manager), HILDON_WINDOW(window));
 
-    manager->current = window;
+  manager->current = window;
+  terminal_manager_update_read_budgets(manager);
+}
+
+gboolean terminal_manager_new_window (TerminalManager *manager,
+				      const gchar *command,
+				      GError **error)
+{
+  TerminalWindow *window = TERMINAL_WINDOW(terminal_window_new());
 
+  if (terminal_window_launch(window, command, error)) {
+    terminal_manager_add_window(manager, window);
     return TRUE;
   }
   else {
@@ -118,10 +395,51 @@ gboolean terminal_manager_new_window (TerminalManager *manager,
   }
 }
 
+static void terminal_manager_sessions_listed (GArray *sessions,
+					      TerminalManager *manager)
+{
+  TerminalWindow *window = NULL;
+  GError *error = NULL;
+  guint n = 0, Nix;
+
+  for (Nix = 0 ; Nix < sessions->len ; Nix++) {
+    if (!window)
+      window = TERMINAL_WINDOW(terminal_window_new());
+
+    /* A session another osso-xterm got to first is simply skipped, or
+       closes its tab once osso-xterm-sessiond says so */
+    if (terminal_window_attach_session(window, g_array_index(sessions, guint, Nix), NULL)) {
+      if (n++ == 0)
+        terminal_manager_add_window(manager, window);
+    }
+    else if (n == 0) {
+      gtk_widget_destroy(GTK_WIDGET(window));
+      window = NULL;
+    }
+  }
+
+  if (n == 0 && !terminal_manager_new_window(manager, NULL, &error)) {
+    g_printerr (_("Unable to launch terminal: %s\n"), error ? error->message : "Unknown error");
+    if (error)
+      g_error_free(error);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Picks up the shells osso-xterm-sessiond still holds from an earlier run,
+   all in one window, one tab each, once it has said which they are. Opens
+   a new window if there were none. */
+void terminal_manager_reattach_sessions (TerminalManager *manager)
+{
+  terminal_pty_list_held((TerminalPtyListFunc)terminal_manager_sessions_listed, manager);
+}
+
 static void terminal_manager_window_destroy (TerminalWindow *window,
     					     TerminalManager *manager)
 {
   manager->windows = g_slist_remove(manager->windows, window);
+  if (manager->current == window)
+    manager->current = NULL;
 
   g_signal_emit(manager, sigs[S_WINDOW_CLOSED], 0, window);
 
@@ -151,12 +469,43 @@ static void terminal_manager_window_new_window (TerminalWindow *window,
   }
 }
 
+/* A tab was opened or switched to */
+static void terminal_manager_window_active_changed (TerminalWindow *window,
+						    TerminalManager *manager)
+{
+  if (!g_slist_find(manager->windows, window))
+    return;
+
+  terminal_manager_set_window_watch(window, manager);
+  terminal_manager_update_read_budgets(manager);
+  terminal_manager_hibernate_idle(manager);
+}
+
 static gboolean terminal_manager_focus_in_actions (TerminalWindow *window,
 						   GdkEventFocus *event,
 						   TerminalManager *manager)
 {
-  if ((event->type == GDK_FOCUS_CHANGE) && (manager->current != window))
+  if ((event->type == GDK_FOCUS_CHANGE) && (manager->current != window)) {
     manager->current = window;
+    terminal_manager_update_read_budgets(manager);
+  }
   return FALSE;
 }
 
+TerminalWidget *terminal_manager_find_terminal (TerminalManager *manager,
+						guint id)
+{
+  TerminalWidget *found = NULL;
+  GSList *iter;
+  GList *terminals, *titer;
+
+  for (iter = manager->windows ; iter && !found ; iter = iter->next) {
+    terminals = terminal_window_get_terminals(TERMINAL_WINDOW(iter->data));
+    for (titer = terminals ; titer && !found ; titer = titer->next)
+      if (terminal_widget_get_id(TERMINAL_WIDGET(titer->data)) == id)
+        found = TERMINAL_WIDGET(titer->data);
+    g_list_free(terminals);
+  }
+
+  return found;
+}
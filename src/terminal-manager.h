@@ -1,7 +1,9 @@
 #include <glib.h>
 #include <glib-object.h>
 #include <hildon/hildon-program.h>
+#include <gconf/gconf-client.h>
 #include "terminal-window.h"
+#include "output-watch.h"
 
 #ifndef TERMINAL_MANAGER_H
 #define TERMINAL_MANAGER_H
@@ -33,6 +35,17 @@ struct _TerminalManager
 
   GSList *windows;
   TerminalWindow *current;
+
+  GConfClient *gconf_client;
+  guint watch_conid;
+  OutputWatch *watch;
+  guint read_budget_conid;
+  gsize read_budget;
+  guint hibernate_after_conid;
+  glong hibernate_after;
+  guint max_live_conid;
+  guint max_live;
+  guint hibernate_id;
 };
 
 GType            terminal_manager_get_type (void) G_GNUC_CONST;
@@ -42,6 +55,12 @@ gboolean         terminal_manager_new_window (TerminalManager *manager,
 					      const gchar *command,
 					      GError **error);
 
+void             terminal_manager_reattach_sessions (TerminalManager *manager);
+void             terminal_manager_shed_memory (TerminalManager *manager);
+
+TerminalWidget  *terminal_manager_find_terminal (TerminalManager *manager,
+						 guint id);
+
 G_END_DECLS;
 
 #endif /* TERMINAL_MANAGER_H */
@@ -0,0 +1,331 @@
+#include <string.h>
+#include "terminal-modes.h"
+
+/* Parameters kept of a control sequence; any more are ignored */
+#define MAX_PARAMS 16
+
+typedef enum
+{
+  STATE_GROUND,
+  STATE_ESCAPE,
+  STATE_CHARSET,      /* ESC ( or ESC ), waiting for the set */
+  STATE_INTERMEDIATE, /* Some other ESC with an intermediate, waiting for its final byte */
+  STATE_CSI,
+  STATE_STRING,       /* OSC, DCS, APC, PM or SOS, waiting for BEL or ST */
+  STATE_STRING_ESCAPE
+} State;
+
+/* The modes kept track of, with how a reset leaves them. A soft reset
+   (DECSTR) is not followed, so what it resets still counts as changed. */
+static const struct
+{
+  gboolean private;
+  guint mode;
+  gboolean on;
+} modes_known[] = {
+  { FALSE,    4, FALSE },  /* IRM, insert */
+  { FALSE,   20, FALSE },  /* LNM, newline */
+  { TRUE,     1, FALSE },  /* DECCKM, application cursor keys */
+  { TRUE,     6, FALSE },  /* DECOM, origin */
+  { TRUE,     7, TRUE  },  /* DECAWM, autowrap */
+  { TRUE,    25, TRUE  },  /* DECTCEM, cursor shown */
+  { TRUE,    47, FALSE },  /* Alternate screen */
+  { TRUE,  1047, FALSE },
+  { TRUE,  1049, FALSE },
+  { TRUE,  1000, FALSE },  /* Mouse reporting */
+  { TRUE,  1001, FALSE },
+  { TRUE,  1002, FALSE },
+  { TRUE,  1003, FALSE }
+};
+
+/* Text attributes, each with the SGR code that turns it off */
+enum
+{
+  ATTR_INTENSITY = 1 << 0,  /* 22 */
+  ATTR_ITALIC    = 1 << 1,  /* 23 */
+  ATTR_UNDERLINE = 1 << 2,  /* 24 */
+  ATTR_BLINK     = 1 << 3,  /* 25 */
+  ATTR_REVERSE   = 1 << 4,  /* 27 */
+  ATTR_INVISIBLE = 1 << 5,  /* 28 */
+  ATTR_STRIKE    = 1 << 6,  /* 29 */
+  ATTR_FOREGROUND = 1 << 7, /* 39 */
+  ATTR_BACKGROUND = 1 << 8  /* 49 */
+};
+
+struct _TerminalModes
+{
+  State state;
+  gchar private;       /* The ? or > of the control sequence, if any */
+  gchar intermediate;
+  gchar charset_slot;  /* ( or ) */
+  guint params[MAX_PARAMS];
+  guint n_params;
+
+  guint32 changed;     /* A bit per modes_known entry not the way a reset leaves it */
+  gboolean keypad;     /* DECKPAM */
+  gboolean shifted;    /* SO, G1 in use */
+  gchar g0;
+  gchar g1;
+  glong top;           /* Of the scroll region, 0 for the default */
+  glong bottom;
+  guint attrs;
+};
+
+TerminalModes *
+terminal_modes_new(void)
+{
+  TerminalModes *modes = g_new0(TerminalModes, 1);
+
+  terminal_modes_reset(modes);
+
+  return modes;
+}
+
+void
+terminal_modes_free(TerminalModes *modes)
+{
+  g_free(modes);
+}
+
+/* As a reset, or a new child, leaves the terminal */
+void
+terminal_modes_reset(TerminalModes *modes)
+{
+  memset(modes, 0, sizeof(*modes));
+  modes->state = STATE_GROUND;
+  modes->g0 = 'B';
+  modes->g1 = 'B';
+}
+
+gboolean
+terminal_modes_are_default(TerminalModes *modes, glong rows)
+{
+  return (modes->changed == 0 && !modes->keypad && !modes->shifted &&
+          modes->g0 == 'B' && modes->g1 == 'B' && modes->attrs == 0 &&
+          modes->top <= 1 && (modes->bottom == 0 || modes->bottom >= rows));
+}
+
+static void
+set_mode(TerminalModes *modes, gboolean private, guint mode, gboolean on)
+{
+  guint Nix;
+
+  for (Nix = 0 ; Nix < G_N_ELEMENTS(modes_known) ; Nix++)
+    if (modes_known[Nix].private == private && modes_known[Nix].mode == mode) {
+      if (on == modes_known[Nix].on)
+        modes->changed &= ~(1 << Nix);
+      else
+        modes->changed |= (1 << Nix);
+    }
+}
+
+static void
+set_attributes(TerminalModes *modes)
+{
+  guint Nix, code;
+
+  if (modes->n_params == 0)
+    modes->attrs = 0;
+
+  for (Nix = 0 ; Nix < modes->n_params ; Nix++) {
+    code = modes->params[Nix];
+    if (code == 0)
+      modes->attrs = 0;
+    else if (code == 1 || code == 2)
+      modes->attrs |= ATTR_INTENSITY;
+    else if (code == 3)
+      modes->attrs |= ATTR_ITALIC;
+    else if (code == 4)
+      modes->attrs |= ATTR_UNDERLINE;
+    else if (code == 5 || code == 6)
+      modes->attrs |= ATTR_BLINK;
+    else if (code == 7)
+      modes->attrs |= ATTR_REVERSE;
+    else if (code == 8)
+      modes->attrs |= ATTR_INVISIBLE;
+    else if (code == 9)
+      modes->attrs |= ATTR_STRIKE;
+    else if (code == 21 || code == 22)
+      modes->attrs &= ~ATTR_INTENSITY;
+    else if (code == 23)
+      modes->attrs &= ~ATTR_ITALIC;
+    else if (code == 24)
+      modes->attrs &= ~ATTR_UNDERLINE;
+    else if (code == 25)
+      modes->attrs &= ~ATTR_BLINK;
+    else if (code == 27)
+      modes->attrs &= ~ATTR_REVERSE;
+    else if (code == 28)
+      modes->attrs &= ~ATTR_INVISIBLE;
+    else if (code == 29)
+      modes->attrs &= ~ATTR_STRIKE;
+    else if (code == 39)
+      modes->attrs &= ~ATTR_FOREGROUND;
+    else if (code == 49)
+      modes->attrs &= ~ATTR_BACKGROUND;
+    else if ((code >= 30 && code <= 38) || (code >= 90 && code <= 97))
+      modes->attrs |= ATTR_FOREGROUND;
+    else if ((code >= 40 && code <= 48) || (code >= 100 && code <= 107))
+      modes->attrs |= ATTR_BACKGROUND;
+
+    /* The colour that follows 38 or 48 is not a code of its own */
+    if ((code == 38 || code == 48) && Nix + 1 < modes->n_params)
+      Nix += (modes->params[Nix + 1] == 2) ? 4 : 2;
+  }
+}
+
+static void
+dispatch_csi(TerminalModes *modes, gchar final)
+{
+  guint Nix;
+
+  if (modes->intermediate)
+    return;
+
+  switch (final) {
+    case 'h':
+    case 'l':
+      if (modes->private && modes->private != '?')
+        break;
+      for (Nix = 0 ; Nix < modes->n_params ; Nix++)
+        set_mode(modes, modes->private == '?', modes->params[Nix], final == 'h');
+      break;
+
+    case 'm':
+      if (!modes->private)
+        set_attributes(modes);
+      break;
+
+    case 'r':
+      if (!modes->private) {
+        modes->top = modes->n_params > 0 ? modes->params[0] : 0;
+        modes->bottom = modes->n_params > 1 ? modes->params[1] : 0;
+      }
+      break;
+  }
+}
+
+static void
+start_csi(TerminalModes *modes)
+{
+  modes->state = STATE_CSI;
+  modes->private = 0;
+  modes->intermediate = 0;
+  modes->n_params = 0;
+}
+
+void
+terminal_modes_feed(TerminalModes *modes, const gchar *data, gsize length)
+{
+  const guchar *p = (const guchar *)data, *end = p + length;
+  guchar c;
+
+  while (p < end) {
+    c = *p;
+
+    /* Cancels whatever sequence it is in */
+    if (c == 0x18 || c == 0x1a) {
+      modes->state = STATE_GROUND;
+      p++;
+      continue;
+    }
+
+    switch (modes->state) {
+      case STATE_GROUND:
+        if (c == 0x1b)
+          modes->state = STATE_ESCAPE;
+        else if (c == 0x0e)
+          modes->shifted = TRUE;
+        else if (c == 0x0f)
+          modes->shifted = FALSE;
+        break;
+
+      case STATE_ESCAPE:
+        modes->state = STATE_GROUND;
+        if (c == '[')
+          start_csi(modes);
+        else if (c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X')
+          modes->state = STATE_STRING;
+        else if (c == '(' || c == ')') {
+          modes->charset_slot = c;
+          modes->state = STATE_CHARSET;
+        }
+        else if (c >= 0x20 && c <= 0x2f)
+          modes->state = STATE_INTERMEDIATE;
+        else if (c == '=')
+          modes->keypad = TRUE;
+        else if (c == '>')
+          modes->keypad = FALSE;
+        else if (c == 'c')
+          terminal_modes_reset(modes);
+        else if (c == 0x1b)
+          modes->state = STATE_ESCAPE;
+        break;
+
+      case STATE_CHARSET:
+        if (modes->charset_slot == '(')
+          modes->g0 = c;
+        else
+          modes->g1 = c;
+        modes->state = STATE_GROUND;
+        break;
+
+      case STATE_INTERMEDIATE:
+        if (c >= 0x30 && c <= 0x7e)
+          modes->state = STATE_GROUND;
+        else if (c == 0x1b)
+          modes->state = STATE_ESCAPE;
+        break;
+
+      case STATE_CSI:
+        if (c >= '0' && c <= '9') {
+          if (modes->n_params == 0)
+            modes->params[modes->n_params++] = 0;
+          if (modes->n_params <= MAX_PARAMS)
+            modes->params[modes->n_params - 1] = MIN(modes->params[modes->n_params - 1] * 10 + (c - '0'), 100000);
+        }
+        else if (c == ';' || c == ':') {
+          if (modes->n_params == 0)
+            modes->params[modes->n_params++] = 0;
+          if (modes->n_params < MAX_PARAMS)
+            modes->params[modes->n_params++] = 0;
+          else
+            modes->n_params = MAX_PARAMS + 1;
+        }
+        else if (c >= 0x3c && c <= 0x3f)
+          modes->private = c;
+        else if (c >= 0x20 && c <= 0x2f)
+          modes->intermediate = c;
+        else if (c >= 0x40 && c <= 0x7e) {
+          modes->n_params = MIN(modes->n_params, MAX_PARAMS);
+          dispatch_csi(modes, c);
+          modes->state = STATE_GROUND;
+        }
+        else if (c == 0x1b)
+          modes->state = STATE_ESCAPE;
+        else if (c == 0x0e)
+          modes->shifted = TRUE;
+        else if (c == 0x0f)
+          modes->shifted = FALSE;
+        break;
+
+      case STATE_STRING:
+        if (c == 0x07)
+          modes->state = STATE_GROUND;
+        else if (c == 0x1b)
+          modes->state = STATE_STRING_ESCAPE;
+        break;
+
+      case STATE_STRING_ESCAPE:
+        /* ST ends the string; any other escape starts a sequence of its own */
+        modes->state = STATE_ESCAPE;
+        if (c == '\\')
+          modes->state = STATE_GROUND;
+        else
+          continue;
+        break;
+    }
+
+    p++;
+  }
+}
@@ -0,0 +1,25 @@
+#ifndef _TERMINAL_MODES_H_
+#define _TERMINAL_MODES_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* What a plain text copy of a terminal's rows leaves out: the alternate
+   screen, the modes set with DECSET and SM, the keypad mode, the scroll
+   region, the character sets and the text attributes. Output is fed to it in
+   arbitrary pieces, in the order the terminal gets it, and only as much of
+   each escape sequence is kept as it takes to tell whether all of that is
+   still the way a reset leaves it. */
+typedef struct _TerminalModes TerminalModes;
+
+TerminalModes *terminal_modes_new(void);
+void           terminal_modes_free(TerminalModes *modes);
+
+void           terminal_modes_feed(TerminalModes *modes, const gchar *data, gsize length);
+void           terminal_modes_reset(TerminalModes *modes);
+gboolean       terminal_modes_are_default(TerminalModes *modes, glong rows);
+
+G_END_DECLS
+
+#endif /* !_TERMINAL_MODES_H_ */
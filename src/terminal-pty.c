@@ -0,0 +1,844 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include "terminal-pty.h"
+#include "session-protocol.h"
+
+/* Bytes read from the pty in one go */
+#define READ_SIZE 4096
+
+/* Output the main thread has not picked up yet, beyond which the reader stops
+   reading and leaves the child to block on a full pty */
+#define MAX_PENDING (256 * 1024)
+
+/* After GTK has resized things, before it redraws them */
+#define OUTPUT_PRIORITY (G_PRIORITY_HIGH_IDLE + 15)
+
+/* Milliseconds osso-xterm-sessiond has to answer a NEW, ATTACH or LIST */
+#define REPLY_TIMEOUT 5000
+
+struct _TerminalPty
+{
+  int fd;             /* The pty, or the socket to osso-xterm-sessiond */
+  gboolean held;      /* By osso-xterm-sessiond */
+  int wake[2];
+  gint columns;
+  gint rows;
+
+  GThread *thread;
+  guint child_watch_id;
+
+  /* Input the child has not taken yet, sent as it makes room for it */
+  GByteArray *outgoing;
+  guint outgoing_id;
+
+  TerminalPtyOutputFunc output_func;
+  TerminalPtyExitFunc exit_func;
+  gpointer user_data;
+
+  /* Shared with the reader thread */
+  GMutex *lock;
+  GCond *cond;
+  GPid pid;           /* 0 until osso-xterm-sessiond has said, if held */
+  guint session;      /* The session held by osso-xterm-sessiond, or 0 */
+  GByteArray *pending;
+  gboolean closing;
+  guint output_id;
+  gsize budget;
+  gboolean throttled;
+  guint exit_id;
+  gint exit_status;
+};
+
+static gboolean flush_outgoing(TerminalPty *pty);
+
+static gboolean
+output_idle(TerminalPty *pty)
+{
+  g_mutex_lock(pty->lock);
+  pty->output_id = 0;
+  g_mutex_unlock(pty->lock);
+
+  if (pty->output_func)
+    pty->output_func(pty, pty->user_data);
+
+  return FALSE;
+}
+
+/* Lets the main thread know about new output, or a change in throttling.
+   Called with the lock held. */
+static void
+queue_output(TerminalPty *pty)
+{
+  if (!(pty->output_id))
+    pty->output_id = g_idle_add_full(OUTPUT_PRIORITY, (GSourceFunc)output_idle, pty, NULL);
+}
+
+static gboolean
+exit_idle(TerminalPty *pty)
+{
+  g_mutex_lock(pty->lock);
+  pty->exit_id = 0;
+  g_mutex_unlock(pty->lock);
+
+  if (pty->exit_func)
+    pty->exit_func(pty, pty->exit_status, pty->user_data);
+
+  return FALSE;
+}
+
+static void
+set_throttled(TerminalPty *pty, gboolean throttled)
+{
+  g_mutex_lock(pty->lock);
+  if (throttled != pty->throttled) {
+    pty->throttled = throttled;
+    queue_output(pty);
+  }
+  g_mutex_unlock(pty->lock);
+}
+
+/* Reads the next frame from osso-xterm-sessiond. Output is left in @frame,
+   and its length returned. The end of the session, or of the connection,
+   is reported to the main thread and returns -1. */
+static ssize_t
+read_held(TerminalPty *pty, GByteArray *frame)
+{
+  gchar type;
+
+  if (!session_read_frame(pty->fd, &type, frame))
+    type = SESSION_FRAME_EXIT, g_byte_array_set_size(frame, 0);
+
+  if (type == SESSION_FRAME_OUTPUT)
+    return frame->len;
+
+  if (type == SESSION_FRAME_EXIT) {
+    g_byte_array_append(frame, (guint8 *)"", 1);
+    g_mutex_lock(pty->lock);
+    pty->exit_status = atoi((gchar *)(frame->data));
+    if (!(pty->closing) && !(pty->exit_id))
+      pty->exit_id = g_idle_add((GSourceFunc)exit_idle, pty);
+    g_mutex_unlock(pty->lock);
+    errno = 0;
+    return -1;
+  }
+
+  /* Nothing else is meant for us */
+  errno = EAGAIN;
+  return -1;
+}
+
+/* Waits for osso-xterm-sessiond to say which session it gave us, and keeps
+   its id and the pid of the child. If it does not within REPLY_TIMEOUT, or
+   says why not, that is reported as the end of the session. */
+static gboolean
+read_reply(TerminalPty *pty, GByteArray *frame)
+{
+  struct pollfd fds[2];
+  guint session;
+  gint pid, n;
+  gchar type;
+
+  fds[0].fd = pty->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = pty->wake[0];
+  fds[1].events = POLLIN;
+
+  do
+    n = poll(fds, 2, REPLY_TIMEOUT);
+  while (n < 0 && errno == EINTR);
+
+  if (n > 0 && !(fds[1].revents) && session_read_frame(pty->fd, &type, frame)) {
+    g_byte_array_append(frame, (guint8 *)"", 1);
+    if (type == SESSION_FRAME_SESSION && sscanf((gchar *)(frame->data), "%u %d", &session, &pid) == 2) {
+      g_mutex_lock(pty->lock);
+      pty->session = session;
+      pty->pid = pid;
+      g_mutex_unlock(pty->lock);
+      return TRUE;
+    }
+    g_warning("osso-xterm-sessiond: %s", (gchar *)(frame->data));
+  }
+  else if (n == 0)
+    g_warning("osso-xterm-sessiond did not answer");
+
+  g_mutex_lock(pty->lock);
+  pty->exit_status = -1;
+  if (!(pty->closing) && !(pty->exit_id))
+    pty->exit_id = g_idle_add((GSourceFunc)exit_idle, pty);
+  g_mutex_unlock(pty->lock);
+
+  return FALSE;
+}
+
+/* With a budget, reading stops once that many bytes have been read within a
+   second, until the second is up. The child then blocks on a full pty, or
+   osso-xterm-sessiond stops reading it for us. */
+static gpointer
+reader_thread(TerminalPty *pty)
+{
+  struct pollfd fds[2];
+  gchar buf[READ_SIZE];
+  GByteArray *frame = pty->held ? g_byte_array_new() : NULL;
+  const guint8 *data;
+  gboolean done = FALSE, over;
+  GTimer *timer = g_timer_new();
+  gsize budget, read_in_second = 0;
+  gdouble elapsed;
+  ssize_t n;
+  int timeout;
+
+  fds[0].fd = pty->fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = pty->wake[0];
+  fds[1].events = POLLIN;
+
+  if (frame)
+    done = !read_reply(pty, frame);
+
+  while (!done) {
+    g_mutex_lock(pty->lock);
+    budget = pty->budget;
+    g_mutex_unlock(pty->lock);
+
+    if ((elapsed = g_timer_elapsed(timer, NULL)) >= 1.0) {
+      g_timer_start(timer);
+      read_in_second = 0;
+      elapsed = 0;
+    }
+    over = (budget > 0 && read_in_second >= budget);
+    set_throttled(pty, over);
+
+    /* While over budget, only the wake pipe is listened to */
+    timeout = over ? MAX(1, (int)((1.0 - elapsed) * 1000)) : -1;
+    fds[0].revents = fds[1].revents = 0;
+    if (poll(over ? &fds[1] : fds, over ? 1 : 2, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents) {
+      while (read(pty->wake[0], buf, sizeof(buf)) > 0);
+      g_mutex_lock(pty->lock);
+      done = pty->closing;
+      g_mutex_unlock(pty->lock);
+      continue;
+    }
+    if (!(fds[0].revents))
+      continue;
+
+    if (frame) {
+      n = read_held(pty, frame);
+      data = frame->data;
+    }
+    else {
+      n = read(pty->fd, buf, sizeof(buf));
+      data = (const guint8 *)buf;
+    }
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    g_mutex_lock(pty->lock);
+    while (!(pty->closing) && pty->pending->len >= MAX_PENDING)
+      g_cond_wait(pty->cond, pty->lock);
+
+    if (n > 0 && !(pty->closing)) {
+      g_byte_array_append(pty->pending, data, n);
+      read_in_second += n;
+      queue_output(pty);
+    }
+    else
+      /* EOF, or EIO once the child has gone. The child watch reports that. */
+      done = TRUE;
+    g_mutex_unlock(pty->lock);
+  }
+
+  g_timer_destroy(timer);
+  if (frame)
+    g_byte_array_free(frame, TRUE);
+
+  return NULL;
+}
+
+static void
+child_exited(GPid pid, gint status, TerminalPty *pty)
+{
+  pty->child_watch_id = 0;
+  g_spawn_close_pid(pid);
+
+  if (pty->exit_func)
+    pty->exit_func(pty, status, pty->user_data);
+}
+
+static void
+reap_child(GPid pid, gint status, gpointer null)
+{
+  g_spawn_close_pid(pid);
+}
+
+static TerminalPty *
+pty_new(GPid pid, int fd, gboolean held, gint columns, gint rows)
+{
+  TerminalPty *pty = g_new0(TerminalPty, 1);
+
+  pty->pid = pid;
+  pty->fd = fd;
+  pty->held = held;
+  pty->columns = columns;
+  pty->rows = rows;
+  pty->lock = g_mutex_new();
+  pty->cond = g_cond_new();
+  pty->pending = g_byte_array_new();
+  pty->outgoing = g_byte_array_new();
+  pty->wake[0] = pty->wake[1] = -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  return pty;
+}
+
+/* Starts the reader, or frees @pty if it cannot */
+static TerminalPty *
+pty_start(TerminalPty *pty, GError **error)
+{
+  if (pipe(pty->wake) < 0) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED, "%s", g_strerror(errno));
+    pty->wake[0] = pty->wake[1] = -1;
+  }
+  else {
+    fcntl(pty->wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pty->wake[1], F_SETFD, FD_CLOEXEC);
+    fcntl(pty->wake[0], F_SETFL, O_NONBLOCK);
+    pty->thread = g_thread_create((GThreadFunc)reader_thread, pty, TRUE, error);
+  }
+
+  if (!(pty->thread)) {
+    terminal_pty_free(pty);
+    return NULL;
+  }
+
+  return pty;
+}
+
+/* Runs @command with @argv and @envv on a new pty of @columns by @rows */
+TerminalPty *
+terminal_pty_spawn(const gchar *command, gchar **argv, gchar **envv,
+                   const gchar *working_directory, gint columns, gint rows,
+                   GError **error)
+{
+  extern gchar **environ;
+  struct winsize ws;
+  TerminalPty *pty;
+  pid_t pid;
+  int fd;
+
+  memset(&ws, 0, sizeof(ws));
+  ws.ws_col = columns;
+  ws.ws_row = rows;
+
+  pid = forkpty(&fd, NULL, NULL, &ws);
+  if (pid < 0) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FORK, "%s", g_strerror(errno));
+    return NULL;
+  }
+
+  if (pid == 0) {
+    if (working_directory)
+      if (chdir(working_directory) < 0)
+        chdir("/");
+    if (envv)
+      environ = envv;
+    execvp(command, argv);
+    _exit(127);
+  }
+
+  /* Writing must not block the main thread, and the reader polls first */
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  pty = pty_new(pid, fd, FALSE, columns, rows);
+  pty->child_watch_id = g_child_watch_add(pid, (GChildWatchFunc)child_exited, pty);
+
+  return pty_start(pty, error);
+}
+
+/* Connects to osso-xterm-sessiond. If it is not up and @start, it is
+   started for next time, and this time fails rather than waits for it. */
+static int
+session_connect(gboolean start, GError **error)
+{
+  gchar *path = session_socket_path();
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+  g_free(path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0) {
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+      return fd;
+    }
+    close(fd);
+  }
+
+  if (start)
+    terminal_pty_start_holder();
+  g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED, "osso-xterm-sessiond is not up");
+
+  return -1;
+}
+
+/* Starts osso-xterm-sessiond unless it is up already, without waiting for
+   it. Started early enough, it is up by the time a terminal asks for it. */
+void
+terminal_pty_start_holder(void)
+{
+  static gboolean started = FALSE;
+  gchar *argv[] = { BINDIR "/osso-xterm-sessiond", NULL };
+  GError *error = NULL;
+  int fd;
+
+  if (started)
+    return;
+  started = TRUE;
+
+  if ((fd = session_connect(FALSE, NULL)) >= 0) {
+    close(fd);
+    return;
+  }
+
+  /* It leaves its own session, so it is not ours to reap */
+  if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                     NULL, NULL, NULL, &error)) {
+    g_warning("Unable to start osso-xterm-sessiond: %s", error->message);
+    g_error_free(error);
+  }
+}
+
+/* Leaves it to the reader to wait for osso-xterm-sessiond to say which
+   session it gave us, so the main thread does not. From here on, @fd goes
+   with the pty. */
+static TerminalPty *
+session_start(int fd, gint columns, gint rows, GError **error)
+{
+  return pty_start(pty_new(0, fd, TRUE, columns, rows), error);
+}
+
+/* Like terminal_pty_spawn(), but the pty is held by osso-xterm-sessiond, so
+   the child carries on if we go away without terminal_pty_free(). Only
+   failing to reach osso-xterm-sessiond fails here; it failing to start the
+   child ends the session later on. */
+TerminalPty *
+terminal_pty_spawn_held(const gchar *command, gchar **argv, gchar **envv,
+                        const gchar *working_directory, gint columns, gint rows,
+                        GError **error)
+{
+  GByteArray *payload;
+  gchar *str;
+  guint n, Nix;
+  int fd;
+  gboolean sent;
+
+  if ((fd = session_connect(TRUE, error)) < 0)
+    return NULL;
+
+  payload = g_byte_array_new();
+#define APPEND(s) (str = (s), g_byte_array_append(payload, (guint8 *)str, strlen(str) + 1))
+  APPEND(g_strdup_printf("%d", columns)); g_free(str);
+  APPEND(g_strdup_printf("%d", rows)); g_free(str);
+  APPEND((gchar *)(working_directory ? working_directory : ""));
+  APPEND((gchar *)command);
+  n = g_strv_length(argv);
+  APPEND(g_strdup_printf("%u", n)); g_free(str);
+  for (Nix = 0 ; Nix < n ; Nix++)
+    APPEND(argv[Nix]);
+  n = envv ? g_strv_length(envv) : 0;
+  APPEND(g_strdup_printf("%u", n)); g_free(str);
+  for (Nix = 0 ; Nix < n ; Nix++)
+    APPEND(envv[Nix]);
+#undef APPEND
+
+  sent = session_write_frame(fd, SESSION_FRAME_NEW, payload->data, payload->len);
+  g_byte_array_free(payload, TRUE);
+  if (!sent) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED, "osso-xterm-sessiond went away");
+    close(fd);
+    return NULL;
+  }
+
+  return session_start(fd, columns, rows, error);
+}
+
+/* Takes @session over from osso-xterm-sessiond. What it kept of the output
+   comes in first. If someone else has taken it over already, the session
+   ends as soon as osso-xterm-sessiond says so. */
+TerminalPty *
+terminal_pty_attach(guint session, gint columns, gint rows, GError **error)
+{
+  TerminalPty *pty;
+  gchar *str;
+  int fd;
+
+  if ((fd = session_connect(FALSE, error)) < 0)
+    return NULL;
+
+  str = g_strdup_printf("%u", session);
+  if (!session_write_frame(fd, SESSION_FRAME_ATTACH, str, strlen(str))) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED, "osso-xterm-sessiond went away");
+    close(fd);
+    g_free(str);
+    return NULL;
+  }
+  g_free(str);
+
+  /* The size it had is not necessarily ours */
+  pty = session_start(fd, -1, -1, error);
+  if (pty)
+    terminal_pty_set_size(pty, columns, rows);
+
+  return pty;
+}
+
+typedef struct
+{
+  int fd;
+  GByteArray *in;
+  GArray *sessions;
+  guint watch_id;
+  guint timeout_id;
+  TerminalPtyListFunc func;
+  gpointer user_data;
+} ListRequest;
+
+static void
+list_done(ListRequest *request)
+{
+  if (request->watch_id)
+    g_source_remove(request->watch_id);
+  if (request->timeout_id)
+    g_source_remove(request->timeout_id);
+  if (request->fd >= 0)
+    close(request->fd);
+
+  request->func(request->sessions, request->user_data);
+
+  g_array_free(request->sessions, TRUE);
+  g_byte_array_free(request->in, TRUE);
+  g_free(request);
+}
+
+/* Also where a list with nobody to ask ends up */
+static gboolean
+list_timeout(ListRequest *request)
+{
+  request->timeout_id = 0;
+  list_done(request);
+
+  return FALSE;
+}
+
+static gboolean
+list_readable(GIOChannel *channel, GIOCondition condition, ListRequest *request)
+{
+  guint8 buf[READ_SIZE];
+  guint32 length;
+  guint session;
+  ssize_t n;
+  gchar type, *str;
+
+  n = read(request->fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return TRUE;
+  if (n > 0)
+    g_byte_array_append(request->in, buf, n);
+
+  while (session_frame_parse(request->in, &type, &length)) {
+    if (type != SESSION_FRAME_SESSION)
+      break;
+    str = g_strndup((gchar *)(request->in->data) + SESSION_FRAME_HEADER_SIZE, length);
+    if (sscanf(str, "%u", &session) == 1)
+      g_array_append_val(request->sessions, session);
+    g_free(str);
+    g_byte_array_remove_range(request->in, 0, SESSION_FRAME_HEADER_SIZE + length);
+  }
+
+  /* Done once it says so, or hangs up */
+  if (n > 0 && !session_frame_parse(request->in, &type, &length))
+    return TRUE;
+
+  request->watch_id = 0;
+  list_done(request);
+
+  return FALSE;
+}
+
+/* Asks osso-xterm-sessiond for the sessions it holds with nobody attached
+   to them, and passes them to @func from the main loop once it has
+   answered, or REPLY_TIMEOUT has passed. Without it, there are none. */
+void
+terminal_pty_list_held(TerminalPtyListFunc func, gpointer user_data)
+{
+  ListRequest *request = g_new0(ListRequest, 1);
+  GIOChannel *channel;
+
+  request->in = g_byte_array_new();
+  request->sessions = g_array_new(FALSE, FALSE, sizeof(guint));
+  request->func = func;
+  request->user_data = user_data;
+
+  request->fd = session_connect(FALSE, NULL);
+  if (request->fd >= 0 && !session_write_frame(request->fd, SESSION_FRAME_LIST, NULL, 0)) {
+    close(request->fd);
+    request->fd = -1;
+  }
+  if (request->fd < 0) {
+    request->timeout_id = g_idle_add((GSourceFunc)list_timeout, request);
+    return;
+  }
+
+  fcntl(request->fd, F_SETFL, fcntl(request->fd, F_GETFL) | O_NONBLOCK);
+  channel = g_io_channel_unix_new(request->fd);
+  request->watch_id = g_io_add_watch(channel, G_IO_IN | G_IO_ERR | G_IO_HUP, (GIOFunc)list_readable, request);
+  g_io_channel_unref(channel);
+  request->timeout_id = g_timeout_add(REPLY_TIMEOUT, (GSourceFunc)list_timeout, request);
+}
+
+void
+terminal_pty_set_callbacks(TerminalPty *pty, TerminalPtyOutputFunc output_func,
+                           TerminalPtyExitFunc exit_func, gpointer user_data)
+{
+  pty->output_func = output_func;
+  pty->exit_func = exit_func;
+  pty->user_data = user_data;
+}
+
+/* Stops reading, hangs up on the child if it is still around and frees @pty */
+void
+terminal_pty_free(TerminalPty *pty)
+{
+  g_mutex_lock(pty->lock);
+  pty->closing = TRUE;
+  g_cond_broadcast(pty->cond);
+  g_mutex_unlock(pty->lock);
+
+  /* osso-xterm-sessiond hangs up on it for us, unless it is not taking
+     any more from us. The reader may be in the middle of a frame, which
+     shutting the socket down cuts short. */
+  if (pty->held) {
+    session_frame_append(pty->outgoing, SESSION_FRAME_KILL, NULL, 0);
+    if (!flush_outgoing(pty) && terminal_pty_get_pid(pty) > 0)
+      kill(terminal_pty_get_pid(pty), SIGHUP);
+    shutdown(pty->fd, SHUT_RDWR);
+  }
+
+  if (pty->thread) {
+    while (write(pty->wake[1], "", 1) < 0 && errno == EINTR);
+    g_thread_join(pty->thread);
+  }
+
+  if (pty->outgoing_id)
+    g_source_remove(pty->outgoing_id);
+
+  /* The reader is gone, so nothing else touches the shared part any more */
+  if (pty->output_id)
+    g_source_remove(pty->output_id);
+  if (pty->exit_id)
+    g_source_remove(pty->exit_id);
+
+  close(pty->fd);
+  if (pty->wake[0] >= 0) {
+    close(pty->wake[0]);
+    close(pty->wake[1]);
+  }
+
+  if (pty->child_watch_id) {
+    g_source_remove(pty->child_watch_id);
+    kill(pty->pid, SIGHUP);
+    g_child_watch_add(pty->pid, reap_child, NULL);
+  }
+
+  g_byte_array_free(pty->pending, TRUE);
+  g_byte_array_free(pty->outgoing, TRUE);
+  g_cond_free(pty->cond);
+  g_mutex_free(pty->lock);
+  g_free(pty);
+}
+
+/* The pid of the child, or 0 while osso-xterm-sessiond has yet to say */
+GPid
+terminal_pty_get_pid(TerminalPty *pty)
+{
+  GPid pid;
+
+  g_mutex_lock(pty->lock);
+  pid = pty->pid;
+  g_mutex_unlock(pty->lock);
+
+  return pid;
+}
+
+/* The session osso-xterm-sessiond holds the pty in, or 0 if it is ours or
+   osso-xterm-sessiond has yet to say */
+guint
+terminal_pty_get_session(TerminalPty *pty)
+{
+  guint session;
+
+  g_mutex_lock(pty->lock);
+  session = pty->session;
+  g_mutex_unlock(pty->lock);
+
+  return session;
+}
+
+/* Takes whatever output has been read so far. Free it with g_byte_array_free(). */
+GByteArray *
+terminal_pty_steal_output(TerminalPty *pty)
+{
+  GByteArray *output;
+
+  g_mutex_lock(pty->lock);
+  output = pty->pending;
+  pty->pending = g_byte_array_new();
+  if (output->len >= MAX_PENDING)
+    g_cond_signal(pty->cond);
+  g_mutex_unlock(pty->lock);
+
+  return output;
+}
+
+/* Writes as much of the queued input as the child, or osso-xterm-sessiond,
+   has room for. Returns whether all of it went. */
+static gboolean
+flush_outgoing(TerminalPty *pty)
+{
+  ssize_t n;
+
+  while (pty->outgoing->len > 0) {
+    /* The reader thread reads the socket blocking, so only this write is not */
+    if (pty->held)
+      n = send(pty->fd, pty->outgoing->data, pty->outgoing->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    else
+      n = write(pty->fd, pty->outgoing->data, pty->outgoing->len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return FALSE;
+      /* The child or osso-xterm-sessiond is gone, which is reported by the
+         child watch or the reader */
+      g_byte_array_set_size(pty->outgoing, 0);
+      break;
+    }
+    g_byte_array_remove_range(pty->outgoing, 0, n);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+outgoing_ready(GIOChannel *channel, GIOCondition condition, TerminalPty *pty)
+{
+  if (!flush_outgoing(pty))
+    return TRUE;
+
+  pty->outgoing_id = 0;
+  return FALSE;
+}
+
+/* Sends what has been added to pty->outgoing, or leaves it to be sent once
+   the child reads */
+static void
+kick_outgoing(TerminalPty *pty)
+{
+  GIOChannel *channel;
+
+  if (pty->outgoing_id || flush_outgoing(pty))
+    return;
+
+  channel = g_io_channel_unix_new(pty->fd);
+  pty->outgoing_id = g_io_add_watch(channel, G_IO_OUT | G_IO_ERR | G_IO_HUP, (GIOFunc)outgoing_ready, pty);
+  g_io_channel_unref(channel);
+}
+
+/* Queues @data for the child. Never blocks: what the child has no room for
+   yet is kept, in order, until it has. */
+void
+terminal_pty_write(TerminalPty *pty, const gchar *data, gssize length)
+{
+  if (length < 0)
+    length = strlen(data);
+
+  if (pty->held)
+    session_frame_append(pty->outgoing, SESSION_FRAME_INPUT, data, length);
+  else
+    g_byte_array_append(pty->outgoing, (const guint8 *)data, length);
+  kick_outgoing(pty);
+}
+
+/* Limits reading to @bytes_per_second, or lifts the limit if 0 */
+void
+terminal_pty_set_read_budget(TerminalPty *pty, gsize bytes_per_second)
+{
+  g_mutex_lock(pty->lock);
+  pty->budget = bytes_per_second;
+  g_mutex_unlock(pty->lock);
+
+  /* The reader may be waiting out the rest of a second */
+  if (pty->thread)
+    while (write(pty->wake[1], "", 1) < 0 && errno == EINTR);
+}
+
+/* Whether reading is paused for having gone over budget */
+gboolean
+terminal_pty_is_throttled(TerminalPty *pty)
+{
+  gboolean throttled;
+
+  g_mutex_lock(pty->lock);
+  throttled = pty->throttled;
+  g_mutex_unlock(pty->lock);
+
+  return throttled;
+}
+
+void
+terminal_pty_set_size(TerminalPty *pty, gint columns, gint rows)
+{
+  struct winsize ws;
+
+  if (columns == pty->columns && rows == pty->rows)
+    return;
+
+  /* Queued behind the input, so it arrives in order */
+  if (pty->held) {
+    gchar *str = g_strdup_printf("%d %d", columns, rows);
+
+    session_frame_append(pty->outgoing, SESSION_FRAME_RESIZE, str, strlen(str));
+    kick_outgoing(pty);
+    pty->columns = columns;
+    pty->rows = rows;
+    g_free(str);
+    return;
+  }
+
+  memset(&ws, 0, sizeof(ws));
+  ws.ws_col = columns;
+  ws.ws_row = rows;
+  if (ioctl(pty->fd, TIOCSWINSZ, &ws) == 0) {
+    pty->columns = columns;
+    pty->rows = rows;
+  }
+}
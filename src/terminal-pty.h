@@ -0,0 +1,44 @@
+#ifndef _TERMINAL_PTY_H_
+#define _TERMINAL_PTY_H_
+
+#include <sys/types.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A child process on a pty of our own, or on one osso-xterm-sessiond holds
+   for us, read by a thread of its own. The
+   thread collects output into a buffer, which the main thread is told about
+   through @output_func, called from an idle callback no more than once for
+   however much output has piled up since the last time, and also when
+   reading is paused or resumed for the read budget. */
+typedef struct _TerminalPty TerminalPty;
+
+typedef void (*TerminalPtyOutputFunc)(TerminalPty *pty, gpointer user_data);
+typedef void (*TerminalPtyExitFunc)(TerminalPty *pty, gint status, gpointer user_data);
+typedef void (*TerminalPtyListFunc)(GArray *sessions, gpointer user_data);
+
+TerminalPty *terminal_pty_spawn(const gchar *command, gchar **argv, gchar **envv,
+                                const gchar *working_directory, gint columns, gint rows,
+                                GError **error);
+TerminalPty *terminal_pty_spawn_held(const gchar *command, gchar **argv, gchar **envv,
+                                     const gchar *working_directory, gint columns, gint rows,
+                                     GError **error);
+TerminalPty *terminal_pty_attach(guint session, gint columns, gint rows, GError **error);
+void         terminal_pty_list_held(TerminalPtyListFunc func, gpointer user_data);
+void         terminal_pty_start_holder(void);
+void         terminal_pty_set_callbacks(TerminalPty *pty, TerminalPtyOutputFunc output_func,
+                                        TerminalPtyExitFunc exit_func, gpointer user_data);
+void         terminal_pty_free(TerminalPty *pty);
+
+GPid         terminal_pty_get_pid(TerminalPty *pty);
+guint        terminal_pty_get_session(TerminalPty *pty);
+GByteArray  *terminal_pty_steal_output(TerminalPty *pty);
+void         terminal_pty_write(TerminalPty *pty, const gchar *data, gssize length);
+void         terminal_pty_set_size(TerminalPty *pty, gint columns, gint rows);
+void         terminal_pty_set_read_budget(TerminalPty *pty, gsize bytes_per_second);
+gboolean     terminal_pty_is_throttled(TerminalPty *pty);
+
+G_END_DECLS
+
+#endif /* !_TERMINAL_PTY_H_ */
@@ -25,12 +25,30 @@
 #include <memory.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <time.h>
 
 #define FONT_SIZE_MAX_ABS_DELTA 8
 
+/* What Vte measures the cell size of a font by */
+#define FONT_MEASURE_CHARACTERS \
+  " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"
+
+/* Number of rows fetched from Vte at a time when a copied selection is
+ * finally handed over to the clipboard */
+#define CLIPBOARD_CHUNK_ROWS 256
+
+/* Most rows the scrollback is grown by to keep a copied selection from being
+ * pushed out of it before it has been fetched */
+#define CLIPBOARD_EXTRA_ROWS 1024
+
+/* What Vte 0.12 keeps per character cell of scrollback, for estimating how
+ * much memory the scrollback takes */
+#define SCROLLBACK_CELL_BYTES 8
+
 #define GETTEXT_PACKAGE "osso-browser-ui"
 #include <glib/gi18n-lib.h>
 /*
@@ -43,6 +61,7 @@
 #include <gdk/gdkx.h>
 #include <gdk/gdkkeysyms.h>
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include "maemo-vte.h"
 
 #include "terminal-gconf.h"
@@ -65,11 +84,33 @@ enum
   {
     CONTEXT_MENU,
     SELECTION_CHANGED,
+    WATCH_TRIGGERED,
     LAST_SIGNAL,
   };
 
 
+/* What terminal_widget_select_all() selected, as of the moment it was copied.
+ * Rows above the screen only change by dropping off the top of the scrollback,
+ * so they are referred to by number and only fetched once somebody pastes, or
+ * once new output starts pushing them out; then a chunk at a time, oldest
+ * first, from an idle. The rows on screen may be rewritten by the child at any
+ * time and are copied right away. Whoever pastes still gets the whole text in
+ * one piece; only fetching it is put off. */
+typedef struct
+{
+  TerminalWidget *widget;     /* NULL once head has been filled in */
+  glong           fetched;    /* First row not yet in head */
+  glong           screen_row;
+  GString        *head;       /* Rows fetched so far, followed by tail after
+                               * the first paste once all are fetched */
+  gchar          *tail;       /* Rows from screen_row on, NULL once in head */
+  guint           fetch_id;   /* Idle fetching the next chunk, or 0 */
+} TerminalClipboardSnapshot;
+
+
 static void     terminal_widget_dispose                       (GObject         *object);
+static void     terminal_widget_release_app_win               (TerminalWidget  *widget);
+static void     terminal_widget_map                           (GtkWidget       *widget);
 static void     terminal_widget_finalize                      (GObject          *object);
 static void     terminal_widget_get_property                  (GObject          *object,
                                                                guint             prop_id,
@@ -93,6 +134,7 @@ static void terminal_widget_update_misc_bell                  (TerminalWidget
 static void terminal_widget_update_misc_cursor_blinks         (TerminalWidget   *widget);
 static void terminal_widget_update_scrolling_lines            (TerminalWidget   *widget);
 static void terminal_widget_update_scrolling_on_output        (TerminalWidget   *widget);
+static void terminal_widget_update_line_times                 (TerminalWidget   *widget);
 static void terminal_widget_update_scrolling_on_keystroke     (TerminalWidget   *widget);
 #if 0
 static void terminal_widget_update_title                      (TerminalWidget   *widget);
@@ -124,19 +166,11 @@ static void     terminal_widget_vte_selection_changed         (VteTerminal    *t
                                                                TerminalWidget *widget);
 static void     terminal_widget_vte_window_title_changed      (VteTerminal    *terminal,
                                                                TerminalWidget *widget);
+static void     terminal_widget_vte_throttled_changed         (TerminalWidget *widget);
+static void     terminal_widget_vte_watch_match               (VteTerminal    *terminal,
+                                                               const gchar    *pattern,
+                                                               TerminalWidget *widget);
 static gboolean terminal_widget_timer_background              (gpointer        user_data);
-static void     terminal_widget_gconf_toolbar               (GConfClient    *client,
-							     guint           conn_id,
-							     GConfEntry     *entry,
-							     TerminalWidget *widget);
-static void     terminal_widget_gconf_toolbar_fs            (GConfClient    *client,
-							     guint           conn_id,
-							     GConfEntry     *entry,
-							     TerminalWidget *widget);
-static void     terminal_widget_gconf_keys               (GConfClient    *client,
-							  guint           conn_id,
-							  GConfEntry     *entry,
-							  TerminalWidget *widget);
 static void     terminal_widget_gconf_reverse                 (GConfClient    *client,
                                                                guint           conn_id,
                                                                GConfEntry     *entry,
@@ -148,9 +182,13 @@ static void     terminal_widget_gconf_font_size               (GConfClient    *c
 static void     terminal_widget_update_font                   (TerminalWidget *widget,
 							       const gchar *name,
                                                                gint size);
-static void     terminal_widget_update_keys          (TerminalWidget *widget,
-						      GSList *keys,
-						      GSList *key_labels);
+static gboolean terminal_widget_prefetch_fonts                (TerminalWidget *widget);
+static void     terminal_widget_apply_scrollback_lines        (TerminalWidget *widget);
+static void     terminal_widget_font_fallback_changed         (const FontFallbackPages *pages,
+                                                               TerminalWidget *widget);
+static void     terminal_widget_clipboard_materialize         (TerminalWidget *widget);
+static void     terminal_widget_clipboard_contents_changed    (VteTerminal    *terminal,
+                                                               TerminalWidget *widget);
 static void     terminal_widget_update_colors		      (TerminalWidget *widget,
 							       const gchar *fg_name,
 							       const gchar *bg_name,
@@ -160,16 +198,10 @@ static void     terminal_widget_timer_background_destroy      (gpointer        u
 #endif
 static void     terminal_widget_emit_context_menu            (TerminalWidget *widget,
 		                                              gpointer user_data);
-static void	terminal_widget_ctrlify_notify	     	     (GObject *src, GParamSpec *pspec, GObject *dst);
-static void	terminal_widget_do_keys			     (TerminalWidget *widget,
-							      const gchar *key_string);
-static void	terminal_widget_do_key_button		     (GObject *button,
-							      TerminalWidget *widget);
-#if 0
-static void terminal_widget_ctrl_clicked (GtkButton    *item,
-					  TerminalWidget *widget);
-#endif
 static GObjectClass *parent_class;
+
+/* Terminals created and not yet finalized */
+static guint n_live_widgets = 0;
 static guint widget_signals[LAST_SIGNAL];
 
 enum
@@ -201,6 +233,7 @@ static void
 terminal_widget_class_init (TerminalWidgetClass *klass)
 {
   GObjectClass *gobject_class;
+  GtkWidgetClass *widget_class;
 
   parent_class = g_type_class_peek_parent (klass);
 
@@ -210,6 +243,9 @@ terminal_widget_class_init (TerminalWidgetClass *klass)
   gobject_class->get_property = terminal_widget_get_property;
   gobject_class->set_property = terminal_widget_set_property;
 
+  widget_class = GTK_WIDGET_CLASS (klass);
+  widget_class->map = terminal_widget_map;
+
   /**
    * TerminalWidget:custom-title:
    **/
@@ -271,117 +307,98 @@ terminal_widget_class_init (TerminalWidgetClass *klass)
                   NULL, NULL,
                   g_cclosure_marshal_VOID__VOID,
                   G_TYPE_NONE, 0);
+
+  /**
+   * TerminalWidget::watch-triggered
+   *
+   * Emitted when one of the watched patterns shows up in the output.
+   **/
+  widget_signals[WATCH_TRIGGERED] =
+    g_signal_new ("watch-triggered",
+                  G_TYPE_FROM_CLASS (gobject_class),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (TerminalWidgetClass, watch_triggered),
+                  NULL, NULL,
+                  g_cclosure_marshal_VOID__STRING,
+                  G_TYPE_NONE, 1, G_TYPE_STRING);
 }
 
-static void
-maybe_set_pan_mode(TerminalWidget *terminal_widget, GParamSpec *pspec, GObject *src)
-{
-  g_assert(G_OBJECT(terminal_widget));
-  GObject *pan_btn_obj = G_OBJECT(terminal_widget->pan_button);
-  GObject *mvte_obj = G_OBJECT(terminal_widget->terminal);
-  GtkAdjustment *adj = vte_terminal_get_adjustment(VTE_TERMINAL(terminal_widget->terminal));
-  gboolean is_active, bt_pan_visible, is_pan_mode,
-           can_pan = (adj->upper - adj->page_size > adj->lower);
-
-/*  g_printerr("%s : "
-                  "upper: %f, lower: %f, page_size: %f, value: %f, step_inc: %f, page_inc: %f\n",
-                  __FUNCTION__, adj->upper, adj->lower, adj->page_size, adj->value, adj->step_increment, adj->page_increment);
-*/
-  g_object_freeze_notify(pan_btn_obj);
-
-  g_object_get(pan_btn_obj, "visible", &bt_pan_visible, "active", &is_active, NULL);
-  g_object_get(mvte_obj, "pan-mode", &is_pan_mode, NULL);
-
-  if (bt_pan_visible != can_pan)
-    g_object_set(pan_btn_obj, "visible", can_pan, NULL);
-
-  if (can_pan) {
-    if (is_pan_mode != !is_active) {
-      g_object_set(mvte_obj, "pan-mode", !is_active, NULL);
-      gtk_widget_show(GTK_WIDGET(pan_btn_obj));
-
-      g_object_set(pan_btn_obj,
-          "icon-widget", g_object_new(GTK_TYPE_IMAGE,
-                                      "visible", TRUE,
-                                      "icon-name", is_active ? "browser_panning_mode_on" : "browser_panning_mode_off",
-                                      "icon-size", HILDON_ICON_SIZE_TOOLBAR,
-                                      NULL),
-          NULL);
-    }
-  }
-  else {
-    if (is_pan_mode)
-      g_object_set(mvte_obj, "pan-mode", FALSE, NULL);
-    gtk_widget_hide(GTK_WIDGET(pan_btn_obj));
+/* Whether to run the child on a pty read by a thread of its own, rather than
+   leave the pty to Vte and the main loop */
+static gboolean
+terminal_widget_use_threaded_pty (TerminalWidget *widget)
+{
+  gboolean threaded;
+  GConfValue *gconf_value;
+
+  threaded = OSSO_XTERM_DEFAULT_THREADED_PTY;
+  gconf_value = gconf_client_get (widget->gconf_client,
+                                  OSSO_XTERM_GCONF_THREADED_PTY,
+                                  NULL);
+  if (gconf_value) {
+    if (gconf_value->type == GCONF_VALUE_BOOL)
+      threaded = gconf_value_get_bool (gconf_value);
+    gconf_value_free (gconf_value);
   }
 
-  g_object_thaw_notify(pan_btn_obj);
+  return threaded && g_thread_supported ();
 }
 
-gboolean
-terminal_widget_need_toolbar(TerminalWidget *widget)
+/* Whether to leave the pty to osso-xterm-sessiond, so the child outlives us */
+static gboolean
+terminal_widget_use_session_holder (TerminalWidget *widget)
 {
-  gboolean toolbar;
+  gboolean holder;
   GConfValue *gconf_value;
-  GError *err = NULL;
 
-  gconf_value = gconf_client_get(widget->gconf_client,
-                                 OSSO_XTERM_GCONF_TOOLBAR,
-                                 &err);
-  if (err != NULL) {
-    g_printerr("Unable to get toolbar setting for non-fullscreen from gconf: %s\n",
-	       err->message);
-    g_clear_error(&err);
-  }
-  toolbar = OSSO_XTERM_DEFAULT_TOOLBAR;
+  holder = OSSO_XTERM_DEFAULT_SESSION_HOLDER;
+  gconf_value = gconf_client_get (widget->gconf_client,
+                                  OSSO_XTERM_GCONF_SESSION_HOLDER,
+                                  NULL);
   if (gconf_value) {
     if (gconf_value->type == GCONF_VALUE_BOOL)
-      toolbar = gconf_value_get_bool(gconf_value);
-    gconf_value_free(gconf_value);
+      holder = gconf_value_get_bool (gconf_value);
+    gconf_value_free (gconf_value);
   }
 
-  return toolbar;
+  return holder && g_thread_supported ();
 }
 
-gboolean
-terminal_widget_need_fullscreen_toolbar(TerminalWidget *widget)
+/* Whether to keep the screen for the next start, which is off unless asked
+ * for since it may hold secrets */
+static gboolean
+terminal_widget_use_last_session (TerminalWidget *widget)
 {
-  gboolean toolbar;
+  gboolean save;
   GConfValue *gconf_value;
-  GError *err = NULL;
 
-  gconf_value = gconf_client_get(widget->gconf_client,
-                                 OSSO_XTERM_GCONF_TOOLBAR_FULLSCREEN,
-                                 &err);
-  if (err != NULL) {
-    g_printerr("Unable to get toolbar setting for fullscreen from gconf: %s\n",
-	       err->message);
-    g_clear_error(&err);
-  }
-  toolbar = OSSO_XTERM_DEFAULT_TOOLBAR_FULLSCREEN;
+  save = OSSO_XTERM_DEFAULT_SAVE_LAST_SESSION;
+  gconf_value = gconf_client_get (widget->gconf_client,
+                                  OSSO_XTERM_GCONF_SAVE_LAST_SESSION,
+                                  NULL);
   if (gconf_value) {
     if (gconf_value->type == GCONF_VALUE_BOOL)
-      toolbar = gconf_value_get_bool(gconf_value);
-    gconf_value_free(gconf_value);
+      save = gconf_value_get_bool (gconf_value);
+    gconf_value_free (gconf_value);
   }
 
-  return toolbar;
+  return save;
 }
 
 static void
 terminal_widget_init (TerminalWidget *widget)
 {
   GError *err = NULL;
-  gboolean toolbar;
-  GSList *keys;
-  GSList *key_labels;
-  GConfValue *gconf_value;
   GtkWidget *hbox;
+  static guint last_id = 0;
 
   widget->dispose_has_run = FALSE;
+  n_live_widgets++;
+  widget->id = ++last_id;
 
   widget->working_directory = g_get_current_dir ();
   widget->custom_title = g_strdup ("");
+  terminal_widget_touch (widget);
 
   widget->gconf_client = gconf_client_get_default ();
 
@@ -394,40 +411,6 @@ terminal_widget_init (TerminalWidget *widget)
     g_clear_error(&err);
   }
 
-  widget->toolbar_conid = gconf_client_notify_add(widget->gconf_client,
-	  OSSO_XTERM_GCONF_TOOLBAR,
-	  (GConfClientNotifyFunc)terminal_widget_gconf_toolbar,
-	  widget,
-	  NULL, &err);
-  widget->toolbar_fs_conid = gconf_client_notify_add(widget->gconf_client,
-	  OSSO_XTERM_GCONF_TOOLBAR_FULLSCREEN,
-	  (GConfClientNotifyFunc)terminal_widget_gconf_toolbar_fs,
-	  widget,
-	  NULL, &err);
-  widget->keys_conid = gconf_client_notify_add(widget->gconf_client,
-	  OSSO_XTERM_GCONF_KEYS,
-	  (GConfClientNotifyFunc)terminal_widget_gconf_keys,
-	  widget,
-	  NULL, &err);
-  widget->key_labels_conid = gconf_client_notify_add(widget->gconf_client,
-	  OSSO_XTERM_GCONF_KEY_LABELS,
-	  (GConfClientNotifyFunc)terminal_widget_gconf_keys,
-	  widget,
-	  NULL, &err);
-  if (err != NULL) {
-    g_clear_error(&err);
-  }
-
-  widget->font_size_conid = gconf_client_notify_add(widget->gconf_client,
-						    OSSO_XTERM_GCONF_FONT_SIZE,
-						    (GConfClientNotifyFunc)terminal_widget_gconf_font_size,
-						    widget,
-						    NULL, &err);
-  if (err != NULL) {
-    g_printerr("font_size notify add failed: %s\n", err->message);
-    g_clear_error(&err);
-  }
-
   widget->font_base_size_conid = gconf_client_notify_add(widget->gconf_client,
 							 OSSO_XTERM_GCONF_FONT_BASE_SIZE,
 							 (GConfClientNotifyFunc)terminal_widget_gconf_font_size,
@@ -476,7 +459,14 @@ terminal_widget_init (TerminalWidget *widget)
     g_clear_error(&err);
   }
 
-  widget->keys_toolbuttons = NULL;
+  widget->shared_watch = NULL;
+  widget->watch_patterns = NULL;
+  widget->scrollback_lines = OSSO_XTERM_DEFAULT_SCROLLBACK;
+  widget->select_all = FALSE;
+  widget->clipboard_snapshot = NULL;
+  widget->font = NULL;
+  widget->font_fallback_watch = font_fallback_add_watch (
+      (FontFallbackFunc) terminal_widget_font_fallback_changed, widget);
 
   widget->terminal = g_object_new(MAEMO_VTE_TYPE, "pan-mode", TRUE, NULL);
   g_object_ref_sink(widget->terminal);
@@ -497,6 +487,8 @@ terminal_widget_init (TerminalWidget *widget)
                     G_CALLBACK (terminal_widget_vte_realize), widget);
   g_signal_connect (G_OBJECT (widget->terminal), "window-title-changed",
                     G_CALLBACK (terminal_widget_vte_window_title_changed), widget);
+  g_signal_connect (G_OBJECT (widget->terminal), "watch-match",
+                    G_CALLBACK (terminal_widget_vte_watch_match), widget);
 
   hbox = g_object_new(HILDON_TYPE_PANNABLE_AREA,
     "drag-inertia", 0.1,
@@ -521,74 +513,11 @@ terminal_widget_init (TerminalWidget *widget)
 
   gtk_widget_grab_focus(widget->terminal);
 
-  widget->tbar = g_object_ref_sink(gtk_toolbar_new());
-  g_object_set(widget->tbar, 
-	       "orientation", GTK_ORIENTATION_HORIZONTAL,
-	       NULL);
-  gtk_widget_show (GTK_WIDGET (widget->tbar));
-
-  widget->cbutton = g_object_ref_sink(gtk_toggle_tool_button_new());
-  gtk_tool_item_set_expand(widget->cbutton, FALSE);
-  gtk_tool_button_set_label(GTK_TOOL_BUTTON(widget->cbutton), "Ctrl");
-  gtk_widget_show(GTK_WIDGET(widget->cbutton));
-
-  widget->pan_button = g_object_new(GTK_TYPE_TOGGLE_TOOL_BUTTON,
-      "icon-widget", g_object_new(GTK_TYPE_IMAGE,
-                                  "visible", TRUE,
-                                  "icon-name", "browser_panning_mode_off",
-                                  "icon-size", HILDON_ICON_SIZE_TOOLBAR,
-                                  NULL),
-      NULL);
-  g_object_ref_sink(widget->pan_button);
-
-  gtk_tool_item_set_expand(widget->pan_button, FALSE);
-  gtk_toolbar_insert(GTK_TOOLBAR(widget->tbar), widget->pan_button, -1);
-
-  g_signal_connect_swapped(G_OBJECT(vte_terminal_get_adjustment(VTE_TERMINAL(widget->terminal))), "changed", (GCallback)maybe_set_pan_mode, widget);
-  g_signal_connect_swapped(G_OBJECT(widget->pan_button), "notify::active", (GCallback)maybe_set_pan_mode, widget);
-  g_signal_connect_swapped(G_OBJECT(widget->pan_button), "notify::visible", (GCallback)maybe_set_pan_mode, widget);
-
-#ifdef DEBUG
-  g_debug("%s - tbar: %p", __FUNCTION__, widget->tbar);
-#endif
-
-  /* Link these two properties */
-  g_signal_connect (G_OBJECT(widget->terminal), "notify::control-mask",
-		    G_CALLBACK(terminal_widget_ctrlify_notify),
-		    widget->cbutton);
-  g_signal_connect (G_OBJECT(widget->cbutton), "notify::active",
-    G_CALLBACK(terminal_widget_ctrlify_notify),
-    widget->terminal);
-
- 
-  /*  g_signal_connect (G_OBJECT(widget->cbutton), "clicked",
-		    G_CALLBACK(terminal_widget_ctrl_clicked),
-		    widget);
-  */
-  gtk_toolbar_insert(GTK_TOOLBAR(widget->tbar),
-		     widget->cbutton,
-		     -1);
-  //  gtk_box_pack_start (GTK_BOX (widget), widget->tbar, FALSE, FALSE, 0);
-
-  /* apply current settings */
-
-  keys = gconf_client_get_list(widget->gconf_client,
-			       OSSO_XTERM_GCONF_KEYS,
-			       GCONF_VALUE_STRING,
-			       &err);
-  key_labels = gconf_client_get_list(widget->gconf_client,
-				     OSSO_XTERM_GCONF_KEY_LABELS,
-				     GCONF_VALUE_STRING,
-				     &err);
-
-  terminal_widget_update_tool_bar(widget, terminal_widget_need_toolbar(widget));
-  terminal_widget_update_keys(TERMINAL_WIDGET(widget), keys, key_labels);
-
-  g_slist_foreach(keys, (GFunc)g_free, NULL);
-  g_slist_foreach(key_labels, (GFunc)g_free, NULL);
-  g_slist_free(keys);
-  g_slist_free(key_labels);
+  g_signal_connect_swapped(G_OBJECT(widget->terminal), "notify::throttled", (GCallback)terminal_widget_vte_throttled_changed, widget);
 
+  /* The zoom is the window's own from here on. The GConf delta, which
+   * osso-xterm no longer writes, only gives the zoom new terminals start at. */
+  widget->zoom = gconf_client_get_int(widget->gconf_client, OSSO_XTERM_GCONF_FONT_SIZE, NULL);
   terminal_widget_gconf_font_size(widget->gconf_client, 0, NULL, widget);
   terminal_widget_gconf_reverse (widget->gconf_client, 0, NULL, widget);
 
@@ -598,6 +527,7 @@ terminal_widget_init (TerminalWidget *widget)
   terminal_widget_update_misc_cursor_blinks (widget);
   terminal_widget_update_scrolling_lines (widget);
   terminal_widget_update_scrolling_on_output (widget);
+  terminal_widget_update_line_times (widget);
   terminal_widget_update_scrolling_on_keystroke (widget);
   terminal_widget_update_word_chars (widget);
 
@@ -641,21 +571,19 @@ terminal_widget_dispose (GObject *object)
     return;
   widget->dispose_has_run = TRUE;
 
-  /* disconnect signals from keys toolbar buttons */
-  for(GSList *iter = widget->keys_toolbuttons;
-      iter != NULL; iter = iter->next){
-    g_signal_handlers_disconnect_by_func(iter->data,
-        terminal_widget_do_key_button, widget);
-    g_object_unref(iter->data);
-    iter->data = NULL;
-  }
-  widget->keys_toolbuttons = g_slist_remove_all(
-      widget->keys_toolbuttons, NULL);
+  /* The clipboard may outlive us, so it gets its text now */
+  terminal_widget_clipboard_materialize (widget);
+
+  font_fallback_remove_watch (widget->font_fallback_watch);
+  widget->font_fallback_watch = 0;
 
-  g_signal_handlers_disconnect_by_func(widget->cbutton,
-      terminal_widget_ctrlify_notify, widget->terminal);
-/*  g_signal_handlers_disconnect_by_func(widget->cbutton,
-		  terminal_widget_ctrlify_notify, widget);*/
+  /* Closing through the child exiting never gets a delete-event */
+  terminal_widget_release_app_win (widget);
+
+  if (widget->font_prefetch_id != 0) {
+    g_source_remove (widget->font_prefetch_id);
+    widget->font_prefetch_id = 0;
+  }
 
   g_signal_handlers_disconnect_by_func(widget->terminal,
     terminal_widget_vte_child_exited, widget);
@@ -674,27 +602,22 @@ terminal_widget_dispose (GObject *object)
   g_signal_handlers_disconnect_by_func(widget->terminal,
     terminal_widget_vte_window_title_changed, widget);
   g_signal_handlers_disconnect_by_func(widget->terminal,
-      terminal_widget_ctrlify_notify, widget->cbutton);
+    terminal_widget_vte_watch_match, widget);
   g_signal_handlers_disconnect_by_func(widget->terminal,
 		  terminal_widget_emit_context_menu, widget);
   g_signal_handlers_disconnect_by_func(widget->terminal,
       terminal_widget_vte_drag_data_received, widget);
-  g_signal_handlers_disconnect_by_func(
-      vte_terminal_get_adjustment(VTE_TERMINAL(widget->terminal)),
-      maybe_set_pan_mode, widget);
-
-  g_signal_handlers_disconnect_by_func(widget->pan_button,
-      maybe_set_pan_mode, widget);
+  g_signal_handlers_disconnect_by_func(widget->terminal,
+      terminal_widget_vte_throttled_changed, widget);
+  terminal_widget_set_frame_scheduler(widget, NULL);
 
-  g_object_unref(widget->pan_button);
-  widget->pan_button = NULL;
-  g_object_unref(widget->cbutton);
-  widget->cbutton = NULL;
   g_object_unref(widget->terminal);
   widget->terminal = NULL;
-  g_object_unref(widget->tbar);
-  widget->tbar = NULL;
 
+  if (widget->shared_watch != NULL) {
+    output_watch_unref(widget->shared_watch);
+    widget->shared_watch = NULL;
+  }
 
   parent_class->dispose (object);
 }
@@ -707,34 +630,30 @@ terminal_widget_finalize (GObject *object)
   g_free (widget->working_directory);
   g_strfreev (widget->custom_command);
   g_free (widget->custom_title);
+  g_strfreev (widget->watch_patterns);
+  if (widget->font != NULL)
+    font_cache_entry_unref (widget->font);
 
-  gconf_client_notify_remove(widget->gconf_client,
-                             widget->toolbar_conid);
-  gconf_client_notify_remove(widget->gconf_client,
-                             widget->toolbar_fs_conid);
-  gconf_client_notify_remove(widget->gconf_client,
-                             widget->keys_conid);
-  gconf_client_notify_remove(widget->gconf_client,
-                             widget->key_labels_conid);
   gconf_client_notify_remove(widget->gconf_client,
                              widget->font_name_conid);
   gconf_client_notify_remove(widget->gconf_client,
                              widget->font_base_size_conid);
-  gconf_client_notify_remove(widget->gconf_client,
-                             widget->font_size_conid);
   gconf_client_notify_remove(widget->gconf_client,
                              widget->fg_conid);
   gconf_client_notify_remove(widget->gconf_client,
                              widget->bg_conid);
   gconf_client_notify_remove(widget->gconf_client,
                              widget->reverse_conid);
+  if (widget->line_times_conid != 0)
+    gconf_client_notify_remove(widget->gconf_client,
+                               widget->line_times_conid);
   gconf_client_remove_dir(widget->gconf_client,
 			  OSSO_XTERM_GCONF_PATH,
 			  NULL);
 
   g_object_unref(G_OBJECT(widget->gconf_client));
 
-  /**/
+  n_live_widgets--;
 
   parent_class->finalize (object);
 }
@@ -931,7 +850,8 @@ terminal_widget_gconf_scrollback_lines(GConfClient    *client,
     lines = gconf_value_get_int(entry->value);
   }
   if (lines <= 0) lines = OSSO_XTERM_DEFAULT_SCROLLBACK;
-  vte_terminal_set_scrollback_lines (VTE_TERMINAL (widget->terminal), lines);
+  widget->scrollback_lines = lines;
+  terminal_widget_apply_scrollback_lines (widget);
 }
 
 static void
@@ -960,6 +880,21 @@ terminal_widget_update_scrolling_lines (TerminalWidget *widget)
 }
 
 
+/* The configured scrollback, plus room for the rows of a pending clipboard
+ * snapshot not fetched yet, up to CLIPBOARD_EXTRA_ROWS */
+static void
+terminal_widget_apply_scrollback_lines (TerminalWidget *widget)
+{
+  TerminalClipboardSnapshot *snapshot = widget->clipboard_snapshot;
+  glong                      lines = widget->scrollback_lines;
+
+  if (snapshot != NULL)
+    lines += MIN (snapshot->screen_row - snapshot->fetched, CLIPBOARD_EXTRA_ROWS);
+
+  vte_terminal_set_scrollback_lines (VTE_TERMINAL (widget->terminal), lines);
+}
+
+
 static void
 terminal_widget_gconf_scrolling_on_output (GConfClient *client, guint conn_id, GConfEntry *entry, TerminalWidget *widget)
 {
@@ -996,6 +931,42 @@ terminal_widget_update_scrolling_on_output (TerminalWidget *widget)
 }
 
 
+static void
+terminal_widget_gconf_line_times (GConfClient *client, guint conn_id, GConfEntry *entry, TerminalWidget *widget)
+{
+  gboolean enable = OSSO_XTERM_DEFAULT_LINE_TIMES;
+  if (entry && entry->value && entry->value->type == GCONF_VALUE_BOOL) {
+    enable = gconf_value_get_bool (entry->value);
+  }
+  maemo_vte_set_line_times (MAEMO_VTE (widget->terminal), enable);
+}
+
+static void
+terminal_widget_update_line_times (TerminalWidget *widget)
+{
+  GConfEntry *entry;
+  GConfValue *value;
+  value = gconf_client_get (widget->gconf_client,
+			    OSSO_XTERM_GCONF_LINE_TIMES, NULL);
+  entry = gconf_entry_new_nocopy (g_strdup(OSSO_XTERM_GCONF_LINE_TIMES),
+				  value);
+
+  if (widget->line_times_conid == 0) {
+    widget->line_times_conid = gconf_client_notify_add(
+						       widget->gconf_client,
+						       OSSO_XTERM_GCONF_LINE_TIMES,
+						       (GConfClientNotifyFunc)terminal_widget_gconf_line_times,
+						       widget,
+						       NULL, NULL);
+  }
+  terminal_widget_gconf_line_times (widget->gconf_client,
+				    widget->line_times_conid,
+				    entry,
+				    widget);
+  gconf_entry_unref(entry);
+}
+
+
 static void
 terminal_widget_update_scrolling_on_keystroke (TerminalWidget *widget)
 {
@@ -1200,6 +1171,7 @@ terminal_widget_vte_selection_changed (VteTerminal    *terminal,
   g_return_if_fail (VTE_IS_TERMINAL (terminal));
   g_return_if_fail (TERMINAL_IS_WIDGET (widget));
 
+  widget->select_all = FALSE;
   g_signal_emit (G_OBJECT (widget), widget_signals[SELECTION_CHANGED], 0);
 }
 
@@ -1215,53 +1187,30 @@ terminal_widget_vte_window_title_changed (VteTerminal    *terminal,
 }
 
 
-static gboolean
-terminal_widget_timer_background (gpointer user_data)
+/* The title says when output is being held back */
+static void
+terminal_widget_vte_throttled_changed (TerminalWidget *widget)
 {
-  return FALSE;
+  g_object_notify (G_OBJECT (widget), "title");
 }
 
 
-void
-terminal_widget_update_tool_bar (TerminalWidget *widget, gboolean show)
+static void
+terminal_widget_vte_watch_match (VteTerminal    *terminal,
+                                 const gchar    *pattern,
+                                 TerminalWidget *widget)
 {
-  if (show)
-    gtk_widget_show (widget->tbar);
-  else
-    gtk_widget_hide (widget->tbar);
+  g_signal_emit (G_OBJECT (widget), widget_signals[WATCH_TRIGGERED], 0, pattern);
 }
 
-static void
-terminal_widget_update_keys (TerminalWidget *widget, GSList *keys, GSList *key_labels)
-{
-  g_slist_foreach(widget->keys_toolbuttons, (GFunc)gtk_widget_destroy, NULL);
-  g_slist_foreach(widget->keys_toolbuttons, (GFunc)g_object_unref, NULL);
-  g_slist_free(widget->keys_toolbuttons);
-  widget->keys_toolbuttons = NULL;
 
-  while (keys && key_labels) {
-#ifdef DEBUG
-    g_debug ("%s - add %s",__FUNCTION__, (gchar *)key_labels->data);
-#endif
-    GtkToolItem *button = gtk_tool_button_new(NULL, key_labels->data);
-    g_object_set_data_full(G_OBJECT(button), "keys", g_strdup(keys->data), g_free);
-
-    gtk_widget_show(GTK_WIDGET(button));
-    gtk_toolbar_insert(GTK_TOOLBAR(widget->tbar), 
-		       button, -1);
-
-    g_signal_connect(G_OBJECT(button),
-		     "clicked",
-		     G_CALLBACK(terminal_widget_do_key_button),
-		     widget);
-    widget->keys_toolbuttons = g_slist_prepend(
-        widget->keys_toolbuttons, g_object_ref(button));
-
-    keys = g_slist_next(keys);
-    key_labels = g_slist_next(key_labels);
-  }
+static gboolean
+terminal_widget_timer_background (gpointer user_data)
+{
+  return FALSE;
 }
 
+
 static void
 terminal_widget_update_colors (TerminalWidget *widget, const gchar *fg_name, const gchar *bg_name, gboolean reverse)
 {
@@ -1279,67 +1228,32 @@ terminal_widget_update_colors (TerminalWidget *widget, const gchar *fg_name, con
 static void
 terminal_widget_update_font (TerminalWidget *widget, const gchar *name, gint size)
 {
-  gchar *font_name;
-  font_name = g_strdup_printf("%s %d", name, size);
-  vte_terminal_set_font_from_string (VTE_TERMINAL (widget->terminal), font_name);
-  g_free(font_name);
-}
+  FontCacheEntry *font;
 
+  /* The fallbacks found so far are for the font in use */
+  font_fallback_set_primary (name);
 
-static void
-terminal_widget_gconf_toolbar(GConfClient    *client,
-			      guint           conn_id,
-			      GConfEntry     *entry,
-			      TerminalWidget *widget) {
-  GConfValue *value;
-  gboolean toolbar;
-
-  value = gconf_entry_get_value(entry);
-  toolbar = gconf_value_get_bool(value);
-  terminal_widget_update_tool_bar(widget, toolbar);
-}
+  /* Other terminals using the same font keep it loaded for us */
+  font = font_cache_get (widget->terminal, name, size);
+  if (font == widget->font)
+    {
+      /* Setting it again would only make Vte reflow */
+      font_cache_entry_unref (font);
+      return;
+    }
+  vte_terminal_set_font (VTE_TERMINAL (widget->terminal),
+                         font_cache_entry_get_description (font));
 
-static void
-terminal_widget_gconf_toolbar_fs(GConfClient    *client,
-			      guint           conn_id,
-			      GConfEntry     *entry,
-			      TerminalWidget *widget) {
-  GConfValue *value;
-  gboolean toolbar;
+  if (widget->font != NULL)
+    font_cache_entry_unref (widget->font);
+  widget->font = font;
 
-  value = gconf_entry_get_value(entry);
-  toolbar = gconf_value_get_bool(value);
-  terminal_widget_update_tool_bar(widget, toolbar);
+  if (widget->font_prefetch_id == 0)
+    widget->font_prefetch_id = g_idle_add_full (G_PRIORITY_LOW,
+                                                (GSourceFunc)terminal_widget_prefetch_fonts,
+                                                widget, NULL);
 }
 
-static void
-terminal_widget_gconf_keys(GConfClient    *client,
-			   guint           conn_id,
-			   GConfEntry     *entry,
-			   TerminalWidget *widget)
-{
-  GSList *keys;
-  GSList *key_labels;
-
-  (void)entry;
-  (void)conn_id;
-
-  key_labels = gconf_client_get_list(client,
-				     OSSO_XTERM_GCONF_KEY_LABELS,
-				     GCONF_VALUE_STRING,
-				     NULL);
-  keys = gconf_client_get_list(client,
-			       OSSO_XTERM_GCONF_KEYS,
-			       GCONF_VALUE_STRING,
-			       NULL);
-
-  terminal_widget_update_keys(widget, keys, key_labels);
-
-  g_slist_foreach(keys, (GFunc)g_free, NULL);
-  g_slist_foreach(key_labels, (GFunc)g_free, NULL);
-  g_slist_free(keys);
-  g_slist_free(key_labels);
-}
 
 static void
 terminal_widget_gconf_reverse(GConfClient    *client,
@@ -1379,17 +1293,13 @@ terminal_widget_gconf_reverse(GConfClient    *client,
 }
 
 
-static void
-terminal_widget_gconf_font_size(GConfClient    *client,
-                                guint           conn_id,
-                                GConfEntry     *entry,
-                                TerminalWidget *widget) {
+/* The configured font name, and its size once zoomed by @zoom */
+static gchar *
+terminal_widget_get_font(GConfClient *client, gint zoom, gint *size)
+{
   gchar *font_name;
   gint font_size;
 
-  (void)conn_id;
-  (void)entry;
-
   font_name = gconf_client_get_string(client, OSSO_XTERM_GCONF_FONT_NAME, NULL);
   if (!font_name) {
     font_name = g_strdup(OSSO_XTERM_DEFAULT_FONT_NAME);
@@ -1398,12 +1308,78 @@ terminal_widget_gconf_font_size(GConfClient    *client,
   if (!font_size) {
     font_size = OSSO_XTERM_DEFAULT_FONT_BASE_SIZE;
   }
-  font_size += gconf_client_get_int(client, OSSO_XTERM_GCONF_FONT_SIZE, NULL);
 
+  *size = font_size + zoom;
+  return font_name;
+}
+
+static void
+terminal_widget_gconf_font_size(GConfClient    *client,
+                                guint           conn_id,
+                                GConfEntry     *entry,
+                                TerminalWidget *widget) {
+  gchar *font_name;
+  gint font_size;
+
+  (void)conn_id;
+  (void)entry;
+
+  if (terminal_widget_is_hibernating (widget))
+    return;
+
+  font_name = terminal_widget_get_font(client, widget->zoom, &font_size);
   terminal_widget_update_font(widget, font_name, font_size);
   g_free(font_name);
 }
 
+/* Loads the sizes a zoom step away, leaving them with the font cache, so
+ * zooming by the hardware keys finds them loaded rather than waiting for
+ * Pango to match and open them. They are measured the way Vte measures
+ * them too, which leaves the extents of those glyphs cached in the fonts
+ * for when Vte does. */
+static gboolean
+terminal_widget_prefetch_fonts (TerminalWidget *widget)
+{
+  gint step, zoom, font_size;
+  gchar *font_name;
+  FontCacheEntry *font;
+  PangoLayout *layout;
+
+  widget->font_prefetch_id = 0;
+
+  for (step = -TERMINAL_WIDGET_ZOOM_STEP ; step <= TERMINAL_WIDGET_ZOOM_STEP ; step += 2 * TERMINAL_WIDGET_ZOOM_STEP) {
+    zoom = widget->zoom + step;
+    if (ABS(zoom) > FONT_SIZE_MAX_ABS_DELTA)
+      continue;
+
+    font_name = terminal_widget_get_font(widget->gconf_client, zoom, &font_size);
+    if (font_size > 0) {
+      font = font_cache_get (widget->terminal, font_name, font_size);
+      layout = gtk_widget_create_pango_layout (widget->terminal, FONT_MEASURE_CHARACTERS);
+      pango_layout_set_font_description (layout, font_cache_entry_get_description (font));
+      pango_layout_get_pixel_extents (layout, NULL, NULL);
+      g_object_unref (layout);
+      font_cache_entry_unref (font);
+    }
+    g_free(font_name);
+  }
+
+  return FALSE;
+}
+
+/* Fonts for more of the output have been found. Only a terminal showing
+ * text from those pages takes them on now, the rest with their next font
+ * change. */
+static void
+terminal_widget_font_fallback_changed (const FontFallbackPages *pages,
+                                       TerminalWidget          *widget)
+{
+  if (!font_fallback_pages_overlap (pages, maemo_vte_get_shown_pages (MAEMO_VTE (widget->terminal))))
+    return;
+
+  terminal_widget_gconf_font_size (widget->gconf_client, 0, NULL, widget);
+}
+
 #if 0
 static void
 terminal_widget_timer_background_destroy (gpointer user_data)
@@ -1424,33 +1400,128 @@ terminal_widget_new ()
   return g_object_new(TERMINAL_TYPE_WIDGET, NULL);
 }
 
-static gboolean
-terminal_widget_window_delete_event(
-    HildonWindow *window, GdkEvent *event, TerminalWidget *widget)
+static gboolean terminal_widget_window_delete_event (HildonWindow   *window,
+                                                     GdkEvent       *event,
+                                                     TerminalWidget *widget);
+
+/* Gives back the window set with terminal_widget_set_app_win(). The window
+ * holds on to us, so keeping it any longer would keep both alive. */
+static void
+terminal_widget_release_app_win (TerminalWidget *widget)
 {
-  hildon_window_remove_toolbar (HILDON_WINDOW (widget->app),
-      GTK_TOOLBAR (widget->tbar));
+  if (widget->app == NULL)
+    return;
+
   g_signal_handlers_disconnect_by_func(widget->app,
         terminal_widget_window_delete_event, widget);
   g_object_unref(widget->app);
+  widget->app = NULL;
+}
+
+static gboolean
+terminal_widget_window_delete_event(
+    HildonWindow *window, GdkEvent *event, TerminalWidget *widget)
+{
+  terminal_widget_release_app_win (widget);
 
   return FALSE;
 }
 
+/* Makes @widget the terminal in use in @window, or in no window if @window
+ * is %NULL */
 void
 terminal_widget_set_app_win (TerminalWidget *widget, HildonWindow *window)
 {
+  terminal_widget_release_app_win (widget);
+  if (window == NULL)
+    return;
   widget->app = g_object_ref(window);
   g_signal_connect (G_OBJECT (widget->app), "delete-event",
                     G_CALLBACK (terminal_widget_window_delete_event), widget);
+}
 
-#ifdef DEBUG
-  g_debug("%s - tbar: %p", __FUNCTION__, widget->tbar);
-#endif
+/* The first shell of the process shows the text of where the last one left
+ * off, without its colours, until it has something to say itself. Nothing
+ * is on screen sooner than that. */
+static void
+terminal_widget_show_last_session (TerminalWidget *widget)
+{
+  static gboolean shown = FALSE;
+  gchar          *file_name;
+
+  if (shown || widget->custom_command != NULL || widget->session != 0)
+    return;
+  shown = TRUE;
+
+  if (!terminal_widget_use_last_session (widget))
+    return;
+
+  file_name = screen_snapshot_last_session_file_name ();
+  maemo_vte_show_preview (MAEMO_VTE (widget->terminal),
+                          screen_snapshot_load (file_name));
+  g_free (file_name);
+}
+
+
+/**
+ * terminal_widget_save_last_session:
+ * @widget : A #TerminalWidget.
+ *
+ * Keeps what @widget shows for the next start to show while its shell is
+ * starting up, if the user has asked for that. Otherwise, removes what an
+ * earlier start may have kept.
+ **/
+void
+terminal_widget_save_last_session (TerminalWidget *widget)
+{
+  ScreenSnapshot *snapshot;
+  gchar          *text;
+  gchar          *file_name;
+
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  if (widget->custom_command != NULL || widget->terminal == NULL)
+    return;
+
+  if (!terminal_widget_use_last_session (widget))
+    {
+      file_name = screen_snapshot_last_session_file_name ();
+      g_unlink (file_name);
+      g_free (file_name);
+      return;
+    }
+
+  text = terminal_widget_get_visible_text (widget);
+  snapshot = screen_snapshot_new (VTE_TERMINAL (widget->terminal)->column_count,
+                                  VTE_TERMINAL (widget->terminal)->row_count,
+                                  text);
+  file_name = screen_snapshot_last_session_file_name ();
+  screen_snapshot_save (snapshot, file_name);
+
+  g_free (file_name);
+  screen_snapshot_free (snapshot);
+  g_free (text);
+}
+
+
+/**
+ * terminal_widget_set_session:
+ * @widget  : A #TerminalWidget.
+ * @session : A session held by osso-xterm-sessiond.
+ *
+ * Makes terminal_widget_launch_child() take @session over instead of
+ * starting a new child.
+ **/
+void
+terminal_widget_set_session (TerminalWidget *widget,
+                             guint           session)
+{
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
 
-  hildon_window_add_toolbar (HILDON_WINDOW (widget->app), GTK_TOOLBAR (widget->tbar));
+  widget->session = session;
 }
 
+
 /**
  * terminal_widget_launch_child:
  * @widget  : A #TerminalWidget.
@@ -1476,23 +1547,109 @@ terminal_widget_launch_child (TerminalWidget *widget)
 
   env = terminal_widget_get_child_environment (widget);
 
-  widget->pid = vte_terminal_fork_command (VTE_TERMINAL (widget->terminal),
-                                           command, argv, env,
-                                           widget->working_directory,
-                                           TRUE, TRUE, TRUE);
+  if (widget->session != 0)
+    {
+      TerminalPty *pty;
+
+      pty = terminal_pty_attach (widget->session,
+                                 VTE_TERMINAL (widget->terminal)->column_count,
+                                 VTE_TERMINAL (widget->terminal)->row_count,
+                                 &error);
+      if (pty != NULL)
+        {
+          widget->pid = 0;
+          maemo_vte_set_pty (MAEMO_VTE (widget->terminal), pty);
+        }
+      else
+        {
+          g_warning ("Unable to take session %u over: %s", widget->session, error->message);
+          g_clear_error (&error);
+          widget->pid = -1;
+        }
+    }
+  else if (terminal_widget_use_threaded_pty (widget))
+    {
+      TerminalPty *pty = NULL;
+      gchar      **pty_env;
+      guint        n;
+
+      /* Vte sets TERM for the children it forks itself */
+      n = g_strv_length (env);
+      pty_env = g_new (gchar *, n + 2);
+      memcpy (pty_env, env, n * sizeof (gchar *));
+      pty_env[n] = g_strdup_printf ("TERM=%s", vte_terminal_get_emulation (VTE_TERMINAL (widget->terminal)));
+      pty_env[n + 1] = NULL;
+
+      /* Without osso-xterm-sessiond, the child is still better off with us.
+       * Only our own reader can read what it sends, so holding needs
+       * threaded_pty as well. */
+      if (terminal_widget_use_session_holder (widget))
+        {
+          pty = terminal_pty_spawn_held (command, argv, pty_env,
+                                         widget->working_directory,
+                                         VTE_TERMINAL (widget->terminal)->column_count,
+                                         VTE_TERMINAL (widget->terminal)->row_count,
+                                         &error);
+          if (pty == NULL)
+            {
+              g_warning ("Unable to leave the child to osso-xterm-sessiond: %s", error->message);
+              g_clear_error (&error);
+            }
+        }
+      if (pty == NULL)
+        pty = terminal_pty_spawn (command, argv, pty_env,
+                                  widget->working_directory,
+                                  VTE_TERMINAL (widget->terminal)->column_count,
+                                  VTE_TERMINAL (widget->terminal)->row_count,
+                                  &error);
+      g_free (pty_env[n]);
+      g_free (pty_env);
+
+      if (pty != NULL)
+        {
+          /* A session just started has no screen of its own to show yet,
+           * unlike one taken over above */
+          widget->pid = 0;
+          maemo_vte_set_pty (MAEMO_VTE (widget->terminal), pty);
+          terminal_widget_show_last_session (widget);
+        }
+      else
+        {
+          g_warning ("Unable to start the child on a pty: %s", error->message);
+          g_clear_error (&error);
+          widget->pid = -1;
+        }
+    }
+  else
+    widget->pid = vte_terminal_fork_command (VTE_TERMINAL (widget->terminal),
+                                             command, argv, env,
+                                             widget->working_directory,
+                                             TRUE, TRUE, TRUE);
 
   g_strfreev (argv);
   g_strfreev (env);
   g_free (command);
 
-  return (widget->pid > 0);
+  return (widget->pid >= 0);
 }
 
 
 /**
- * terminal_widget_set_custom_command:
- * @widget  : A #TerminalWidget.
- * @command :
+ * terminal_widget_get_n_live:
+ *
+ * Return value : The number of terminals created and not yet finalized.
+ **/
+guint
+terminal_widget_get_n_live (void)
+{
+  return n_live_widgets;
+}
+
+
+/**
+ * terminal_widget_set_custom_command:
+ * @widget  : A #TerminalWidget.
+ * @command :
  **/
 void
 terminal_widget_set_custom_command (TerminalWidget *widget,
@@ -1545,8 +1702,11 @@ terminal_widget_get_size (TerminalWidget *widget,
 /**
  * terminal_widget_force_resize_window:
  *
- * I don't like this way, but its required to work-around a Gtk+
- * bug (maybe also caused by a Vte bug, not sure).
+ * Sizes @window to fit @force_columns by @force_rows of the terminal, or its
+ * current column or row count where negative. Once @window has been laid out,
+ * what it adds around the terminal is taken from the allocations, and the
+ * terminal's own size from its padding and cell size, so no size request has
+ * to be run over the whole window.
  **/
 void
 terminal_widget_force_resize_window (TerminalWidget *widget,
@@ -1554,6 +1714,7 @@ terminal_widget_force_resize_window (TerminalWidget *widget,
                                      gint            force_columns,
                                      gint            force_rows)
 {
+  VteTerminal   *vte = VTE_TERMINAL (widget->terminal);
   GtkRequisition terminal_requisition;
   GtkRequisition window_requisition;
   gint           width;
@@ -1563,27 +1724,37 @@ terminal_widget_force_resize_window (TerminalWidget *widget,
   gint           xpad;
   gint           ypad;
 
-  gtk_widget_set_size_request (widget->terminal, 2000, 2000);
-  gtk_widget_size_request (GTK_WIDGET (window), &window_requisition);
-  gtk_widget_size_request (widget->terminal, &terminal_requisition);
+  vte_terminal_get_padding (vte, &xpad, &ypad);
 
-  width = window_requisition.width - terminal_requisition.width;
-  height = window_requisition.height - terminal_requisition.height;
+  if (GTK_WIDGET_MAPPED (window) && GTK_WIDGET_MAPPED (widget->terminal))
+    {
+      /* What the terminal has beyond its whole cells belongs to the window */
+      width = GTK_WIDGET (window)->allocation.width - xpad
+            - vte->char_width * vte->column_count;
+      height = GTK_WIDGET (window)->allocation.height - ypad
+             - vte->char_height * vte->row_count;
+    }
+  else
+    {
+      gtk_widget_size_request (GTK_WIDGET (window), &window_requisition);
+      gtk_widget_size_request (widget->terminal, &terminal_requisition);
+
+      width = window_requisition.width - terminal_requisition.width;
+      height = window_requisition.height - terminal_requisition.height;
+    }
 
   if (force_columns < 0)
-    columns = VTE_TERMINAL (widget->terminal)->column_count;
+    columns = vte->column_count;
   else
     columns = force_columns;
 
   if (force_rows < 0)
-    rows = VTE_TERMINAL (widget->terminal)->row_count;
+    rows = vte->row_count;
   else
     rows = force_rows;
 
-  vte_terminal_get_padding (VTE_TERMINAL (widget->terminal), &xpad, &ypad);
-
-  width += xpad + VTE_TERMINAL (widget->terminal)->char_width * columns;
-  height += ypad + VTE_TERMINAL (widget->terminal)->char_height * rows;
+  width += xpad + vte->char_width * columns;
+  height += ypad + vte->char_height * rows;
 
   if (width < 0 || height < 0) {
     g_printerr("Invalid values: width=%d, height=%d, rows=%d, cols=%d\n",
@@ -1641,23 +1812,275 @@ terminal_widget_get_title (TerminalWidget *widget)
 {
   const gchar  *window_title;
   gchar *title;
+  gchar *throttled_title;
+  gboolean throttled = FALSE;
 
   g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), NULL);
 
   if (G_UNLIKELY (*widget->custom_title != '\0'))
-    return g_strdup (widget->custom_title);
+    title = g_strdup (widget->custom_title);
+  else
+    {
+      window_title = vte_terminal_get_window_title (VTE_TERMINAL (widget->terminal));
 
-  window_title = vte_terminal_get_window_title (VTE_TERMINAL (widget->terminal));
+      if (window_title != NULL)
+        title = g_strdup (window_title);
+      else
+        title = g_strdup (_("Untitled"));
+    }
 
-  if (window_title != NULL)
-    title = g_strdup (window_title);
-  else
-    title = g_strdup (_("Untitled"));
+  g_object_get (G_OBJECT (widget->terminal), "throttled", &throttled, NULL);
+  if (throttled)
+    {
+      throttled_title = g_strdup_printf ("%s %s", title, _("(throttled)"));
+      g_free (title);
+      title = throttled_title;
+    }
 
   return title;
 }
 
 
+/**
+ * terminal_widget_get_id:
+ * @widget      : A #TerminalWidget.
+ *
+ * Return value : A number identifying @widget for the lifetime of the process.
+ **/
+guint
+terminal_widget_get_id (TerminalWidget *widget)
+{
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), 0);
+  return widget->id;
+}
+
+
+/**
+ * terminal_widget_get_row_range:
+ * @widget    : A #TerminalWidget.
+ * @first_row : Location to store the oldest row still in the scrollback.
+ * @end_row   : Location to store the row past the last one on screen.
+ *
+ * Rows are numbered the way Vte numbers them, i.e. they keep their number
+ * while the scrollback grows, until they drop off its top. A hibernating
+ * terminal is not woken up for it; its rows are numbered the way they will
+ * be once it is.
+ **/
+void
+terminal_widget_get_row_range (TerminalWidget *widget,
+                               glong          *first_row,
+                               glong          *end_row)
+{
+  GtkAdjustment  *adj;
+  ScreenSnapshot *hibernated;
+
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  hibernated = maemo_vte_get_hibernated (MAEMO_VTE (widget->terminal), NULL, NULL);
+  if (hibernated != NULL)
+    {
+      *first_row = 0;
+      *end_row = MAX ((glong) screen_snapshot_get_n_lines (hibernated),
+                      VTE_TERMINAL (widget->terminal)->row_count);
+      return;
+    }
+
+  adj = vte_terminal_get_adjustment (VTE_TERMINAL (widget->terminal));
+  *first_row = (glong) adj->lower;
+  *end_row = (glong) adj->upper;
+}
+
+
+static gboolean
+terminal_widget_always_selected (VteTerminal *terminal,
+                                 glong        column,
+                                 glong        row,
+                                 gpointer     user_data)
+{
+  return TRUE;
+}
+
+
+/**
+ * terminal_widget_get_text_range:
+ * @widget    : A #TerminalWidget.
+ * @first_row : The first row to return, as numbered by
+ *              terminal_widget_get_row_range().
+ * @n_rows    : The number of rows to return.
+ *
+ * The range is clipped to the rows actually present in the terminal.
+ *
+ * Return value : The text of the rows, one line each, or %NULL if none of the
+ *                rows are present. Free with g_free().
+ **/
+gchar*
+terminal_widget_get_text_range (TerminalWidget *widget,
+                                glong           first_row,
+                                glong           n_rows)
+{
+  VteTerminal    *term;
+  ScreenSnapshot *hibernated;
+  glong           lower;
+  glong           upper;
+
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), NULL);
+
+  term = VTE_TERMINAL (widget->terminal);
+  terminal_widget_get_row_range (widget, &lower, &upper);
+
+  if (first_row < lower)
+    {
+      n_rows -= lower - first_row;
+      first_row = lower;
+    }
+  if (first_row + n_rows > upper)
+    n_rows = upper - first_row;
+  if (n_rows <= 0)
+    return NULL;
+
+  hibernated = maemo_vte_get_hibernated (MAEMO_VTE (widget->terminal), NULL, NULL);
+  if (hibernated != NULL)
+    return screen_snapshot_get_text (hibernated, first_row, n_rows);
+
+  return vte_terminal_get_text_range (term,
+                                      first_row, 0,
+                                      first_row + n_rows - 1, term->column_count - 1,
+                                      terminal_widget_always_selected, NULL, NULL);
+}
+
+
+/**
+ * terminal_widget_get_visible_text:
+ * @widget      : A #TerminalWidget.
+ *
+ * Return value : The text currently shown on the screen. Free with g_free().
+ **/
+gchar*
+terminal_widget_get_visible_text (TerminalWidget *widget)
+{
+  GtkAdjustment *adj;
+  glong          first_row;
+  glong          end_row;
+
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), NULL);
+
+  /* A hibernating terminal wakes up scrolled to the bottom */
+  if (terminal_widget_is_hibernating (widget))
+    {
+      terminal_widget_get_row_range (widget, &first_row, &end_row);
+      first_row = end_row - VTE_TERMINAL (widget->terminal)->row_count;
+    }
+  else
+    {
+      adj = vte_terminal_get_adjustment (VTE_TERMINAL (widget->terminal));
+      first_row = (glong) adj->value;
+    }
+
+  return terminal_widget_get_text_range (widget, first_row,
+                                         VTE_TERMINAL (widget->terminal)->row_count);
+}
+
+
+/**
+ * terminal_widget_get_cursor_position:
+ * @widget : A #TerminalWidget.
+ * @column : Location to store the cursor column.
+ * @row    : Location to store the cursor row, numbered like
+ *           terminal_widget_get_row_range() does.
+ **/
+void
+terminal_widget_get_cursor_position (TerminalWidget *widget,
+                                     glong          *column,
+                                     glong          *row)
+{
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+  if (maemo_vte_get_hibernated (MAEMO_VTE (widget->terminal), column, row) == NULL)
+    vte_terminal_get_cursor_position (VTE_TERMINAL (widget->terminal), column, row);
+}
+
+
+/* The child's pid, or 0 while osso-xterm-sessiond has yet to say what it
+ * is. Vte's own children are the only ones the pty does not know. */
+static GPid
+terminal_widget_get_pid (TerminalWidget *widget)
+{
+  TerminalPty *pty = maemo_vte_get_pty (MAEMO_VTE (widget->terminal));
+
+  return (pty != NULL) ? terminal_pty_get_pid (pty) : widget->pid;
+}
+
+/* User and system time of @pid and the children it has waited for, in
+ * milliseconds */
+static guint64
+terminal_widget_get_cpu_time (GPid pid)
+{
+  gchar         *file;
+  gchar         *contents = NULL;
+  gchar         *p;
+  unsigned long  utime = 0, stime = 0;
+  long           cutime = 0, cstime = 0;
+
+  if (pid <= 0)
+    return 0;
+
+  file = g_strdup_printf ("/proc/%d/stat", pid);
+  if (g_file_get_contents (file, &contents, NULL, NULL))
+    {
+      /* The command name may hold anything, so fields are counted from the
+       * end of it */
+      p = strrchr (contents, ')');
+      if (p == NULL
+          || sscanf (p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+                     &utime, &stime, &cutime, &cstime) != 4)
+        utime = stime = cutime = cstime = 0;
+      g_free (contents);
+    }
+  g_free (file);
+
+  /* An unsigned long of ticks times 1000 overflows on 32-bit targets */
+  return ((guint64) utime + stime + cutime + cstime) * 1000 / sysconf (_SC_CLK_TCK);
+}
+
+
+/**
+ * terminal_widget_get_stats:
+ * @widget : A #TerminalWidget.
+ * @stats  : Location to store what @widget has cost so far.
+ *
+ * The font cache is shared by all terminals, so its figures are for the
+ * whole process, and the scrollback size is an estimate.
+ **/
+void
+terminal_widget_get_stats (TerminalWidget      *widget,
+                           TerminalWidgetStats *stats)
+{
+  MaemoVteStats  vte_stats;
+  FontCacheStats font_stats;
+  glong          first_row;
+  glong          end_row;
+
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  maemo_vte_get_stats (MAEMO_VTE (widget->terminal), &vte_stats);
+  font_cache_get_stats (&font_stats);
+  terminal_widget_get_row_range (widget, &first_row, &end_row);
+
+  stats->bytes_read = vte_stats.bytes_read;
+  stats->bytes_written = vte_stats.bytes_written;
+  stats->frames = vte_stats.frames;
+  stats->avg_frame_time = vte_stats.frames ? vte_stats.frame_time / vte_stats.frames : 0;
+  stats->max_frame_time = vte_stats.max_frame_time;
+  stats->scrollback_lines = MAX (end_row - first_row - VTE_TERMINAL (widget->terminal)->row_count, 0);
+  stats->scrollback_bytes = stats->scrollback_lines
+                          * VTE_TERMINAL (widget->terminal)->column_count
+                          * SCROLLBACK_CELL_BYTES;
+  stats->font_cache_hits = font_stats.hits;
+  stats->font_cache_misses = font_stats.misses;
+  stats->pid = terminal_widget_get_pid (widget);
+  stats->cpu_time = terminal_widget_get_cpu_time (stats->pid);
+}
+
+
 /**
  * terminal_widget_get_working_directory:
  * @widget      : A #TerminalWidget.
@@ -1669,6 +2092,7 @@ terminal_widget_get_title (TerminalWidget *widget)
 const gchar*
 terminal_widget_get_working_directory (TerminalWidget *widget)
 {
+  GPid   pid;
   gchar  buffer[4096 + 1];
   gchar *file;
   gchar *cwd;
@@ -1676,9 +2100,10 @@ terminal_widget_get_working_directory (TerminalWidget *widget)
 
   g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), NULL);
 
-  if (widget->pid >= 0)
+  pid = terminal_widget_get_pid (widget);
+  if (pid > 0)
     {
-      file = g_strdup_printf ("/proc/%d/cwd", widget->pid);
+      file = g_strdup_printf ("/proc/%d/cwd", pid);
       length = readlink (file, buffer, sizeof (buffer));
 
       if (length > 0 && *buffer == '/')
@@ -1740,7 +2165,249 @@ gboolean
 terminal_widget_has_selection (TerminalWidget *widget)
 {
   g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), FALSE);
-  return vte_terminal_get_has_selection (VTE_TERMINAL (widget->terminal));
+  return widget->select_all
+      || vte_terminal_get_has_selection (VTE_TERMINAL (widget->terminal));
+}
+
+
+/* Appends rows @row to @end, or what is left of them, to @str */
+static void
+terminal_widget_clipboard_fetch (TerminalClipboardSnapshot *snapshot,
+                                 GString                   *str,
+                                 glong                      row,
+                                 glong                      end)
+{
+  gchar *chunk;
+  glong  lower;
+  glong  upper;
+
+  terminal_widget_get_row_range (snapshot->widget, &lower, &upper);
+  for (row = MAX (row, lower); row < end; row += CLIPBOARD_CHUNK_ROWS)
+    {
+      chunk = terminal_widget_get_text_range (snapshot->widget, row,
+                                              MIN (CLIPBOARD_CHUNK_ROWS, end - row));
+      if (chunk != NULL)
+        {
+          g_string_append (str, chunk);
+          g_free (chunk);
+        }
+    }
+}
+
+/* Copies the oldest rows not yet fetched out of the terminal. Once there are
+ * none left, the snapshot no longer refers to the terminal.
+ *
+ * Return value : %TRUE if there are rows left to fetch. */
+static gboolean
+terminal_widget_clipboard_fetch_chunk (TerminalWidget *widget)
+{
+  TerminalClipboardSnapshot *snapshot = widget->clipboard_snapshot;
+  glong                      end;
+
+  end = MIN (snapshot->fetched + CLIPBOARD_CHUNK_ROWS, snapshot->screen_row);
+  terminal_widget_clipboard_fetch (snapshot, snapshot->head, snapshot->fetched, end);
+  snapshot->fetched = end;
+
+  if (snapshot->fetched < snapshot->screen_row)
+    {
+      terminal_widget_apply_scrollback_lines (widget);
+      return TRUE;
+    }
+
+  if (snapshot->fetch_id != 0)
+    {
+      g_source_remove (snapshot->fetch_id);
+      snapshot->fetch_id = 0;
+    }
+  snapshot->widget = NULL;
+
+  widget->clipboard_snapshot = NULL;
+  if (widget->terminal != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (widget->terminal,
+                                            terminal_widget_clipboard_contents_changed, widget);
+      terminal_widget_apply_scrollback_lines (widget);
+    }
+
+  return FALSE;
+}
+
+static gboolean
+terminal_widget_clipboard_fetch_idle (gpointer data)
+{
+  TerminalWidget            *widget = TERMINAL_WIDGET (data);
+  TerminalClipboardSnapshot *snapshot = widget->clipboard_snapshot;
+  guint                      fetch_id = snapshot->fetch_id;
+
+  /* So that fetching the last chunk does not remove this source */
+  snapshot->fetch_id = 0;
+  if (!terminal_widget_clipboard_fetch_chunk (widget))
+    return FALSE;
+
+  snapshot->fetch_id = fetch_id;
+  return TRUE;
+}
+
+/* Stops referring to rows in the terminal, by copying all that are left out
+ * of it */
+static void
+terminal_widget_clipboard_materialize (TerminalWidget *widget)
+{
+  if (widget->clipboard_snapshot == NULL)
+    return;
+
+  while (terminal_widget_clipboard_fetch_chunk (widget))
+    ;
+}
+
+/* Leaves the snapshot with only the rows that were on the screen, rather than
+ * copy the scrollback out of the terminal when memory is short */
+static void
+terminal_widget_clipboard_truncate (TerminalWidget *widget)
+{
+  TerminalClipboardSnapshot *snapshot = widget->clipboard_snapshot;
+
+  if (snapshot == NULL)
+    return;
+
+  g_string_truncate (snapshot->head, 0);
+  snapshot->fetched = snapshot->screen_row;
+  terminal_widget_clipboard_fetch_chunk (widget);
+}
+
+static void
+terminal_widget_clipboard_contents_changed (VteTerminal    *terminal,
+                                            TerminalWidget *widget)
+{
+  TerminalClipboardSnapshot *snapshot = widget->clipboard_snapshot;
+  GtkAdjustment             *adj = vte_terminal_get_adjustment (terminal);
+  glong                      extra;
+  glong                      room;
+
+  if (snapshot == NULL)
+    return;
+
+  /* Rows already pushed out are gone from the snapshot too */
+  if ((glong) adj->lower > snapshot->fetched)
+    snapshot->fetched = MIN ((glong) adj->lower, snapshot->screen_row);
+
+  /* Nothing needs fetching until new output runs into the rows added for
+   * the snapshot. Then it is fetched a chunk at a time, and should the
+   * output outrun the idle, a chunk right away before it reaches the
+   * unfetched rows. */
+  extra = MIN (snapshot->screen_row - snapshot->fetched, CLIPBOARD_EXTRA_ROWS);
+  room = widget->scrollback_lines + extra - (glong) (adj->upper - adj->lower);
+  if (room >= extra)
+    return;
+
+  if (room < terminal->row_count && !terminal_widget_clipboard_fetch_chunk (widget))
+    return;
+
+  if (snapshot->fetch_id == 0)
+    snapshot->fetch_id = g_idle_add (terminal_widget_clipboard_fetch_idle, widget);
+}
+
+static void
+terminal_widget_clipboard_get (GtkClipboard              *clipboard,
+                               GtkSelectionData          *selection_data,
+                               guint                      info,
+                               TerminalClipboardSnapshot *snapshot)
+{
+  GString *str;
+
+  /* Partly still in the terminal: the rest is fetched for this paste only */
+  if (snapshot->widget != NULL)
+    {
+      str = g_string_new_len (snapshot->head->str, snapshot->head->len);
+      terminal_widget_clipboard_fetch (snapshot, str, snapshot->fetched, snapshot->screen_row);
+      g_string_append (str, snapshot->tail);
+      gtk_selection_data_set_text (selection_data, str->str, str->len);
+      g_string_free (str, TRUE);
+      return;
+    }
+
+  /* Already copied out: the tail joins the head for good, rather than both
+   * being copied again on every paste */
+  if (snapshot->tail != NULL)
+    {
+      g_string_append (snapshot->head, snapshot->tail);
+      g_free (snapshot->tail);
+      snapshot->tail = NULL;
+    }
+
+  gtk_selection_data_set_text (selection_data, snapshot->head->str, snapshot->head->len);
+}
+
+static void
+terminal_widget_clipboard_clear (GtkClipboard              *clipboard,
+                                 TerminalClipboardSnapshot *snapshot)
+{
+  TerminalWidget *widget = snapshot->widget;
+
+  if (snapshot->fetch_id != 0)
+    g_source_remove (snapshot->fetch_id);
+
+  if (widget != NULL && widget->clipboard_snapshot == snapshot)
+    {
+      widget->clipboard_snapshot = NULL;
+      g_signal_handlers_disconnect_by_func (widget->terminal,
+                                            terminal_widget_clipboard_contents_changed, widget);
+      terminal_widget_apply_scrollback_lines (widget);
+    }
+
+  g_string_free (snapshot->head, TRUE);
+  g_free (snapshot->tail);
+  g_free (snapshot);
+}
+
+static void
+terminal_widget_copy_all (TerminalWidget *widget)
+{
+  TerminalClipboardSnapshot *snapshot;
+  VteTerminal               *term = VTE_TERMINAL (widget->terminal);
+  GtkClipboard              *clipboard;
+  GtkTargetList             *target_list;
+  GtkTargetEntry            *targets;
+  gint                       n_targets;
+  glong                      upper;
+
+  snapshot = g_new0 (TerminalClipboardSnapshot, 1);
+  snapshot->widget = widget;
+  terminal_widget_get_row_range (widget, &snapshot->fetched, &upper);
+  snapshot->screen_row = MAX (snapshot->fetched, upper - term->row_count);
+  snapshot->head = g_string_new (NULL);
+  snapshot->tail = terminal_widget_get_text_range (widget, snapshot->screen_row,
+                                                   upper - snapshot->screen_row);
+  if (snapshot->tail == NULL)
+    snapshot->tail = g_strdup ("");
+
+  target_list = gtk_target_list_new (NULL, 0);
+  gtk_target_list_add_text_targets (target_list, 0);
+  targets = gtk_target_table_new_from_list (target_list, &n_targets);
+  gtk_target_list_unref (target_list);
+
+  /* Replacing a previous snapshot clears it first */
+  clipboard = gtk_widget_get_clipboard (widget->terminal, GDK_SELECTION_CLIPBOARD);
+  if (gtk_clipboard_set_with_data (clipboard, targets, n_targets,
+                                   (GtkClipboardGetFunc) terminal_widget_clipboard_get,
+                                   (GtkClipboardClearFunc) terminal_widget_clipboard_clear,
+                                   snapshot))
+    {
+      widget->clipboard_snapshot = snapshot;
+      g_signal_connect (G_OBJECT (widget->terminal), "contents-changed",
+                        G_CALLBACK (terminal_widget_clipboard_contents_changed), widget);
+      /* Make room so that the snapshot is not pushed out of the scrollback
+       * before it is pasted */
+      terminal_widget_apply_scrollback_lines (widget);
+    }
+  else
+    {
+      g_string_free (snapshot->head, TRUE);
+      g_free (snapshot->tail);
+      g_free (snapshot);
+    }
+
+  gtk_target_table_free (targets, n_targets);
 }
 
 
@@ -1749,12 +2416,18 @@ terminal_widget_has_selection (TerminalWidget *widget)
  * @widget  : A #TerminalWidget.
  *
  * Places the selected text in the terminal in the #GDK_SELECTIN_CLIPBOARD selection.
+ * When everything is selected, the text is only fetched from the terminal once
+ * it is pasted, as it was at the time of the copy.
  **/
 void
 terminal_widget_copy_clipboard (TerminalWidget *widget)
 {
   g_return_if_fail (TERMINAL_IS_WIDGET (widget));
-  vte_terminal_copy_clipboard (VTE_TERMINAL (widget->terminal));
+
+  if (widget->select_all)
+    terminal_widget_copy_all (widget);
+  else
+    vte_terminal_copy_clipboard (VTE_TERMINAL (widget->terminal));
 }
 
 
@@ -1786,6 +2459,8 @@ terminal_widget_reset (TerminalWidget *widget,
                        gboolean        clear)
 {
   g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+  if (clear)
+    terminal_widget_clipboard_materialize (widget);
   vte_terminal_reset (VTE_TERMINAL (widget->terminal), TRUE, clear);
 }
 
@@ -1809,6 +2484,35 @@ terminal_widget_im_append_menuitems (TerminalWidget *widget,
 }
 
 
+/* Tells when the row under @y came in, if that was noted */
+static void
+terminal_widget_show_line_time (TerminalWidget *widget,
+                                gint            y)
+{
+  VteTerminal *term = VTE_TERMINAL (widget->terminal);
+  GtkAdjustment *adj = vte_terminal_get_adjustment (term);
+  gint xpad, ypad;
+  gint64 msec;
+  time_t secs;
+  gchar clock[16], *text;
+
+  vte_terminal_get_padding (term, &xpad, &ypad);
+  if (term->char_height <= 0 ||
+      !maemo_vte_get_line_time (MAEMO_VTE (term),
+                                (glong)adj->value + MAX (y - ypad, 0) / term->char_height,
+                                &msec))
+    return;
+
+  secs = (time_t)(msec / 1000);
+  if (strftime (clock, sizeof (clock), "%H:%M:%S", localtime (&secs)) == 0)
+    return;
+
+  text = g_strdup_printf ("%s.%03d", clock, (gint)(msec % 1000));
+  hildon_banner_show_information (GTK_WIDGET (widget), NULL, text);
+  g_free (text);
+}
+
+
 static void
 terminal_widget_emit_context_menu (TerminalWidget *widget,
 		                   gpointer        user_data)
@@ -1820,6 +2524,8 @@ terminal_widget_emit_context_menu (TerminalWidget *widget,
   (void)user_data;
 
   gtk_widget_get_pointer(widget->terminal, &x, &y);
+  terminal_widget_show_line_time (widget, y);
+
   button->button = GDK_BUTTON_PRESS;
   button->window = widget->terminal->window;
   button->send_event = FALSE;
@@ -1853,20 +2559,6 @@ terminal_widget_get_tag (TerminalWidget *widget,
 				  tag);
 }
 
-static void
-terminal_widget_ctrlify_notify (GObject *src,
-				    GParamSpec     *pspec,
-				    GObject *dst)
-{
-  const char *dst_pspec_name = strcmp(pspec->name, "active") ? "active" : "control-mask";
-  gboolean src_val, dst_val;
-
-  g_object_get(src, pspec->name, &src_val, NULL);
-  g_object_get(dst, dst_pspec_name, &dst_val, NULL);
-  if (src_val != dst_val)
-    g_object_set(dst, dst_pspec_name, src_val, NULL);
-}
-
 static void
 terminal_widget_send_key(TerminalWidget *widget,
 		         guint keyval,
@@ -1878,7 +2570,8 @@ terminal_widget_send_key(TerminalWidget *widget,
 #endif
   key = (GdkEventKey *) gdk_event_new(GDK_KEY_PRESS);
 
-  key->window = GTK_WIDGET(widget->terminal)->window;
+  /* gdk_event_free() drops the event's reference to it */
+  key->window = g_object_ref(GTK_WIDGET(widget->terminal)->window);
   key->time = GDK_CURRENT_TIME;
   key->state = state;
   key->keyval = keyval;
@@ -1888,7 +2581,6 @@ terminal_widget_send_key(TerminalWidget *widget,
   key->state |= GDK_RELEASE_MASK;
   gdk_event_put ((GdkEvent *) key);
 
-  g_object_ref(key->window);
   gdk_event_free((GdkEvent *) key);
 #ifdef DEBUG
   g_debug ("%s - end", __FUNCTION__);
@@ -1987,9 +2679,17 @@ static const gchar *parse_key(const gchar *source,
   return NULL;
 }
 
-static void 
-terminal_widget_do_keys(TerminalWidget *widget,
-			const gchar *key_string)
+/**
+ * terminal_widget_send_keys:
+ * @widget     : A #TerminalWidget.
+ * @key_string : Keys as in /apps/osso/xterm/keys, such as "<ctrl>c" or
+ *               "Escape Up".
+ *
+ * Sends the keys to the terminal as though they were typed.
+ **/
+void
+terminal_widget_send_keys (TerminalWidget *widget,
+                           const gchar    *key_string)
 {
   guint keyval = 0;
   guint state = 0;
@@ -2000,53 +2700,338 @@ terminal_widget_do_keys(TerminalWidget *widget,
   }
 }
 
-static void 
-terminal_widget_do_key_button(GObject *button,
-			      TerminalWidget *widget)
-{
-  terminal_widget_do_keys(widget, g_object_get_data(button, "keys"));
-}
-
+/**
+ * terminal_widget_select_all:
+ * @widget  : A #TerminalWidget.
+ *
+ * Selects the whole scrollback and screen, for terminal_widget_copy_clipboard().
+ * The selection lasts until the user selects something in the terminal.
+ **/
 gboolean   
 terminal_widget_select_all (TerminalWidget *widget)
 {
 #ifdef DEBUG
   g_debug (__FUNCTION__);
 #endif
-#if 0
-  VteTerminal *term = VTE_TERMINAL(widget->terminal);
-  GTK_WIDGET (term->widget);
-#endif
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), FALSE);
+
+  if (!widget->select_all)
+    {
+      widget->select_all = TRUE;
+      g_signal_emit (G_OBJECT (widget), widget_signals[SELECTION_CHANGED], 0);
+    }
   return TRUE;
 }
-#if 0
-void terminal_widget_send_keys(TerminalWidget *widget,
-                               const gchar *key_string)
+/* Zooms this terminal only. Other windows, and the configured size, are
+ * left alone. */
+gboolean
+terminal_widget_modify_font_size(TerminalWidget *widget, int increment)
 {
-        guint keyval = 0;
-        guint state = 0;
+  int font_size_delta = widget->zoom + increment;
 
-        while (key_string && *key_string) {
-                key_string = parse_key(key_string, &keyval, &state);
-                terminal_widget_send_key(widget, keyval, state);
-        }
+  if (ABS(font_size_delta) <= FONT_SIZE_MAX_ABS_DELTA) {
+    widget->zoom = font_size_delta;
+    terminal_widget_gconf_font_size(widget->gconf_client, 0, NULL, widget);
+    return TRUE;
+  }
+
+  return FALSE;
 }
-#endif
 
+static void
+terminal_widget_update_watch (TerminalWidget *widget)
+{
+  OutputWatch *watch;
+  GPtrArray *patterns;
+  const gchar * const *shared_patterns;
+  gchar **p;
+
+  if (widget->watch_patterns == NULL)
+    {
+      maemo_vte_set_watch (MAEMO_VTE (widget->terminal), widget->shared_watch);
+      return;
+    }
+
+  /* This terminal has patterns of its own, so it gets an automaton of its own */
+  patterns = g_ptr_array_new ();
+  if (widget->shared_watch != NULL)
+    for (shared_patterns = output_watch_get_patterns (widget->shared_watch);
+         *shared_patterns != NULL; shared_patterns++)
+      g_ptr_array_add (patterns, (gpointer) *shared_patterns);
+  for (p = widget->watch_patterns; *p != NULL; p++)
+    g_ptr_array_add (patterns, *p);
+  g_ptr_array_add (patterns, NULL);
+
+  watch = output_watch_new ((const gchar * const *) patterns->pdata);
+  maemo_vte_set_watch (MAEMO_VTE (widget->terminal), watch);
+  if (watch != NULL)
+    output_watch_unref (watch);
+
+  g_ptr_array_free (patterns, TRUE);
+}
+
+/**
+ * terminal_widget_set_shared_watch:
+ * @widget : A #TerminalWidget.
+ * @watch  : The patterns watched for in all terminals, or %NULL.
+ **/
+void
+terminal_widget_set_shared_watch (TerminalWidget *widget,
+                                  OutputWatch    *watch)
+{
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  if (widget->shared_watch == watch)
+    return;
+
+  if (widget->shared_watch != NULL)
+    output_watch_unref (widget->shared_watch);
+  widget->shared_watch = watch ? output_watch_ref (watch) : NULL;
+
+  terminal_widget_update_watch (widget);
+}
+
+/**
+ * terminal_widget_add_watch_pattern:
+ * @widget  : A #TerminalWidget.
+ * @pattern : Text to watch for in the output of this terminal only.
+ **/
+void
+terminal_widget_add_watch_pattern (TerminalWidget *widget,
+                                   const gchar    *pattern)
+{
+  guint n;
+
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+  g_return_if_fail (pattern != NULL && *pattern != '\0');
+
+  n = widget->watch_patterns ? g_strv_length (widget->watch_patterns) : 0;
+  widget->watch_patterns = g_renew (gchar *, widget->watch_patterns, n + 2);
+  widget->watch_patterns[n] = g_strdup (pattern);
+  widget->watch_patterns[n + 1] = NULL;
+
+  terminal_widget_update_watch (widget);
+}
+
+/**
+ * terminal_widget_clear_watch_patterns:
+ * @widget : A #TerminalWidget.
+ *
+ * Forgets the patterns added with terminal_widget_add_watch_pattern().
+ **/
+void
+terminal_widget_clear_watch_patterns (TerminalWidget *widget)
+{
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  g_strfreev (widget->watch_patterns);
+  widget->watch_patterns = NULL;
+
+  terminal_widget_update_watch (widget);
+}
+
+/**
+ * terminal_widget_set_frame_scheduler:
+ * @widget    : A #TerminalWidget.
+ * @scheduler : The scheduler of the window showing @widget, or %NULL.
+ *
+ * Has the scroll position of @widget follow its output once per frame of
+ * @scheduler, rather than whenever the main loop is idle.
+ **/
+void
+terminal_widget_set_frame_scheduler (TerminalWidget *widget,
+                                     FrameScheduler *scheduler)
+{
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  maemo_vte_set_frame_scheduler (MAEMO_VTE (widget->terminal), scheduler);
+}
+
+
+/**
+ * terminal_widget_set_read_budget:
+ * @widget           : A #TerminalWidget.
+ * @bytes_per_second : How much output @widget may read per second, or 0.
+ *
+ * Past the budget, the child is left to block until the second is up.
+ * Terminals whose child Vte runs itself are not limited.
+ **/
+void
+terminal_widget_set_read_budget (TerminalWidget *widget,
+                                 gsize           bytes_per_second)
+{
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  maemo_vte_set_read_budget (MAEMO_VTE (widget->terminal), bytes_per_second);
+}
+
+
+
+/* A terminal woken up while hidden is shown as it was left */
+static void
+terminal_widget_map (GtkWidget *widget)
+{
+  GTK_WIDGET_CLASS (parent_class)->map (widget);
+
+  terminal_widget_wake (TERMINAL_WIDGET (widget));
+}
+
+
+/**
+ * terminal_widget_touch:
+ * @widget : A #TerminalWidget.
+ *
+ * Notes that @widget is in use, as far as terminal_widget_get_idle_time() is
+ * concerned.
+ **/
+void
+terminal_widget_touch (TerminalWidget *widget)
+{
+  GTimeVal now;
+
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  g_get_current_time (&now);
+  widget->last_active = now.tv_sec;
+}
+
+
+/**
+ * terminal_widget_get_idle_time:
+ * @widget : A #TerminalWidget.
+ *
+ * Return value : The seconds since @widget was last in use.
+ **/
+glong
+terminal_widget_get_idle_time (TerminalWidget *widget)
+{
+  GTimeVal now;
+
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), 0);
+
+  g_get_current_time (&now);
+  return MAX (now.tv_sec - widget->last_active, 0);
+}
+
+
+/**
+ * terminal_widget_hibernate:
+ * @widget : A #TerminalWidget.
+ *
+ * Lets go of what the terminal takes to show itself: its window and what is
+ * drawn in it, its rows and its font. The child carries on,
+ * with a plain text copy of the rows kept for terminal_widget_wake(). Only a
+ * terminal on a pty of our own, which nobody can see, can hibernate. That
+ * includes the one in use in a window that is not mapped; mapping it wakes
+ * the terminal again.
+ *
+ * Return value : %TRUE if @widget is hibernating now.
+ **/
+gboolean
+terminal_widget_hibernate (TerminalWidget *widget)
+{
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), FALSE);
+
+  if (terminal_widget_is_hibernating (widget))
+    return TRUE;
+  if (GTK_WIDGET_MAPPED (widget->terminal))
+    return FALSE;
+
+  /* The clipboard would otherwise be left with rows that are gone */
+  terminal_widget_clipboard_materialize (widget);
+
+  if (!maemo_vte_hibernate (MAEMO_VTE (widget->terminal)))
+    return FALSE;
+
+  if (widget->font_prefetch_id != 0)
+    {
+      g_source_remove (widget->font_prefetch_id);
+      widget->font_prefetch_id = 0;
+    }
+  if (widget->font != NULL)
+    {
+      font_cache_entry_unref (widget->font);
+      widget->font = NULL;
+    }
+
+  return TRUE;
+}
+
+
+/**
+ * terminal_widget_wake:
+ * @widget : A #TerminalWidget.
+ *
+ * Builds up what terminal_widget_hibernate() let go of, before @widget is
+ * next drawn.
+ **/
 void
-terminal_widget_add_tool_item(TerminalWidget *widget, GtkToolItem *item)
+terminal_widget_wake (TerminalWidget *widget)
 {
-  gtk_toolbar_insert(GTK_TOOLBAR(widget->tbar), item, -1);
+  g_return_if_fail (TERMINAL_IS_WIDGET (widget));
+
+  if (!terminal_widget_is_hibernating (widget))
+    return;
+
+  terminal_widget_apply_scrollback_lines (widget);
+  maemo_vte_wake (MAEMO_VTE (widget->terminal));
+
+  terminal_widget_gconf_font_size (widget->gconf_client, 0, NULL, widget);
+  terminal_widget_touch (widget);
 }
 
+
+/**
+ * terminal_widget_is_hibernating:
+ * @widget : A #TerminalWidget.
+ *
+ * Return value : %TRUE between terminal_widget_hibernate() and
+ *                terminal_widget_wake().
+ **/
 gboolean
-terminal_widget_modify_font_size(TerminalWidget *widget, int increment)
+terminal_widget_is_hibernating (TerminalWidget *widget)
 {
-  int font_size_delta = gconf_client_get_int(widget->gconf_client, OSSO_XTERM_GCONF_FONT_SIZE, NULL);
-  font_size_delta += increment;
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), FALSE);
 
-  if (ABS(font_size_delta) <= FONT_SIZE_MAX_ABS_DELTA)
-    return gconf_client_set_int(widget->gconf_client, OSSO_XTERM_GCONF_FONT_SIZE, font_size_delta, NULL);
+  return widget->terminal != NULL && maemo_vte_is_hibernating (MAEMO_VTE (widget->terminal));
+}
 
-  return FALSE;
+
+/**
+ * terminal_widget_trim_scrollback:
+ * @widget : A #TerminalWidget.
+ *
+ * Drops the rows that have scrolled off the screen. New ones are kept again
+ * as configured. A hibernating terminal drops them from the text it keeps.
+ * A copy of all the text not yet copied out of the terminal is cut down to
+ * the screen it was taken from.
+ *
+ * Return value : About how many bytes the rows took up.
+ **/
+gsize
+terminal_widget_trim_scrollback (TerminalWidget *widget)
+{
+  VteTerminal   *vte;
+  GtkAdjustment *adj;
+  glong          rows;
+
+  g_return_val_if_fail (TERMINAL_IS_WIDGET (widget), 0);
+
+  if (terminal_widget_is_hibernating (widget))
+    return maemo_vte_trim_hibernated (MAEMO_VTE (widget->terminal));
+
+  vte = VTE_TERMINAL (widget->terminal);
+  adj = vte_terminal_get_adjustment (vte);
+  rows = (glong) adj->upper - (glong) adj->lower - vte->row_count;
+  if (rows <= 0)
+    return 0;
+
+  /* Copying a pending clipboard snapshot out would take the very memory
+   * being freed, so it keeps only the screen it was taken from */
+  terminal_widget_clipboard_truncate (widget);
+
+  vte_terminal_set_scrollback_lines (vte, 0);
+  terminal_widget_apply_scrollback_lines (widget);
+
+  return rows * vte->column_count * SCROLLBACK_CELL_BYTES;
 }
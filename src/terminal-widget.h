@@ -26,6 +26,10 @@
 #include <hildon/hildon.h>
 #include <gconf/gconf-client.h>
 
+#include "output-watch.h"
+#include "frame-scheduler.h"
+#include "font-cache.h"
+
 G_BEGIN_DECLS;
 
 #define TERMINAL_TYPE_WIDGET      (terminal_widget_get_type ())
@@ -37,6 +41,7 @@ G_BEGIN_DECLS;
 
 typedef struct _TerminalWidgetClass TerminalWidgetClass;
 typedef struct _TerminalWidget      TerminalWidget;
+typedef struct _TerminalWidgetStats TerminalWidgetStats;
 
 struct _TerminalWidgetClass
 {
@@ -45,20 +50,20 @@ struct _TerminalWidgetClass
   /* signals */
   void (*context_menu) (TerminalWidget *widget, GdkEvent *event);
   void (*selection_changed) (TerminalWidget *widget);
+  void (*watch_triggered) (TerminalWidget *widget, const gchar *pattern);
 };
 
 struct _TerminalWidget
 {
   GtkVBox              __parent__;
   gboolean             dispose_has_run;
+  guint                id;
   GtkWidget           *terminal;
-  GtkWidget	      *tbar;
-  GtkToolItem         *pan_button;
-  GtkToolItem         *cbutton;
-  GSList              *keys_toolbuttons;
 
-  GPid                 pid;
+  GPid                 pid;            /* Of a child Vte forked, 0 for one on a pty */
+  guint                session;
   gchar               *working_directory;
+  glong                last_active;
 
   gchar              **custom_command;
   gchar               *custom_title;
@@ -66,29 +71,57 @@ struct _TerminalWidget
   GConfClient         *gconf_client;
   guint                scrollbar_conid;
   guint                scrolling_conid;
+  guint                line_times_conid;
   guint		       scrollback_conid;
-  guint                toolbar_conid;
-  guint                toolbar_fs_conid;
-  guint                keys_conid;
-  guint                key_labels_conid;
-  guint                font_size_conid;
   guint                font_base_size_conid;
   guint                font_name_conid;
   guint                reverse_conid;
   guint                fg_conid;
   guint                bg_conid;
 
+  OutputWatch         *shared_watch;
+  gchar              **watch_patterns;
+
+  gint                 scrollback_lines;
+  gboolean             select_all;
+  gpointer             clipboard_snapshot;
+
+  FontCacheEntry      *font;
+  guint                font_fallback_watch;
+  gint                 zoom;
+  guint                font_prefetch_id;
+
 //  GtkIMContext        *im_context;
 //  gboolean	       im_pending;
 
   GtkWindow           *app;
 };
 
+/* What a terminal has cost so far. Frame times are in microseconds, CPU time
+ * is the child's own, in milliseconds. */
+struct _TerminalWidgetStats
+{
+  guint64              bytes_read;
+  guint64              bytes_written;
+  guint                frames;
+  gulong               avg_frame_time;
+  gulong               max_frame_time;
+  glong                scrollback_lines;
+  gsize                scrollback_bytes;
+  guint                font_cache_hits;
+  guint                font_cache_misses;
+  GPid                 pid;
+  guint64              cpu_time;
+};
+
 GType        terminal_widget_get_type                     (void) G_GNUC_CONST;
 
 GtkWidget   *terminal_widget_new                          (void);
 
 gboolean     terminal_widget_launch_child                 (TerminalWidget *widget);
+void         terminal_widget_save_last_session            (TerminalWidget *widget);
+void         terminal_widget_set_session                  (TerminalWidget *widget,
+                                                           guint           session);
 
 void         terminal_widget_set_custom_command           (TerminalWidget *widget,
                                                            gchar         **command);
@@ -108,6 +141,21 @@ void       terminal_widget_set_window_geometry_hints    (TerminalWidget *widget,
 
 gchar       *terminal_widget_get_title                  (TerminalWidget *widget);
 
+guint        terminal_widget_get_id                     (TerminalWidget *widget);
+void         terminal_widget_get_row_range              (TerminalWidget *widget,
+                                                         glong          *first_row,
+                                                         glong          *end_row);
+gchar       *terminal_widget_get_text_range             (TerminalWidget *widget,
+                                                         glong           first_row,
+                                                         glong           n_rows);
+gchar       *terminal_widget_get_visible_text           (TerminalWidget *widget);
+void         terminal_widget_get_cursor_position        (TerminalWidget *widget,
+                                                         glong          *column,
+                                                         glong          *row);
+void         terminal_widget_get_stats                  (TerminalWidget      *widget,
+                                                         TerminalWidgetStats *stats);
+guint        terminal_widget_get_n_live                 (void);
+
 const gchar *terminal_widget_get_working_directory      (TerminalWidget *widget);
 void         terminal_widget_set_working_directory      (TerminalWidget *widget,
                                                          const gchar    *directory);
@@ -127,23 +175,35 @@ char      *terminal_widget_get_tag		      (TerminalWidget *widget,
 						       gint            x,
 						       gint            y,
 						       gint           *tag);
-void      terminal_widget_update_tool_bar             (TerminalWidget *widget,
-	  					       gboolean show);
-
-gboolean terminal_widget_need_toolbar(TerminalWidget *widget);
-gboolean terminal_widget_need_fullscreen_toolbar(TerminalWidget *widget);
 
 void terminal_widget_set_app_win (TerminalWidget *widget, HildonWindow *window);
 
-#if 0
 void terminal_widget_send_keys(TerminalWidget *widget,
                                const gchar *key_string);
-#endif
 
-void terminal_widget_add_tool_item(TerminalWidget *widget, GtkToolItem *item);
+/* How far one press of a zoom key changes the font size */
+#define TERMINAL_WIDGET_ZOOM_STEP 2
 
 gboolean terminal_widget_modify_font_size(TerminalWidget *widget, int increment);
 
+void     terminal_widget_set_shared_watch     (TerminalWidget *widget,
+                                               OutputWatch    *watch);
+void     terminal_widget_add_watch_pattern    (TerminalWidget *widget,
+                                               const gchar    *pattern);
+void     terminal_widget_clear_watch_patterns (TerminalWidget *widget);
+
+void     terminal_widget_set_frame_scheduler  (TerminalWidget *widget,
+                                               FrameScheduler *scheduler);
+void     terminal_widget_set_read_budget      (TerminalWidget *widget,
+                                               gsize           bytes_per_second);
+
+void     terminal_widget_touch                (TerminalWidget *widget);
+glong    terminal_widget_get_idle_time        (TerminalWidget *widget);
+gboolean terminal_widget_hibernate            (TerminalWidget *widget);
+void     terminal_widget_wake                 (TerminalWidget *widget);
+gboolean terminal_widget_is_hibernating       (TerminalWidget *widget);
+gsize    terminal_widget_trim_scrollback      (TerminalWidget *widget);
+
 G_END_DECLS;
 
 #endif /* !__TERMINAL_WIDGET_H__ */
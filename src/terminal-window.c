@@ -62,6 +62,7 @@
 #include <gconf/gconf-client.h>
 #include <gdk/gdkkeysyms.h>
 #include <gdk/gdkx.h>
+#include <glib/gstdio.h>
 #include <vte/vte.h>
 
 #include "terminal-gconf.h"
@@ -69,17 +70,31 @@
 #include "terminal-tab-header.h"
 #include "terminal-window.h"
 #include "terminal-encoding.h"
+#include "maemo-vte.h"
 #include "shortcuts.h"
 
 
 #define ALEN(a) (sizeof(a)/sizeof((a)[0]))
 
-#define FONT_SIZE_INC  2
+/* The settings the launch screenshot depends on */
+static const gchar *screenshot_keys[] = {
+  OSSO_XTERM_GCONF_FONT_NAME,
+  OSSO_XTERM_GCONF_FONT_BASE_SIZE,
+  OSSO_XTERM_GCONF_FONT_SIZE,
+  OSSO_XTERM_GCONF_FONT_COLOR,
+  OSSO_XTERM_GCONF_BG_COLOR,
+  OSSO_XTERM_GCONF_REVERSE,
+  OSSO_XTERM_GCONF_SCROLLBAR,
+  OSSO_XTERM_GCONF_TOOLBAR,
+  OSSO_XTERM_GCONF_KEYS,
+  OSSO_XTERM_GCONF_KEY_LABELS,
+};
 
 /* signals */
 enum
 {
   SIGNAL_NEW_WINDOW = 1,
+  SIGNAL_ACTIVE_CHANGED,
   LAST_SIGNAL
 };
 
@@ -93,6 +108,16 @@ static void            terminal_window_notify_title            (TerminalWidget
                                                                TerminalWindow     *window);
 static void            terminal_window_action_new_window          (GtkWidget    *new_window_button,
                                                              TerminalWindow     *window);
+static void            terminal_window_action_new_tab          (GtkWidget       *new_tab_button,
+                                                             TerminalWindow     *window);
+static void            terminal_window_action_split_horizontally (GtkWidget     *split_button,
+                                                             TerminalWindow     *window);
+static void            terminal_window_action_split_vertically (GtkWidget       *split_button,
+                                                             TerminalWindow     *window);
+static void            terminal_window_switch_page             (GtkNotebook     *notebook,
+                                                             GtkNotebookPage *page,
+                                                             guint            page_num,
+                                                             TerminalWindow  *window);
 static void            terminal_window_paste_show            (GtkWidget         *hildon_app_menu,
                                                              TerminalWindow     *window);
 static void            terminal_window_action_copy             (GtkButton       *copy_button,
@@ -105,12 +130,26 @@ static void            terminal_window_action_reset            (GtkWidget
                                                              TerminalWindow     *window);
 static void            terminal_window_action_reset_and_clear  (GtkWidget       *button,
                                                              TerminalWindow     *window);
+#ifdef DEBUG
+static void            terminal_window_action_show_damage      (GtkToggleButton *button,
+                                                             TerminalWindow     *window);
+#endif /* DEBUG */
 #if (0)
 static void            terminal_window_action_encoding         (GtkAction       *action,
 								TerminalWindow  *window);
 
 #endif /* (0) */
 static void            terminal_widget_destroyed (GObject *obj, TerminalWindow *window);
+static void            terminal_window_set_active (TerminalWindow *window,
+                                                   TerminalWidget *active);
+static void            terminal_window_update_tab_title (TerminalWidget *terminal,
+                                                         GParamSpec     *pspec,
+                                                         TerminalWindow *window);
+static void            terminal_window_contents_changed (GtkWidget      *terminal,
+                                                         TerminalWindow *window);
+static gboolean        terminal_window_first_paint (GtkWidget      *terminal,
+                                                    GdkEventExpose *event,
+                                                    TerminalWindow *window);
 
 struct _TerminalWindow
 {
@@ -123,16 +162,36 @@ struct _TerminalWindow
   GtkWidget *unfs_button;
   HildonAppMenu *match_menu;
 
+  /* One toolbar for all the terminals of the window, acting on the one in
+     use */
+  GtkWidget *toolbar;
+  GtkToolItem *pan_button;
+  GtkToolItem *ctrl_button;
+  GSList *key_buttons;
+
   GConfClient *gconf_client;
+  guint toolbar_conid;
+  guint toolbar_fs_conid;
+  guint keys_conid;
+  guint key_labels_conid;
 
-  TerminalWidget *terminal;
+  GtkWidget *notebook;
+  TerminalWidget *terminal;     /* The pane in use in the tab shown */
   gchar *encoding;
 
   guint take_screenshot_idle_id;
+
+  FrameScheduler *scheduler;
 };
 
 static GObjectClass *parent_class;
 
+/* Windows created and not yet finalized */
+static guint n_live_windows = 0;
+
+/* Once a screenshot has been taken or found current, no later window looks */
+static gboolean screenshot_checked = FALSE;
+
 #if (0)
 static GtkActionEntry action_entries[] =
 {
@@ -161,16 +220,120 @@ terminal_window_is_fullscreen(TerminalWindow *window)
      * of the parent of one of children. */
     GdkWindowState state;
     state = gdk_window_get_state(
-        gtk_widget_get_parent_window(GTK_WIDGET(window->terminal)));
+        gtk_widget_get_parent_window(GTK_WIDGET(window->notebook)));
     if((state & GDK_WINDOW_STATE_FULLSCREEN) == GDK_WINDOW_STATE_FULLSCREEN)
       return TRUE;
     return FALSE;
 }
 
-static TerminalWidget*
+/**
+ * terminal_window_get_active:
+ * @window : A #TerminalWindow.
+ *
+ * Return value : The #TerminalWidget in the tab shown, or %NULL.
+ **/
+TerminalWidget*
 terminal_window_get_active (TerminalWindow *window)
 {
-  return TERMINAL_WIDGET (window->terminal);    
+  g_return_val_if_fail (TERMINAL_IS_WINDOW (window), NULL);
+
+  return window->terminal;
+}
+
+/* Each tab is a box holding either a terminal or a tree of GtkPaned splits
+   with terminals for leaves */
+static void
+terminal_window_collect_terminals (GtkWidget  *widget,
+                                   GList     **terminals)
+{
+  if (TERMINAL_IS_WIDGET (widget))
+    *terminals = g_list_prepend (*terminals, widget);
+  else if (GTK_IS_CONTAINER (widget))
+    gtk_container_foreach (GTK_CONTAINER (widget),
+                           (GtkCallback) terminal_window_collect_terminals, terminals);
+}
+
+/* The tab @widget is in */
+static GtkWidget *
+terminal_window_get_page (TerminalWindow *window,
+                          GtkWidget      *widget)
+{
+  while (widget != NULL && widget->parent != window->notebook)
+    widget = widget->parent;
+
+  return widget;
+}
+
+/* The pane last used in @page, or its first one */
+static TerminalWidget *
+terminal_window_get_page_active (GtkWidget *page)
+{
+  TerminalWidget *active = g_object_get_data (G_OBJECT (page), "active-terminal");
+  GList *terminals = NULL;
+
+  terminal_window_collect_terminals (page, &terminals);
+  terminals = g_list_reverse (terminals);
+  if (g_list_find (terminals, active) == NULL)
+    active = (terminals != NULL) ? TERMINAL_WIDGET (terminals->data) : NULL;
+  g_list_free (terminals);
+
+  return active;
+}
+
+/* Puts @new where @old is. @old is let go of. */
+static void
+terminal_window_replace (GtkWidget *old,
+                         GtkWidget *new)
+{
+  GtkWidget *parent = old->parent;
+
+  if (GTK_IS_PANED (parent))
+    {
+      gboolean first = (gtk_paned_get_child1 (GTK_PANED (parent)) == old);
+
+      gtk_container_remove (GTK_CONTAINER (parent), old);
+      if (first)
+        gtk_paned_pack1 (GTK_PANED (parent), new, TRUE, TRUE);
+      else
+        gtk_paned_pack2 (GTK_PANED (parent), new, TRUE, TRUE);
+    }
+  else
+    {
+      gtk_container_remove (GTK_CONTAINER (parent), old);
+      gtk_box_pack_start (GTK_BOX (parent), new, TRUE, TRUE, 0);
+    }
+}
+
+/* Gets rid of the splits under @widget that have lost a pane, giving their
+   place to the pane that is left */
+static void
+terminal_window_collapse (GtkWidget *widget)
+{
+  GtkWidget *child1, *child2, *child;
+
+  if (!GTK_IS_PANED (widget))
+    return;
+
+  if ((child1 = gtk_paned_get_child1 (GTK_PANED (widget))) != NULL)
+    terminal_window_collapse (child1);
+  if ((child2 = gtk_paned_get_child2 (GTK_PANED (widget))) != NULL)
+    terminal_window_collapse (child2);
+
+  child1 = gtk_paned_get_child1 (GTK_PANED (widget));
+  child2 = gtk_paned_get_child2 (GTK_PANED (widget));
+  if (child1 != NULL && child2 != NULL)
+    return;
+
+  child = (child1 != NULL) ? child1 : child2;
+  if (child != NULL)
+    {
+      g_object_ref (child);
+      gtk_container_remove (GTK_CONTAINER (widget), child);
+      terminal_window_replace (widget, child);
+      g_object_unref (child);
+    }
+  else
+    gtk_widget_destroy (widget);
 }
 
 static void
@@ -223,6 +386,20 @@ terminal_window_class_init (TerminalWindowClass *klass)
                            G_TYPE_NONE,
                            1, 
 			   &param_types);
+
+  /* Another tab is shown */
+  terminal_window_signals[SIGNAL_ACTIVE_CHANGED] =
+            g_signal_newv ("active-changed",
+                           G_TYPE_FROM_CLASS (klass),
+                           G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE |
+                           G_SIGNAL_NO_HOOKS,
+                           NULL,
+                           NULL,
+                           NULL,
+                           g_cclosure_marshal_VOID__VOID,
+                           G_TYPE_NONE,
+                           0,
+                           NULL);
 }
 
 static gboolean
@@ -240,7 +417,7 @@ terminal_window_key_press_event (TerminalWindow *window,
           {
             TerminalWidget *tw = terminal_window_get_active(window);
             if (tw) {
-              if (!terminal_widget_modify_font_size(tw, FONT_SIZE_INC))
+              if (!terminal_widget_modify_font_size(tw, TERMINAL_WIDGET_ZOOM_STEP))
                 hildon_banner_show_information(GTK_WIDGET(window), "NULL", _("Already at maximum font size."));
             }
           }
@@ -251,7 +428,7 @@ terminal_window_key_press_event (TerminalWindow *window,
             TerminalWidget *tw = terminal_window_get_active(window);
 
             if (tw) {
-              if (!terminal_widget_modify_font_size(tw, -FONT_SIZE_INC))
+              if (!terminal_widget_modify_font_size(tw, -TERMINAL_WIDGET_ZOOM_STEP))
                 hildon_banner_show_information(GTK_WIDGET(window), "NULL", _("Already at minimum font size."));
             }
           }
@@ -311,25 +488,249 @@ make_match_menu(TerminalWindow *wnd)
   return menu;
 }
 
+static gboolean
+terminal_window_need_toolbar (TerminalWindow *window,
+                              gboolean        fullscreen)
+{
+  gboolean toolbar;
+  GConfValue *gconf_value;
+  GError *err = NULL;
+
+  gconf_value = gconf_client_get (window->gconf_client,
+                                  fullscreen ? OSSO_XTERM_GCONF_TOOLBAR_FULLSCREEN
+                                             : OSSO_XTERM_GCONF_TOOLBAR,
+                                  &err);
+  if (err != NULL) {
+    g_printerr ("Unable to get toolbar setting for %s from gconf: %s\n",
+                fullscreen ? "fullscreen" : "non-fullscreen", err->message);
+    g_clear_error (&err);
+  }
+  toolbar = fullscreen ? OSSO_XTERM_DEFAULT_TOOLBAR_FULLSCREEN : OSSO_XTERM_DEFAULT_TOOLBAR;
+  if (gconf_value) {
+    if (gconf_value->type == GCONF_VALUE_BOOL)
+      toolbar = gconf_value_get_bool (gconf_value);
+    gconf_value_free (gconf_value);
+  }
+
+  return toolbar;
+}
+
+/* Shows or hides the toolbar as set for the window being @fullscreen or not */
+static void
+terminal_window_update_toolbar (TerminalWindow *window,
+                                gboolean        fullscreen)
+{
+  if (terminal_window_need_toolbar (window, fullscreen))
+    gtk_widget_show (window->toolbar);
+  else
+    gtk_widget_hide (window->toolbar);
+}
+
+static void
+terminal_window_gconf_toolbar (GConfClient    *client,
+                               guint           conn_id,
+                               GConfEntry     *entry,
+                               TerminalWindow *window)
+{
+  terminal_window_update_toolbar (window,
+      GTK_WIDGET_REALIZED (GTK_WIDGET (window)) && terminal_window_is_fullscreen (window));
+}
+
+static void
+terminal_window_key_button_clicked (GtkToolButton  *button,
+                                    TerminalWindow *window)
+{
+  if (window->terminal != NULL)
+    terminal_widget_send_keys (window->terminal,
+                               g_object_get_data (G_OBJECT (button), "keys"));
+}
+
+/* Puts the buttons of /apps/osso/xterm/keys on the toolbar, in place of
+   those there were */
+static void
+terminal_window_gconf_keys (GConfClient    *client,
+                            guint           conn_id,
+                            GConfEntry     *entry,
+                            TerminalWindow *window)
+{
+  GSList *keys, *key_labels, *key, *label;
+  GtkToolItem *button;
+  gint position;
+
+  g_slist_foreach (window->key_buttons, (GFunc) gtk_widget_destroy, NULL);
+  g_slist_foreach (window->key_buttons, (GFunc) g_object_unref, NULL);
+  g_slist_free (window->key_buttons);
+  window->key_buttons = NULL;
+
+  keys = gconf_client_get_list (window->gconf_client,
+                                OSSO_XTERM_GCONF_KEYS,
+                                GCONF_VALUE_STRING,
+                                NULL);
+  key_labels = gconf_client_get_list (window->gconf_client,
+                                      OSSO_XTERM_GCONF_KEY_LABELS,
+                                      GCONF_VALUE_STRING,
+                                      NULL);
+
+  /* The fullscreen button stays last */
+  position = gtk_toolbar_get_item_index (GTK_TOOLBAR (window->toolbar),
+                                         GTK_TOOL_ITEM (window->unfs_button));
+  for (key = keys, label = key_labels;
+       key != NULL && label != NULL;
+       key = key->next, label = label->next)
+    {
+      button = gtk_tool_button_new (NULL, label->data);
+      g_object_set_data_full (G_OBJECT (button), "keys", g_strdup (key->data), g_free);
+      g_signal_connect (G_OBJECT (button), "clicked",
+                        G_CALLBACK (terminal_window_key_button_clicked), window);
+      gtk_widget_show (GTK_WIDGET (button));
+      gtk_toolbar_insert (GTK_TOOLBAR (window->toolbar), button, position++);
+      window->key_buttons = g_slist_prepend (window->key_buttons, g_object_ref (button));
+    }
+
+  g_slist_foreach (keys, (GFunc) g_free, NULL);
+  g_slist_foreach (key_labels, (GFunc) g_free, NULL);
+  g_slist_free (keys);
+  g_slist_free (key_labels);
+}
+
+/* The terminal in use follows the Ctrl button, and the other way round */
+static void
+terminal_window_ctrl_toggled (GtkToggleToolButton *button,
+                              TerminalWindow      *window)
+{
+  gboolean active = gtk_toggle_tool_button_get_active (button);
+  gboolean control_mask;
+
+  if (window->terminal == NULL)
+    return;
+
+  g_object_get (window->terminal->terminal, "control-mask", &control_mask, NULL);
+  if (control_mask != active)
+    g_object_set (window->terminal->terminal, "control-mask", active, NULL);
+}
+
+static void
+terminal_window_control_mask_changed (GObject        *vte,
+                                      GParamSpec     *pspec,
+                                      TerminalWindow *window)
+{
+  gboolean control_mask;
+
+  if (window->terminal == NULL || G_OBJECT (window->terminal->terminal) != vte)
+    return;
+
+  g_object_get (vte, "control-mask", &control_mask, NULL);
+  if (gtk_toggle_tool_button_get_active (GTK_TOGGLE_TOOL_BUTTON (window->ctrl_button)) != control_mask)
+    gtk_toggle_tool_button_set_active (GTK_TOGGLE_TOOL_BUTTON (window->ctrl_button), control_mask);
+}
+
+/* Pan mode is on while the pan button is up, and only while the terminal in
+   use has more to it than fits on the screen. The button is hidden when
+   there is nothing to pan. */
+static void
+terminal_window_update_pan_mode (TerminalWindow *window)
+{
+  GObject *vte;
+  gboolean active, pan_mode, can_pan;
+
+  if (window->terminal == NULL)
+    return;
+
+  vte = G_OBJECT (window->terminal->terminal);
+  active = gtk_toggle_tool_button_get_active (GTK_TOGGLE_TOOL_BUTTON (window->pan_button));
+  g_object_get (vte, "pan-mode", &pan_mode, "can-pan", &can_pan, NULL);
+
+  if (can_pan)
+    {
+      if (pan_mode != !active)
+        g_object_set (vte, "pan-mode", !active, NULL);
+      gtk_widget_show (GTK_WIDGET (window->pan_button));
+    }
+  else
+    {
+      if (pan_mode)
+        g_object_set (vte, "pan-mode", FALSE, NULL);
+      gtk_widget_hide (GTK_WIDGET (window->pan_button));
+    }
+}
+
+static void
+terminal_window_pan_toggled (GtkToggleToolButton *button,
+                             TerminalWindow      *window)
+{
+  gtk_tool_button_set_icon_widget (GTK_TOOL_BUTTON (button),
+      g_object_new (GTK_TYPE_IMAGE,
+                    "visible", TRUE,
+                    "icon-name", gtk_toggle_tool_button_get_active (button)
+                                 ? "browser_panning_mode_on" : "browser_panning_mode_off",
+                    "icon-size", HILDON_ICON_SIZE_TOOLBAR,
+                    NULL));
+  terminal_window_update_pan_mode (window);
+}
+
+static void
+terminal_window_can_pan_changed (GObject        *vte,
+                                 GParamSpec     *pspec,
+                                 TerminalWindow *window)
+{
+  if (window->terminal != NULL && G_OBJECT (window->terminal->terminal) == vte)
+    terminal_window_update_pan_mode (window);
+}
+
+/* Stops following the Ctrl and pan state of the terminal in use */
+static void
+terminal_window_unfollow (TerminalWindow *window)
+{
+  if (window->terminal == NULL || window->terminal->terminal == NULL)
+    return;
+
+  g_signal_handlers_disconnect_by_func (window->terminal->terminal,
+                                        terminal_window_control_mask_changed, window);
+  g_signal_handlers_disconnect_by_func (window->terminal->terminal,
+                                        terminal_window_can_pan_changed, window);
+}
+
+/* Sets the Ctrl and pan buttons to the state of the terminal in use, and
+   follows it from there */
+static void
+terminal_window_follow (TerminalWindow *window)
+{
+  GObject *vte = G_OBJECT (window->terminal->terminal);
+  gboolean control_mask, pan_mode, can_pan;
+
+  g_object_get (vte, "control-mask", &control_mask,
+                "pan-mode", &pan_mode, "can-pan", &can_pan, NULL);
+
+  gtk_toggle_tool_button_set_active (GTK_TOGGLE_TOOL_BUTTON (window->ctrl_button), control_mask);
+  gtk_toggle_tool_button_set_active (GTK_TOGGLE_TOOL_BUTTON (window->pan_button),
+                                     can_pan && !pan_mode);
+  terminal_window_update_pan_mode (window);
+
+  /* Tied to the window too, as the terminal may outlive it */
+  g_signal_connect_object (vte, "notify::control-mask",
+                           G_CALLBACK (terminal_window_control_mask_changed), window, 0);
+  g_signal_connect_object (vte, "notify::can-pan",
+                           G_CALLBACK (terminal_window_can_pan_changed), window, 0);
+}
+
 static void
 terminal_window_init (TerminalWindow *window)
 {
   //  GtkWidget           *popup;
   GError              *error = NULL;
   gchar               *role;
-  gint                 font_size;
   gboolean             reverse;
   GConfValue          *gconf_value;
-  GSList              *keys;
-  GSList              *key_labels;
   GtkWidget *hildon_app_menu;
   GtkWidget *button;
 
   window->dispose_has_run = FALSE;
+  n_live_windows++;
 
   window->terminal = NULL;
   window->encoding = NULL;
   window->unfs_button = NULL;
+  window->key_buttons = NULL;
   window->take_screenshot_idle_id = 0;
 
   gtk_window_set_title(GTK_WINDOW(window), "X Terminal");
@@ -346,6 +747,19 @@ terminal_window_init (TerminalWindow *window)
   g_signal_connect(G_OBJECT(button), "clicked", (GCallback)terminal_window_action_new_window, window);
   hildon_app_menu_append(HILDON_APP_MENU(hildon_app_menu), GTK_BUTTON(button));
 
+  /* New tab */
+  button = g_object_new(GTK_TYPE_BUTTON, "visible", TRUE, "label", _("New tab"), NULL);
+  g_signal_connect(G_OBJECT(button), "clicked", (GCallback)terminal_window_action_new_tab, window);
+  hildon_app_menu_append(HILDON_APP_MENU(hildon_app_menu), GTK_BUTTON(button));
+
+  /* Split */
+  button = g_object_new(GTK_TYPE_BUTTON, "visible", TRUE, "label", _("Split horizontally"), NULL);
+  g_signal_connect(G_OBJECT(button), "clicked", (GCallback)terminal_window_action_split_horizontally, window);
+  hildon_app_menu_append(HILDON_APP_MENU(hildon_app_menu), GTK_BUTTON(button));
+  button = g_object_new(GTK_TYPE_BUTTON, "visible", TRUE, "label", _("Split vertically"), NULL);
+  g_signal_connect(G_OBJECT(button), "clicked", (GCallback)terminal_window_action_split_vertically, window);
+  hildon_app_menu_append(HILDON_APP_MENU(hildon_app_menu), GTK_BUTTON(button));
+
   /* Select font */
   button = g_object_new(GTK_TYPE_BUTTON, "visible", TRUE, "label", GTK_STOCK_SELECT_FONT, "use-stock", TRUE, NULL);
   g_signal_connect_data(G_OBJECT(button), "clicked", (GCallback)show_font_dialog, window, NULL, G_CONNECT_AFTER | G_CONNECT_SWAPPED);
@@ -374,22 +788,89 @@ terminal_window_init (TerminalWindow *window)
 	g_signal_connect(G_OBJECT(button), "clicked", (GCallback)terminal_window_action_reset_and_clear, window);
 	hildon_app_menu_append(HILDON_APP_MENU(hildon_app_menu), GTK_BUTTON(button));
 
+#ifdef DEBUG
+  /* Show redraws */
+  button = g_object_new(GTK_TYPE_TOGGLE_BUTTON, "visible", TRUE, "label", "Show redraws",
+                        "active", g_getenv("OSSO_XTERM_SHOW_DAMAGE") != NULL, NULL);
+  g_signal_connect(G_OBJECT(button), "toggled", (GCallback)terminal_window_action_show_damage, window);
+  hildon_app_menu_append(HILDON_APP_MENU(hildon_app_menu), GTK_BUTTON(button));
+#endif /* DEBUG */
+
   hildon_window_set_app_menu(HILDON_WINDOW(window), HILDON_APP_MENU(hildon_app_menu));
 
   g_signal_connect( G_OBJECT(window), "key-press-event",
                     G_CALLBACK(terminal_window_key_press_event), NULL);
 
   window->gconf_client = gconf_client_get_default();
-  
-  font_size = gconf_client_get_int(window->gconf_client,
-                                   OSSO_XTERM_GCONF_FONT_SIZE,
-                                   &error);
-  if (error != NULL) {
-      g_printerr("Unable to get font size from gconf: %s\n",
-                 error->message);
-      g_error_free(error);
-      error = NULL;
-  }
+  window->scheduler = frame_scheduler_new();
+
+  /* The terminals, one per tab. Tabs only show once there is more than one. */
+  window->notebook = gtk_notebook_new();
+  gtk_notebook_set_show_tabs(GTK_NOTEBOOK(window->notebook), FALSE);
+  gtk_notebook_set_show_border(GTK_NOTEBOOK(window->notebook), FALSE);
+  gtk_notebook_set_scrollable(GTK_NOTEBOOK(window->notebook), TRUE);
+  g_signal_connect(G_OBJECT(window->notebook), "switch-page",
+                   G_CALLBACK(terminal_window_switch_page), window);
+  gtk_container_add(GTK_CONTAINER(window), window->notebook);
+  gtk_widget_show(window->notebook);
+
+  window->toolbar = gtk_toolbar_new();
+  g_object_set(window->toolbar, "orientation", GTK_ORIENTATION_HORIZONTAL, NULL);
+
+  window->pan_button = g_object_new(GTK_TYPE_TOGGLE_TOOL_BUTTON,
+      "icon-widget", g_object_new(GTK_TYPE_IMAGE,
+                                  "visible", TRUE,
+                                  "icon-name", "browser_panning_mode_off",
+                                  "icon-size", HILDON_ICON_SIZE_TOOLBAR,
+                                  NULL),
+      NULL);
+  g_object_ref_sink(window->pan_button);
+  gtk_tool_item_set_expand(window->pan_button, FALSE);
+  g_signal_connect(G_OBJECT(window->pan_button), "toggled", (GCallback)terminal_window_pan_toggled, window);
+  gtk_toolbar_insert(GTK_TOOLBAR(window->toolbar), window->pan_button, -1);
+
+  window->ctrl_button = g_object_ref_sink(gtk_toggle_tool_button_new());
+  gtk_tool_item_set_expand(window->ctrl_button, FALSE);
+  gtk_tool_button_set_label(GTK_TOOL_BUTTON(window->ctrl_button), "Ctrl");
+  gtk_widget_show(GTK_WIDGET(window->ctrl_button));
+  g_signal_connect(G_OBJECT(window->ctrl_button), "toggled", (GCallback)terminal_window_ctrl_toggled, window);
+  gtk_toolbar_insert(GTK_TOOLBAR(window->toolbar), window->ctrl_button, -1);
+
+  window->unfs_button = GTK_WIDGET(
+      g_object_new(GTK_TYPE_TOGGLE_TOOL_BUTTON,
+                   "visible", TRUE,
+                   "active", FALSE,
+                   "icon-widget", g_object_new(GTK_TYPE_IMAGE,
+                                               "visible", TRUE,
+                                               "icon-name", "general_fullsize",
+                                               "icon-size", HILDON_ICON_SIZE_TOOLBAR,
+                                               NULL),
+                   NULL));
+  g_object_ref_sink(window->unfs_button);
+  g_signal_connect(G_OBJECT(window->unfs_button), "toggled", (GCallback)terminal_window_action_fullscreen, window);
+  gtk_toolbar_insert(GTK_TOOLBAR(window->toolbar), GTK_TOOL_ITEM(window->unfs_button), -1);
+
+  /* The key buttons go between Ctrl and the fullscreen button */
+  terminal_window_gconf_keys(window->gconf_client, 0, NULL, window);
+  terminal_window_update_toolbar(window, FALSE);
+  hildon_window_add_toolbar(HILDON_WINDOW(window), GTK_TOOLBAR(window->toolbar));
+
+  window->toolbar_conid = gconf_client_notify_add(window->gconf_client,
+      OSSO_XTERM_GCONF_TOOLBAR,
+      (GConfClientNotifyFunc)terminal_window_gconf_toolbar,
+      window, NULL, NULL);
+  window->toolbar_fs_conid = gconf_client_notify_add(window->gconf_client,
+      OSSO_XTERM_GCONF_TOOLBAR_FULLSCREEN,
+      (GConfClientNotifyFunc)terminal_window_gconf_toolbar,
+      window, NULL, NULL);
+  window->keys_conid = gconf_client_notify_add(window->gconf_client,
+      OSSO_XTERM_GCONF_KEYS,
+      (GConfClientNotifyFunc)terminal_window_gconf_keys,
+      window, NULL, NULL);
+  window->key_labels_conid = gconf_client_notify_add(window->gconf_client,
+      OSSO_XTERM_GCONF_KEY_LABELS,
+      (GConfClientNotifyFunc)terminal_window_gconf_keys,
+      window, NULL, NULL);
 
   gconf_value = gconf_client_get(window->gconf_client,
                                  OSSO_XTERM_GCONF_REVERSE,
@@ -417,20 +898,6 @@ terminal_window_init (TerminalWindow *window)
       error = NULL;
   }
 
-  keys = gconf_client_get_list(window->gconf_client,
-                                 OSSO_XTERM_GCONF_KEYS,
-                                 GCONF_VALUE_STRING,
-                                 &error);
-  key_labels = gconf_client_get_list(window->gconf_client,
-                                 OSSO_XTERM_GCONF_KEY_LABELS,
-                                 GCONF_VALUE_STRING,
-                                 &error);
-
-  g_slist_foreach(keys, (GFunc)g_free, NULL);
-  g_slist_foreach(key_labels, (GFunc)g_free, NULL);
-  g_slist_free(keys);
-  g_slist_free(key_labels);
-
   /* set a unique role on each window (for session management) */
   role = g_strdup_printf ("Terminal-%p-%d-%d", window, getpid (), (gint) time (NULL));
   gtk_window_set_role (GTK_WINDOW (window), role);
@@ -443,22 +910,47 @@ static void
 terminal_window_dispose (GObject *object)
 {
   TerminalWindow *window = TERMINAL_WINDOW (object);
+  GList *terminals, *iter;
 
   if(window->dispose_has_run)
     return;
   window->dispose_has_run = TRUE;
 
+  /* The notebook takes the terminals down with it once the window goes */
+  terminals = terminal_window_get_terminals (window);
+  for (iter = terminals ; iter != NULL ; iter = iter->next)
+    {
+      g_signal_handlers_disconnect_by_func (TERMINAL_WIDGET (iter->data)->terminal,
+                                            terminal_window_contents_changed, window);
+      g_signal_handlers_disconnect_by_func (TERMINAL_WIDGET (iter->data)->terminal,
+                                            terminal_window_first_paint, window);
+    }
+  g_list_free (terminals);
+
   if (window->terminal != NULL){
-    g_object_unref (window->terminal);
+    terminal_window_unfollow (window);
+    terminal_widget_save_last_session (window->terminal);
     window->terminal = NULL;
   }
 
+  gconf_client_notify_remove(window->gconf_client, window->toolbar_conid);
+  gconf_client_notify_remove(window->gconf_client, window->toolbar_fs_conid);
+  gconf_client_notify_remove(window->gconf_client, window->keys_conid);
+  gconf_client_notify_remove(window->gconf_client, window->key_labels_conid);
+
   g_object_unref(window->copy_button);
   window->copy_button = NULL;
   g_object_unref(window->paste_button);
   window->paste_button = NULL;
   g_object_unref(window->unfs_button);
   window->unfs_button = NULL;
+  g_object_unref(window->pan_button);
+  window->pan_button = NULL;
+  g_object_unref(window->ctrl_button);
+  window->ctrl_button = NULL;
+  g_slist_foreach(window->key_buttons, (GFunc)g_object_unref, NULL);
+  g_slist_free(window->key_buttons);
+  window->key_buttons = NULL;
   g_object_unref(window->match_menu);
   window->match_menu = NULL;
 
@@ -467,6 +959,10 @@ terminal_window_dispose (GObject *object)
     window->take_screenshot_idle_id = 0;
   }
 
+  frame_scheduler_cancel(window->scheduler, window);
+  frame_scheduler_unref(window->scheduler);
+  window->scheduler = NULL;
+
   parent_class->dispose (object);
 }
 
@@ -484,6 +980,8 @@ terminal_window_finalize (GObject *object)
   g_free(window->encoding);
   window->encoding = NULL;
 
+  n_live_windows--;
+
   parent_class->finalize (object);
 }
 
@@ -503,17 +1001,33 @@ terminal_window_update_actions (TerminalWindow *window)
 }
 
 static void
-terminal_window_notify_title(TerminalWidget *terminal,
-                          GParamSpec   *pspec,
-                          TerminalWindow  *window)
+terminal_window_queue_update_actions (TerminalWindow *window)
+{
+  if (window->scheduler != NULL)
+    frame_scheduler_queue (window->scheduler, (FrameUpdateFunc) terminal_window_update_actions, window);
+}
+
+static void
+terminal_window_update_title (TerminalWindow *window)
 {
   TerminalWidget *active_terminal;
-  gchar *terminal_title = terminal_widget_get_title(terminal);
+  gchar *terminal_title;
+
   active_terminal = terminal_window_get_active (window);
-  if (G_LIKELY( terminal == active_terminal )) {
+  if (G_LIKELY (active_terminal != NULL)) {
+    terminal_title = terminal_widget_get_title(active_terminal);
     gtk_window_set_title(GTK_WINDOW(window), terminal_title);
+    g_free(terminal_title);
   }
-  g_free(terminal_title);
+}
+
+static void
+terminal_window_notify_title(TerminalWidget *terminal,
+                          GParamSpec   *pspec,
+                          TerminalWindow  *window)
+{
+  if (G_LIKELY( terminal == terminal_window_get_active (window) && window->scheduler != NULL ))
+    frame_scheduler_queue(window->scheduler, (FrameUpdateFunc)terminal_window_update_title, window);
 }
 
 static void
@@ -526,6 +1040,50 @@ terminal_window_action_new_window (GtkWidget *new_window_button,
 
 }
 
+static void
+terminal_window_action_new_tab (GtkWidget      *new_tab_button,
+                                TerminalWindow *window)
+{
+  GError *error = NULL;
+
+  if (!terminal_window_new_tab (window, NULL, &error)) {
+    hildon_banner_show_information (GTK_WIDGET (window),
+        GTK_STOCK_DIALOG_ERROR,
+        g_dgettext ("gtk20", "Could not open console."));
+    if (error)
+      g_error_free (error);
+  }
+}
+
+static void
+terminal_window_split_or_complain (TerminalWindow *window,
+                                   GtkOrientation  orientation)
+{
+  GError *error = NULL;
+
+  if (!terminal_window_split (window, orientation, &error)) {
+    hildon_banner_show_information (GTK_WIDGET (window),
+        GTK_STOCK_DIALOG_ERROR,
+        g_dgettext ("gtk20", "Could not open console."));
+    if (error)
+      g_error_free (error);
+  }
+}
+
+static void
+terminal_window_action_split_horizontally (GtkWidget      *split_button,
+                                           TerminalWindow *window)
+{
+  terminal_window_split_or_complain (window, GTK_ORIENTATION_HORIZONTAL);
+}
+
+static void
+terminal_window_action_split_vertically (GtkWidget      *split_button,
+                                         TerminalWindow *window)
+{
+  terminal_window_split_or_complain (window, GTK_ORIENTATION_VERTICAL);
+}
+
 /* Check is paste enabled */
 static void
 terminal_window_paste_show (GtkWidget *hildon_app_menu,
@@ -592,6 +1150,19 @@ terminal_window_action_reset_and_clear (GtkWidget *button,
   terminal_widget_reset (active, TRUE);
 }
 
+#ifdef DEBUG
+static void
+terminal_window_action_show_damage (GtkToggleButton *button,
+                                    TerminalWindow  *window)
+{
+  TerminalWidget *active;
+
+  active = terminal_window_get_active (window);
+  if (active != NULL)
+    g_object_set (G_OBJECT (active->terminal), "show-damage", gtk_toggle_button_get_active (button), NULL);
+}
+#endif /* DEBUG */
+
 #if (0)
 static void
 terminal_window_action_encoding (GtkAction       *action,
@@ -624,78 +1195,466 @@ terminal_window_new (void)
 static void 
 terminal_widget_destroyed (GObject *obj, TerminalWindow *window)
 {
+  GList *pages, *iter, *children;
+
 #ifdef DEBUG
   g_debug (__FUNCTION__);
 #endif
   g_assert (TERMINAL_IS_WINDOW (window));
-  if(window->terminal != NULL){
-    g_object_unref(window->terminal);
-    window->terminal = NULL;
-    gtk_widget_destroy (GTK_WIDGET (window));
-  }
+
+  /* The window itself is going, with all its tabs */
+  if (window->dispose_has_run)
+    return;
+
+  /* Its split, or tab, has already let go of it */
+  if (window->terminal == TERMINAL_WIDGET (obj))
+    {
+      terminal_window_unfollow (window);
+      window->terminal = NULL;
+    }
+
+  pages = gtk_container_get_children (GTK_CONTAINER (window->notebook));
+  for (iter = pages ; iter != NULL ; iter = iter->next)
+    {
+      children = gtk_container_get_children (GTK_CONTAINER (iter->data));
+      if (children == NULL)
+        gtk_widget_destroy (GTK_WIDGET (iter->data));
+      else
+        terminal_window_collapse (GTK_WIDGET (children->data));
+      g_list_free (children);
+    }
+  g_list_free (pages);
+
+  if (gtk_notebook_get_n_pages (GTK_NOTEBOOK (window->notebook)) == 0)
+    {
+      gtk_widget_destroy (GTK_WIDGET (window));
+      return;
+    }
+
+  gtk_notebook_set_show_tabs (GTK_NOTEBOOK (window->notebook),
+      gtk_notebook_get_n_pages (GTK_NOTEBOOK (window->notebook)) > 1);
+
+  /* The pane next to it takes over */
+  if (window->terminal == NULL)
+    terminal_window_set_active (window, terminal_window_get_page_active (
+        gtk_notebook_get_nth_page (GTK_NOTEBOOK (window->notebook),
+            gtk_notebook_get_current_page (GTK_NOTEBOOK (window->notebook)))));
 }
 
+/* The toolbar and the window's title go with the pane in use: the Ctrl and
+   pan buttons show its state, and the key buttons send keys to it. */
 static void
-notify_match(GtkWidget *widget, GParamSpec *pspec, TerminalWindow *wnd)
+terminal_window_set_active (TerminalWindow *window,
+                            TerminalWidget *active)
+{
+  GtkWidget *page;
+
+  if (window->dispose_has_run || active == NULL || active == window->terminal)
+    return;
+
+  /* Nothing gets drawn before the terminal is back to what it was */
+  terminal_widget_wake (active);
+  terminal_widget_touch (active);
+
+  if (window->terminal != NULL)
+    {
+      terminal_widget_touch (window->terminal);
+      terminal_window_unfollow (window);
+      terminal_widget_set_app_win (window->terminal, NULL);
+    }
+
+  window->terminal = active;
+  page = terminal_window_get_page (window, GTK_WIDGET (active));
+  if (page != NULL)
+    g_object_set_data (G_OBJECT (page), "active-terminal", active);
+
+  terminal_widget_set_app_win (active, HILDON_WINDOW (window));
+  terminal_window_follow (window);
+
+  terminal_window_update_actions (window);
+  terminal_window_update_tab_title (active, NULL, window);
+  if (window->scheduler != NULL)
+    frame_scheduler_queue (window->scheduler, (FrameUpdateFunc)terminal_window_update_title, window);
+  if (!GTK_WIDGET_HAS_FOCUS (active->terminal))
+    gtk_widget_grab_focus (active->terminal);
+
+  g_signal_emit (G_OBJECT (window),
+                 terminal_window_signals[SIGNAL_ACTIVE_CHANGED], 0);
+}
+
+static void
+terminal_window_switch_page (GtkNotebook     *notebook,
+                             GtkNotebookPage *page,
+                             guint            page_num,
+                             TerminalWindow  *window)
+{
+  if (window->dispose_has_run)
+    return;
+
+  terminal_window_set_active (window,
+      terminal_window_get_page_active (gtk_notebook_get_nth_page (notebook, page_num)));
+}
+
+/* Tapping a pane makes it the one in use */
+static gboolean
+terminal_window_terminal_focus_in (GtkWidget      *terminal,
+                                   GdkEventFocus  *event,
+                                   TerminalWindow *window)
+{
+  GtkWidget *widget = gtk_widget_get_ancestor (terminal, TERMINAL_TYPE_WIDGET);
+
+  if (widget != NULL)
+    terminal_window_set_active (window, TERMINAL_WIDGET (widget));
+
+  return FALSE;
+}
+
+/* A tab is labelled after the pane in use in it */
+static void
+terminal_window_update_tab_title (TerminalWidget *terminal,
+                                  GParamSpec     *pspec,
+                                  TerminalWindow *window)
+{
+  GtkWidget *page = terminal_window_get_page (window, GTK_WIDGET (terminal));
+  gchar *title;
+
+  if (page == NULL || terminal_window_get_page_active (page) != terminal)
+    return;
+
+  title = terminal_widget_get_title (terminal);
+  g_object_set (G_OBJECT (gtk_notebook_get_tab_label (GTK_NOTEBOOK (window->notebook), page)),
+                "title", title, NULL);
+  g_free (title);
+}
+
+/* Closes every pane in the tab */
+static void
+terminal_window_close_page (GtkWidget *page)
+{
+  GList *terminals = NULL;
+
+  terminal_window_collect_terminals (page, &terminals);
+  g_list_foreach (terminals, (GFunc) g_object_ref, NULL);
+  g_list_foreach (terminals, (GFunc) gtk_widget_destroy, NULL);
+  g_list_foreach (terminals, (GFunc) g_object_unref, NULL);
+  g_list_free (terminals);
+}
+
+static void
+update_match(TerminalWindow *wnd)
 {
   char *match = NULL;
 
-  g_object_get(G_OBJECT(widget), "match", &match, NULL);
+  if (wnd->terminal == NULL)
+    return;
+
+  g_object_get(G_OBJECT(wnd->terminal->terminal), "match", &match, NULL);
   if (match) {
     g_object_set_data_full(G_OBJECT(wnd->match_menu), "match", match, (GDestroyNotify)g_free);
     hildon_app_menu_popup(wnd->match_menu, GTK_WINDOW(wnd));
   }
 }
 
+static void
+notify_match(GtkWidget *widget, GParamSpec *pspec, TerminalWindow *wnd)
+{
+  if (wnd->scheduler)
+    frame_scheduler_queue(wnd->scheduler, (FrameUpdateFunc)update_match, wnd);
+}
+
+/* Tell the user and anyone listening on D-Bus that a watched pattern showed
+   up in a terminal they are not looking at */
+static void
+terminal_window_watch_triggered(TerminalWidget *widget, const gchar *pattern, TerminalWindow *window)
+{
+  DBusConnection *conn;
+  gchar *title;
+
+  if (gtk_window_is_active(GTK_WINDOW(window)) && widget == window->terminal)
+    return;
+
+  title = terminal_widget_get_title(widget);
+  hildon_banner_show_informationf(GTK_WIDGET(window), NULL, "%s: %s", title, pattern);
+  g_free(title);
+
+  conn = dbus_bus_get(DBUS_BUS_SESSION, NULL);
+  if (conn) {
+    DBusMessage *msg = dbus_message_new_signal("/com/nokia/xterm", "com.nokia.xterm", "watch_triggered");
+    if (msg) {
+      dbus_uint32_t id = terminal_widget_get_id(widget);
+
+      if (dbus_message_append_args(msg, DBUS_TYPE_UINT32, &id, DBUS_TYPE_STRING, &pattern, DBUS_TYPE_INVALID))
+        dbus_connection_send(conn, msg, NULL);
+      dbus_message_unref(msg);
+    }
+    dbus_connection_unref(conn);
+  }
+}
+
+static gchar *
+screenshot_stamp_file_name (void)
+{
+  return g_build_filename (g_get_home_dir (), ".cache", "osso-xterm", "screenshot-settings", NULL);
+}
+
+/* A digest of the values of screenshot_keys */
+static gchar *
+screenshot_settings_digest (GConfClient *client)
+{
+  GString *str = g_string_new (NULL);
+  GConfValue *value;
+  gchar *digest;
+  guint Nix;
+
+  for (Nix = 0 ; Nix < ALEN (screenshot_keys) ; Nix++) {
+    value = gconf_client_get (client, screenshot_keys[Nix], NULL);
+    if (value) {
+      gchar *value_str = gconf_value_to_string (value);
+
+      g_string_append_printf (str, "%s=%s\n", screenshot_keys[Nix], value_str);
+      g_free (value_str);
+      gconf_value_free (value);
+    }
+  }
+
+  digest = g_compute_checksum_for_string (G_CHECKSUM_MD5, str->str, str->len);
+  g_string_free (str, TRUE);
+
+  return digest;
+}
+
+/* Whether the screenshot there is was taken with the settings there are now */
+static gboolean
+screenshot_is_current (GConfClient *client)
+{
+  gchar *file_name, *stamp = NULL, *digest;
+  gboolean current = FALSE;
+
+  if (!g_file_test (OSSO_XTERM_SCREENSHOT_FILE_NAME, G_FILE_TEST_EXISTS))
+    return FALSE;
+
+  file_name = screenshot_stamp_file_name ();
+  if (g_file_get_contents (file_name, &stamp, NULL, NULL)) {
+    digest = screenshot_settings_digest (client);
+    current = !strcmp (g_strstrip (stamp), digest);
+    g_free (digest);
+    g_free (stamp);
+  }
+  g_free (file_name);
+
+  return current;
+}
+
 static gboolean
-maybe_take_screenshot(TerminalWindow *window)
+maybe_take_screenshot (TerminalWindow *window)
 {
-  if (!g_file_test(OSSO_XTERM_SCREENSHOT_FILE_NAME, G_FILE_TEST_EXISTS))
-    hildon_gtk_window_take_screenshot(GTK_WINDOW(window), TRUE);
+  gchar *file_name, *dir_name, *digest;
+
   window->take_screenshot_idle_id = 0;
 
+  if (screenshot_checked)
+    return FALSE;
+  screenshot_checked = TRUE;
+
+  if (screenshot_is_current (window->gconf_client))
+    return FALSE;
+
+  hildon_gtk_window_take_screenshot (GTK_WINDOW (window), TRUE);
+
+  file_name = screenshot_stamp_file_name ();
+  dir_name = g_path_get_dirname (file_name);
+  digest = screenshot_settings_digest (window->gconf_client);
+  g_mkdir_with_parents (dir_name, 0700);
+  g_file_set_contents (file_name, digest, -1, NULL);
+  g_free (digest);
+  g_free (dir_name);
+  g_free (file_name);
+
   return FALSE;
 }
 
+/* The terminal has been drawn with the child's output on it. The screenshot
+   is taken once everything else is done. */
+static gboolean
+terminal_window_first_paint (GtkWidget      *terminal,
+                             GdkEventExpose *event,
+                             TerminalWindow *window)
+{
+  g_signal_handlers_disconnect_by_func (terminal, terminal_window_first_paint, window);
+
+  if (!screenshot_checked && !window->take_screenshot_idle_id)
+    window->take_screenshot_idle_id =
+      g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc)maybe_take_screenshot, window, NULL);
+
+  return FALSE;
+}
+
+/* Waits for the child's first output, rather than the preview of the last
+   session or a blank terminal, before waiting for it to be drawn */
 static void
-terminal_window_real_add (
-    TerminalWindow *window,
-    TerminalWidget *widget)
+terminal_window_contents_changed (GtkWidget      *terminal,
+                                  TerminalWindow *window)
 {
-  /*
-    gchar *title = terminal_widget_get_title(widget);
-    g_object_set(GTK_WINDOW (window), "title", title, NULL);
-    g_free(title);
-  */
-    gtk_container_add(GTK_CONTAINER (window), GTK_WIDGET(widget));
+  if (maemo_vte_is_showing_preview (MAEMO_VTE (terminal)))
+    return;
+
+  g_signal_handlers_disconnect_by_func (terminal, terminal_window_contents_changed, window);
+  g_signal_connect_after (G_OBJECT (terminal), "expose-event",
+                          G_CALLBACK (terminal_window_first_paint), window);
+}
 
-    /* add terminal to window */
-    window->terminal = g_object_ref_sink(widget);
+/**
+ * terminal_window_expire_screenshot:
+ * @key : the GConf key that has changed
+ *
+ * Removes the launch screenshot if @key is one of the settings it depends
+ * on and the settings differ from those it was taken with.
+ **/
+void
+terminal_window_expire_screenshot (const gchar *key)
+{
+  GConfClient *client;
+  gchar *file_name;
+  guint Nix;
+
+  for (Nix = 0 ; Nix < ALEN (screenshot_keys) ; Nix++)
+    if (!strcmp (key, screenshot_keys[Nix]))
+      break;
+  if (Nix == ALEN (screenshot_keys))
+    return;
 
+  client = gconf_client_get_default ();
+  if (!screenshot_is_current (client)) {
+    g_unlink (OSSO_XTERM_SCREENSHOT_FILE_NAME);
+    file_name = screenshot_stamp_file_name ();
+    g_unlink (file_name);
+    g_free (file_name);
+    screenshot_checked = FALSE;
+  }
+  g_object_unref (client);
+}
+
+/* Hooks @widget up to the window, wherever in it it is going to be */
+static void
+terminal_window_attach (
+    TerminalWindow *window,
+    TerminalWidget *widget)
+{
     g_signal_connect(G_OBJECT(widget), "notify::title",
   		    G_CALLBACK(terminal_window_notify_title), window);
+    g_signal_connect(G_OBJECT(widget), "notify::title",
+  		    G_CALLBACK(terminal_window_update_tab_title), window);
     g_signal_connect (G_OBJECT (widget), "destroy",
                       G_CALLBACK (terminal_widget_destroyed), window);
     g_signal_connect_swapped (G_OBJECT (widget), "selection-changed",
-                              G_CALLBACK (terminal_window_update_actions), window);
-    terminal_window_update_actions (window);
+                              G_CALLBACK (terminal_window_queue_update_actions), window);
+    terminal_widget_set_frame_scheduler (widget, window->scheduler);
     g_signal_connect(G_OBJECT(widget->terminal), "notify::match", (GCallback)notify_match, window);
+    g_signal_connect(G_OBJECT(widget->terminal), "focus-in-event", (GCallback)terminal_window_terminal_focus_in, window);
+    g_signal_connect(G_OBJECT(widget), "watch-triggered", (GCallback)terminal_window_watch_triggered, window);
 
-    window->unfs_button = GTK_WIDGET(
-        g_object_new(GTK_TYPE_TOGGLE_TOOL_BUTTON,
-                     "visible", TRUE,
-                     "active", FALSE,
-                     "icon-widget", g_object_new(GTK_TYPE_IMAGE,
-                                                 "visible", TRUE,
-                                                 "icon-name", "general_fullsize",
-                                                 "icon-size", HILDON_ICON_SIZE_TOOLBAR,
-                                                 NULL),
-                     NULL));
-    g_object_ref_sink(window->unfs_button);
-    g_signal_connect(G_OBJECT(window->unfs_button), "toggled", (GCallback)terminal_window_action_fullscreen, window);
-    terminal_widget_add_tool_item(TERMINAL_WIDGET(widget), GTK_TOOL_ITEM(window->unfs_button));
+  if (!screenshot_checked)
+    g_signal_connect (G_OBJECT (widget->terminal), "contents-changed",
+                      G_CALLBACK (terminal_window_contents_changed), window);
+}
 
-  window->take_screenshot_idle_id = g_idle_add((GSourceFunc)maybe_take_screenshot, window);
+static void
+terminal_window_real_add (
+    TerminalWindow *window,
+    TerminalWidget *widget)
+{
+    GtkWidget *header, *page;
+    gint page_num;
+
+    terminal_window_attach (window, widget);
+
+    page = gtk_vbox_new (FALSE, 0);
+    gtk_box_pack_start (GTK_BOX (page), GTK_WIDGET (widget), TRUE, TRUE, 0);
+    gtk_widget_show (page);
+
+    header = terminal_tab_header_new ();
+    g_signal_connect_object (G_OBJECT (header), "close",
+                             G_CALLBACK (terminal_window_close_page), page, G_CONNECT_SWAPPED);
+    gtk_widget_show (header);
+
+    /* The first page is switched to as it is added */
+    page_num = gtk_notebook_append_page (GTK_NOTEBOOK (window->notebook), page, header);
+    gtk_notebook_set_tab_reorderable (GTK_NOTEBOOK (window->notebook), page, TRUE);
+    gtk_notebook_set_show_tabs (GTK_NOTEBOOK (window->notebook),
+        gtk_notebook_get_n_pages (GTK_NOTEBOOK (window->notebook)) > 1);
+    gtk_notebook_set_current_page (GTK_NOTEBOOK (window->notebook), page_num);
+    terminal_window_update_tab_title (widget, NULL, window);
+}
+
+/* A terminal for @window that is to run @command, or the shell */
+static TerminalWidget *
+terminal_window_create_terminal (TerminalWindow *window,
+                                 const gchar    *command)
+{
+  GtkWidget *terminal;
+
+  /* setup the terminal widget */
+  terminal = terminal_widget_new ();
+  terminal_widget_set_working_directory(TERMINAL_WIDGET(terminal),
+		 g_get_home_dir());
+  gtk_widget_show (GTK_WIDGET (terminal));
+
+  if (command) {
+    gint argc;
+    gchar **argv;
+
+    if (g_shell_parse_argv(command,
+	  &argc,
+	  &argv,
+	  NULL)) {
+      terminal_widget_set_custom_command(TERMINAL_WIDGET (terminal),
+	  argv);
+      g_strfreev(argv);
+    }
+  }
+
+  return TERMINAL_WIDGET (terminal);
+}
+
+/* Starts the child of @terminal, once it is in the window */
+static gboolean
+terminal_window_start_terminal (TerminalWindow *window,
+                                TerminalWidget *terminal)
+{
+  if (!terminal_widget_launch_child (terminal))
+    return FALSE;
+
+  if (window->encoding == NULL) {
+    gconf_client_set_string(window->gconf_client, OSSO_XTERM_GCONF_ENCODING, 
+			    OSSO_XTERM_DEFAULT_ENCODING, NULL);
+    window->encoding = g_strdup (OSSO_XTERM_DEFAULT_ENCODING);
+  }
+  g_object_set (terminal, "encoding", window->encoding, NULL);
+
+  return TRUE;
+}
+
+/* Adds a terminal running @command, or the shell, as a new tab. With a
+   @session, the terminal takes that over instead. */
+static TerminalWidget *
+terminal_window_launch_terminal (TerminalWindow *window,
+                                 const gchar    *command,
+                                 guint           session,
+                                 GError        **error)
+{
+  TerminalWidget *terminal = terminal_window_create_terminal (window, command);
+
+  terminal_widget_set_session (terminal, session);
+  terminal_window_real_add (window, terminal);
+
+  if (!terminal_window_start_terminal (window, terminal)) {
+    /* A window with nothing else in it is left for the caller to get rid of */
+    if (gtk_notebook_get_n_pages (GTK_NOTEBOOK (window->notebook)) > 1)
+      gtk_widget_destroy (GTK_WIDGET (terminal));
+    return NULL;
+  }
+
+  return terminal;
 }
 
 /**
@@ -726,50 +1685,119 @@ terminal_window_launch (
     const gchar *command,
     GError **error)
 {
-  gboolean child_launched = FALSE;
-  GtkWidget *terminal;
+  g_return_val_if_fail (TERMINAL_IS_WINDOW (window), FALSE);
+
+  if (terminal_window_launch_terminal (window, command, 0, error) == NULL)
+    return FALSE;
 
+  gtk_widget_show_all(GTK_WIDGET(window));
+
+  /*  g_idle_add ((GSourceFunc)_im_context_focus, window->terminal); */
+  return TRUE;
+}
+
+/**
+ * terminal_window_new_tab:
+ * @window  : A #TerminalWindow.
+ * @command : The command to run, or %NULL for the shell.
+ * @error   : Location to store error to, or %NULL.
+ *
+ * Opens another terminal in @window, in a tab of its own, and shows it. The
+ * window's menu, toolbar and settings are shared with its other tabs.
+ *
+ * Return value : %TRUE on success, %FALSE on error.
+ **/
+gboolean
+terminal_window_new_tab (TerminalWindow *window,
+                         const gchar    *command,
+                         GError        **error)
+{
   g_return_val_if_fail (TERMINAL_IS_WINDOW (window), FALSE);
 
-  /* setup the terminal widget */
-  terminal = terminal_widget_new ();
-  terminal_widget_set_working_directory(TERMINAL_WIDGET(terminal),
-		 g_get_home_dir());
-  terminal_widget_set_app_win (TERMINAL_WIDGET (terminal), HILDON_WINDOW (window));
+  return terminal_window_launch_terminal (window, command, 0, error) != NULL;
+}
 
-  gtk_widget_show (GTK_WIDGET (terminal));
-  terminal_window_real_add (window, TERMINAL_WIDGET(terminal));
-  if (command) {
-    gint argc;
-    gchar **argv;
+/**
+ * terminal_window_attach_session:
+ * @window  : A #TerminalWindow.
+ * @session : A session osso-xterm-sessiond holds with nobody attached.
+ * @error   : Location to store error to, or %NULL.
+ *
+ * Opens a tab in @window for a shell left behind by an earlier osso-xterm,
+ * showing what it kept of its output before carrying on with it.
+ *
+ * Return value : %TRUE on success, %FALSE on error.
+ **/
+gboolean
+terminal_window_attach_session (TerminalWindow *window,
+                                guint           session,
+                                GError        **error)
+{
+  g_return_val_if_fail (TERMINAL_IS_WINDOW (window), FALSE);
 
-    if (g_shell_parse_argv(command,
-	  &argc,
-	  &argv,
-	  NULL)) {
-      terminal_widget_set_custom_command(TERMINAL_WIDGET (terminal),
-	  argv);
-      g_strfreev(argv);
-    }
-  }
+  if (terminal_window_launch_terminal (window, NULL, session, error) == NULL)
+    return FALSE;
 
-  child_launched = terminal_widget_launch_child (TERMINAL_WIDGET (terminal));
+  gtk_widget_show_all (GTK_WIDGET (window));
 
-  if (child_launched) {
-    gtk_widget_show_all(GTK_WIDGET(window));
+  return TRUE;
+}
 
-    if (window->encoding == NULL) {
-      gconf_client_set_string(window->gconf_client, OSSO_XTERM_GCONF_ENCODING, 
-			      OSSO_XTERM_DEFAULT_ENCODING, NULL);
-      g_object_set (window->terminal, "encoding", 
-		    OSSO_XTERM_DEFAULT_ENCODING, NULL);
-    } else {
-      g_object_set (window->terminal, "encoding", window->encoding, NULL);
-    }
+/**
+ * terminal_window_split:
+ * @window      : A #TerminalWindow.
+ * @orientation : %GTK_ORIENTATION_HORIZONTAL to open the new pane beside the
+ *                one in use, %GTK_ORIENTATION_VERTICAL to open it below.
+ * @error       : Location to store error to, or %NULL.
+ *
+ * Splits the pane in use in two, with a new shell in the second half. Only
+ * the two halves are resized when the split is moved, and GTK+ lays them out
+ * once per frame however many motion events the drag brings.
+ *
+ * Return value : %TRUE on success, %FALSE on error.
+ **/
+gboolean
+terminal_window_split (TerminalWindow *window,
+                       GtkOrientation  orientation,
+                       GError        **error)
+{
+  TerminalWidget *active, *terminal;
+  GtkWidget *paned;
+  gint size;
 
-  /*  g_idle_add ((GSourceFunc)_im_context_focus, window->terminal); */
+  g_return_val_if_fail (TERMINAL_IS_WINDOW (window), FALSE);
+
+  active = window->terminal;
+  if (active == NULL)
+    return FALSE;
+
+  size = (orientation == GTK_ORIENTATION_HORIZONTAL)
+    ? GTK_WIDGET (active)->allocation.width
+    : GTK_WIDGET (active)->allocation.height;
+
+  paned = (orientation == GTK_ORIENTATION_HORIZONTAL) ? gtk_hpaned_new () : gtk_vpaned_new ();
+  gtk_widget_show (paned);
+
+  g_object_ref (active);
+  terminal_window_replace (GTK_WIDGET (active), paned);
+  gtk_paned_pack1 (GTK_PANED (paned), GTK_WIDGET (active), TRUE, TRUE);
+  g_object_unref (active);
+  if (size > 1)
+    gtk_paned_set_position (GTK_PANED (paned), size / 2);
+
+  terminal = terminal_window_create_terminal (window, NULL);
+  terminal_window_attach (window, terminal);
+  gtk_paned_pack2 (GTK_PANED (paned), GTK_WIDGET (terminal), TRUE, TRUE);
+
+  if (!terminal_window_start_terminal (window, terminal)) {
+    /* The split goes again with it */
+    gtk_widget_destroy (GTK_WIDGET (terminal));
+    return FALSE;
   }
-  return child_launched;
+
+  terminal_window_set_active (window, terminal);
+
+  return TRUE;
 }
 
 void terminal_window_set_state (TerminalWindow *window, gboolean go_fs)
@@ -779,14 +1807,60 @@ void terminal_window_set_state (TerminalWindow *window, gboolean go_fs)
     if(go_fs){
       if(!fs){
         gtk_window_fullscreen(GTK_WINDOW(window));
-        terminal_widget_update_tool_bar(
-            window->terminal, terminal_widget_need_toolbar(window->terminal));
+        terminal_window_update_toolbar(window, TRUE);
       }
     } else {
       if(fs){
         gtk_window_unfullscreen(GTK_WINDOW(window));
-        terminal_widget_update_tool_bar(
-            window->terminal, terminal_widget_need_fullscreen_toolbar(window->terminal));
+        terminal_window_update_toolbar(window, FALSE);
       }
     }
 }
+
+/**
+ * terminal_window_get_terminals:
+ * @window : A #TerminalWindow.
+ *
+ * Return value : The #TerminalWidget<!-- -->s shown in @window. Free the list
+ *                with g_list_free().
+ **/
+GList *
+terminal_window_get_terminals (TerminalWindow *window)
+{
+  GList *terminals = NULL;
+
+  g_return_val_if_fail (TERMINAL_IS_WINDOW (window), NULL);
+
+  terminal_window_collect_terminals (window->notebook, &terminals);
+
+  return g_list_reverse (terminals);
+}
+
+/**
+ * terminal_window_get_frame_stats:
+ * @window : A #TerminalWindow.
+ * @stats  : Location to store the counters of the window's update scheduler.
+ **/
+void
+terminal_window_get_frame_stats (TerminalWindow      *window,
+                                 FrameSchedulerStats *stats)
+{
+  g_return_if_fail (TERMINAL_IS_WINDOW (window));
+
+  if (window->scheduler != NULL)
+    frame_scheduler_get_stats (window->scheduler, stats);
+  else
+    memset (stats, 0, sizeof (*stats));
+}
+
+/**
+ * terminal_window_get_n_live:
+ *
+ * Return value : The number of windows created and not yet finalized. It
+ *                should drop back once windows are closed.
+ **/
+guint
+terminal_window_get_n_live (void)
+{
+  return n_live_windows;
+}
@@ -69,11 +69,34 @@ gboolean   terminal_window_launch (TerminalWindow     *window,
     				const gchar     *command,
                                 GError          **error);
 
+gboolean   terminal_window_new_tab (TerminalWindow  *window,
+                                    const gchar     *command,
+                                    GError         **error);
+
+gboolean   terminal_window_attach_session (TerminalWindow  *window,
+                                           guint            session,
+                                           GError         **error);
+
+gboolean   terminal_window_split (TerminalWindow  *window,
+                                  GtkOrientation   orientation,
+                                  GError         **error);
+
+TerminalWidget *terminal_window_get_active (TerminalWindow *window);
+
 
 void terminal_window_new_window (TerminalWindow  *window);
 
 void terminal_window_set_state (TerminalWindow *window, gboolean go_fs);
 
+GList *terminal_window_get_terminals (TerminalWindow *window);
+
+void terminal_window_get_frame_stats (TerminalWindow      *window,
+                                      FrameSchedulerStats *stats);
+
+guint terminal_window_get_n_live (void);
+
+void terminal_window_expire_screenshot (const gchar *key);
+
 G_END_DECLS;
 
 #endif /* !__TERMINAL_WINDOW_H__ */
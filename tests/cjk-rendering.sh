@@ -0,0 +1,67 @@
+#!/bin/sh
+# Showing CJK text the terminal font does not cover, first with no fallbacks
+# found yet (cold) and then with those the first run saved under ~/.cache
+# (warm). ms is from starting osso-xterm to the text having been read,
+# pages the number of pages with a fallback search behind them.
+# frame_max_us and frame_avg_us are Vte's drawing times from
+# get_stats; max_reply_ms is the slowest get_memory round trip while the text
+# comes in and its fallbacks are searched for, which is how long the main
+# loop was kept from everything else.
+#
+# Timings rather than a pass or fail, so not part of make check: make bench.
+
+. "$(dirname "$0")/harness.sh"
+
+: ${REPEAT:=20}
+
+# Hiragana and Katakana, the CJK ideographs and Hangul, 39 wide characters to
+# an 80 column line. UTF-8 is written out byte by byte, whatever awk would
+# make of a codepoint.
+LC_ALL=C awk -v repeat=$REPEAT '
+  function put(c) {
+    printf "%c%c%c", 224 + int(c / 4096), 128 + int(c / 64) % 64, 128 + c % 64
+    if (++n % 39 == 0)
+      printf "\n"
+  }
+  BEGIN {
+    for (r = 0; r < repeat; r++) {
+      for (c = 12352; c < 12544; c++) put(c)
+      for (c = 19968; c < 40960; c += 64) put(c)
+      for (c = 44032; c < 55204; c += 64) put(c)
+    }
+    printf "\n"
+  }' > "$HARNESS_DIR/text"
+
+cat > "$HARNESS_DIR/show.sh" <<'EOF'
+cat "$1"
+date +%s%N > "$2.tmp" && mv "$2.tmp" "$2"
+exec sleep 100000
+EOF
+
+fallbacks=$HOME/.cache/osso-xterm/font-fallback
+
+for cache in cold warm; do
+  rm -f "$HARNESS_DIR/done"
+  start=$(date +%s%N)
+  harness_start "sh $HARNESS_DIR/show.sh $HARNESS_DIR/text $HARNESS_DIR/done"
+
+  # The fallbacks are saved a few seconds after the last one is found
+  max_reply=0
+  while [ ! -f "$HARNESS_DIR/done" ] || { [ $cache = cold ] && [ ! -f "$fallbacks" ]; }; do
+    before=$(harness_now_ms)
+    harness_call get_memory >/dev/null || exit 1
+    reply=$(($(harness_now_ms) - before))
+    [ $reply -gt $max_reply ] && max_reply=$reply
+    if [ $(((before - start / 1000000) / 1000)) -gt 120 ]; then
+      echo "$0: cache=$cache did not finish in 2 minutes" >&2
+      exit 1
+    fi
+    sleep 0.1
+  done
+
+  ms=$((($(cat "$HARNESS_DIR/done") - start) / 1000000))
+  frames=$(harness_call get_stats | sed -n 's/.* \(frame_avg_us=[0-9]* frame_max_us=[0-9]*\).*/\1/p' | head -n 1)
+  echo "cache=$cache pages=$(wc -l < "$fallbacks") ms=$ms $frames max_reply_ms=$max_reply"
+
+  harness_stop
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+# What noting the time of each line (line_times) costs the feed: one
+# terminal cats $FEED_LINES short lines, with line_times off and then on. ms is
+# from run_command to cat being done, which it only is once osso-xterm has
+# read it all off the pty, and lines_per_s the lines over that.
+# frame_avg_us and frame_max_us are Vte's drawing times from get_stats, and
+# max_reply_ms the slowest get_memory round trip meanwhile.
+#
+# Line times are only taken on a pty of our own, so threaded_pty is on.
+# Timings rather than a pass or fail, so not part of make check: make bench.
+
+. "$(dirname "$0")/harness.sh"
+
+: ${FEED_LINES:=200000}
+
+# Short lines, as the cost is per line rather than per byte
+awk "BEGIN { for (i = 0; i < $FEED_LINES; i++) printf \"%09d\\n\", i }" > "$HARNESS_DIR/text"
+cat > "$HARNESS_DIR/flood.sh" <<'EOS'
+cat "$1"
+date +%s%N > "$2.tmp" && mv "$2.tmp" "$2"
+EOS
+
+harness_set threaded_pty bool true
+harness_set session_holder bool false
+
+for line_times in false true; do
+  harness_set line_times bool $line_times
+  harness_start "sleep 100000"
+  rm -f "$HARNESS_DIR/done"
+
+  start=$(date +%s%N)
+  harness_call run_command \
+    "string:sh $HARNESS_DIR/flood.sh $HARNESS_DIR/text $HARNESS_DIR/done" >/dev/null || exit 1
+
+  max_reply=0
+  while [ ! -f "$HARNESS_DIR/done" ]; do
+    before=$(harness_now_ms)
+    harness_call get_memory >/dev/null || exit 1
+    reply=$(($(harness_now_ms) - before))
+    [ $reply -gt $max_reply ] && max_reply=$reply
+    if [ $(((before - start / 1000000) / 1000)) -gt 600 ]; then
+      echo "$0: line_times=$line_times did not finish in 10 minutes" >&2
+      exit 1
+    fi
+    sleep 0.1
+  done
+
+  ms=$((($(cat "$HARNESS_DIR/done") - start) / 1000000))
+  [ $ms -gt 0 ] || ms=1
+  frames=$(harness_call get_stats | sed -n 's/.* \(frame_avg_us=[0-9]* frame_max_us=[0-9]*\).*/\1/p' | tail -n 1)
+  echo "line_times=$line_times lines=$FEED_LINES ms=$ms lines_per_s=$((FEED_LINES * 1000 / ms)) $frames max_reply_ms=$max_reply"
+
+  harness_stop
+done
@@ -0,0 +1,107 @@
+# Sourced by the scripts in this directory. Runs osso-xterm in an X server,
+# session bus, GConf and home directory of its own, and talks to it over
+# D-Bus. Exits 77, which make check counts as skipped, when the tools for
+# that are missing.
+
+: ${OSSO_XTERM:=$(dirname "$0")/../src/osso-xterm}
+
+harness_need()
+{
+  for tool in "$@"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+      echo "$0: skipped, no $tool" >&2
+      exit 77
+    fi
+  done
+}
+
+# The script runs again inside the X server and session bus
+if [ -z "$HARNESS_SESSION" ]; then
+  harness_need xvfb-run dbus-launch dbus-send gconftool-2
+  if [ ! -x "$OSSO_XTERM" ]; then
+    echo "$0: skipped, no $OSSO_XTERM" >&2
+    exit 77
+  fi
+  HARNESS_SESSION=1
+  export HARNESS_SESSION OSSO_XTERM
+  exec xvfb-run -a dbus-launch --exit-with-session /bin/sh "$0" "$@"
+fi
+
+# A fresh home keeps the settings of the user out of it, and TMPDIR a gconfd
+# of its own
+HARNESS_DIR=$(mktemp -d "${TMPDIR:-/tmp}/osso-xterm-test.XXXXXX") || exit 1
+HOME=$HARNESS_DIR/home
+TMPDIR=$HARNESS_DIR
+export HOME TMPDIR
+mkdir "$HOME"
+HARNESS_PID=
+
+harness_cleanup()
+{
+  harness_stop
+  gconftool-2 --shutdown >/dev/null 2>&1
+  rm -rf "$HARNESS_DIR"
+}
+trap harness_cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+harness_now_ms()
+{
+  echo $(($(date +%s%N) / 1000000))
+}
+
+# harness_set <key under /apps/osso/xterm> <bool|int|string> <value>
+harness_set()
+{
+  gconftool-2 --type "$2" --set "/apps/osso/xterm/$1" "$3"
+}
+
+harness_has_owner()
+{
+  dbus-send --session --print-reply --dest=org.freedesktop.DBus \
+    /org/freedesktop/DBus org.freedesktop.DBus.NameHasOwner \
+    string:com.nokia.xterm 2>/dev/null | grep -q 'boolean true'
+}
+
+# harness_call <method> [<dbus-send argument>...]
+# Prints the string or boolean returned. Only call once osso-xterm is up:
+# before that the call would start whichever one is installed.
+harness_call()
+{
+  harness_method=$1
+  shift
+  harness_reply=$(dbus-send --session --print-reply --reply-timeout=30000 \
+                    --dest=com.nokia.xterm /com/nokia/xterm \
+                    "com.nokia.xterm.$harness_method" "$@" 2>&1) || {
+    echo "$0: $harness_method failed: $harness_reply" >&2
+    return 1
+  }
+  printf '%s\n' "$harness_reply" | sed -n 's/^ *string "\(.*\)"$/\1/p; s/^ *boolean //p'
+}
+
+# harness_start <command of the first window>
+harness_start()
+{
+  "$OSSO_XTERM" "$1" >>"$HARNESS_DIR/osso-xterm.log" 2>&1 &
+  HARNESS_PID=$!
+
+  harness_tries=0
+  until harness_has_owner; do
+    harness_tries=$((harness_tries + 1))
+    if [ $harness_tries -gt 300 ] || ! kill -0 $HARNESS_PID 2>/dev/null; then
+      echo "$0: osso-xterm did not come up" >&2
+      cat "$HARNESS_DIR/osso-xterm.log" >&2
+      exit 1
+    fi
+    sleep 0.1
+  done
+}
+
+harness_stop()
+{
+  if [ -n "$HARNESS_PID" ]; then
+    kill $HARNESS_PID 2>/dev/null
+    wait $HARNESS_PID 2>/dev/null
+    HARNESS_PID=
+  fi
+}
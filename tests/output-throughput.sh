@@ -0,0 +1,59 @@
+#!/bin/sh
+# Output throughput with threaded_pty off and on, for 1, 4 and 16 terminals
+# receiving output at once. Each terminal cats $BYTES of 80 column lines, and
+# cat only returns once osso-xterm has read it all off the pty; the figure is
+# the bytes over the time from the first run_command to the last cat being
+# done. max_reply_ms is the slowest get_memory round trip meanwhile, as a
+# measure of how long the main loop is kept from everything else.
+#
+# Timings rather than a pass or fail, so not part of make check: make bench.
+
+. "$(dirname "$0")/harness.sh"
+
+: ${BYTES:=4000000}
+: ${TERMINALS:=1 4 16}
+
+awk "BEGIN { for (i = 0; i < $BYTES / 80; i++) printf \"%079d\\n\", i }" > "$HARNESS_DIR/text"
+cat > "$HARNESS_DIR/flood.sh" <<'EOF'
+cat "$1"
+date +%s%N > "$2.tmp" && mv "$2.tmp" "$2"
+EOF
+
+# osso-xterm-sessiond would only add a hop of its own
+harness_set session_holder bool false
+
+for threaded in false true; do
+  harness_set threaded_pty bool $threaded
+  for n in $TERMINALS; do
+    harness_start "sleep 100000"
+    rm -f "$HARNESS_DIR"/done.*
+
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt $n ]; do
+      harness_call run_command \
+        "string:sh $HARNESS_DIR/flood.sh $HARNESS_DIR/text $HARNESS_DIR/done.$i" >/dev/null || exit 1
+      i=$((i + 1))
+    done
+
+    max_reply=0
+    while [ $(ls "$HARNESS_DIR" | grep -c '^done\.[0-9]*$') -lt $n ]; do
+      before=$(harness_now_ms)
+      harness_call get_memory >/dev/null || exit 1
+      reply=$(($(harness_now_ms) - before))
+      [ $reply -gt $max_reply ] && max_reply=$reply
+      if [ $(((before - start / 1000000) / 1000)) -gt 600 ]; then
+        echo "$0: threaded_pty=$threaded terminals=$n did not finish in 10 minutes" >&2
+        exit 1
+      fi
+      sleep 0.1
+    done
+
+    end=$(cat "$HARNESS_DIR"/done.* | sort -n | tail -n 1)
+    ms=$(((end - start) / 1000000))
+    [ $ms -gt 0 ] || ms=1
+    echo "threaded_pty=$threaded terminals=$n bytes=$((BYTES * n)) ms=$ms kb_per_s=$((BYTES * n / ms)) max_reply_ms=$max_reply"
+
+    harness_stop
+  done
+done
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Opens and closes a window $CYCLES times over D-Bus, the first window staying
+# open throughout, and fails if closed windows and terminals are not freed,
+# or if the resident size grows by more than $MAX_GROWTH_KB past the first
+# $WARMUP cycles, which load what is only loaded once.
+
+. "$(dirname "$0")/harness.sh"
+
+: ${CYCLES:=50}
+: ${WARMUP:=5}
+: ${MAX_GROWTH_KB:=2048}
+
+# Waits for the window of the last cycle to be gone and freed, and prints the
+# memory once it is
+settle()
+{
+  tries=0
+  while :; do
+    memory=$(harness_call get_memory) || exit 1
+    case "$memory" in
+      *" windows=1 terminals=1")
+        echo "$memory"
+        return
+        ;;
+    esac
+    tries=$((tries + 1))
+    if [ $tries -gt 100 ]; then
+      echo "$0: closed windows are not freed: $memory" >&2
+      exit 1
+    fi
+    sleep 0.1
+  done
+}
+
+harness_start "sleep 100000"
+settle >/dev/null
+
+cycle=1
+while [ $cycle -le $CYCLES ]; do
+  harness_call run_command string:true >/dev/null || exit 1
+  memory=$(settle)
+  echo "cycle=$cycle $memory"
+
+  rss=${memory#rss_kb=}
+  rss=${rss%% *}
+  if [ $cycle -eq $WARMUP ]; then
+    baseline=$rss
+  elif [ $cycle -gt $WARMUP ] && [ $((rss - baseline)) -gt $MAX_GROWTH_KB ]; then
+    echo "$0: grew by $((rss - baseline)) kB in $((cycle - WARMUP)) cycles" >&2
+    exit 1
+  fi
+
+  cycle=$((cycle + 1))
+done